@@ -0,0 +1,306 @@
+/*
+  Host (Linux) benchmark for the MACHINE class, no hardware needed
+    - compiles machine.h from one of the sketch folders against the Arduino stubs in ./stub (see hostMachine.h)
+    - times parsePGN() (incl updateStates()/updateMachineStates() and the output pins/callbacks) for each PGN type
+    - also runs a synthetic AgIO stream and optionally a recording, through PgnFramer like the sketches do
+    - counts heap allocations, the parse path should not allocate at all with debugLevel 0 (exits with 1 if it does)
+    - Teensy: PCA9555 output words through i2cAsyncWriter.h on the mock bus, none should fail (exits with 1 if any do)
+
+  make              builds bench_esp32, bench_teensy & bench_nano
+  make run          runs all three, one after the other to compare them
+
+  ./bench_teensy [-n frames] [-d debugLevel] [-f recording.hex]
+    recording.hex is one UDP packet (port 8888) per line as hex, ie Wireshark "Copy...as a Hex Stream", # for comments
+*/
+
+#include <stdlib.h>
+#include <new>
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include "hostMachine.h"
+#ifdef BENCH_TEENSY
+  #include "../Machine_Teensy/i2cAsyncWriter.h"
+#endif
+
+
+// ********************************************* heap counting *************************************
+uint32_t allocCount = 0;
+uint64_t allocBytes = 0;
+
+void* operator new(size_t size) {
+  allocCount++;
+  allocBytes += size;
+  void* p = malloc(size ? size : 1);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+void* operator new[](size_t size) { return operator new(size); }
+// noinline, or gcc sees the free() inlined against a new expression and warns (-Wmismatched-new-delete)
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+__attribute__((noinline)) void operator delete[](void* p, size_t) noexcept { free(p); }
+
+
+// ********************************************* PGN builders **************************************
+typedef std::vector<uint8_t> Frame;
+
+Frame makePgn(uint8_t pgn, const std::vector<uint8_t>& data) {
+  Frame f(PgnFramer::HEADER_LEN + data.size() + 1);
+  f[0] = 0x80; f[1] = 0x81; f[2] = 0x7F; f[3] = pgn; f[4] = data.size();
+  memcpy(&f[PgnFramer::HEADER_LEN], data.data(), data.size());
+  machine.calculateAndSetCRC(f.data(), f.size());
+  return f;
+}
+
+Frame sectionData(uint64_t sections) {        // 0xE5 (229) - 64 Section Data
+  std::vector<uint8_t> d;
+  for (uint8_t i = 0; i < 8; i++) d.push_back(sections >> (i * 8));
+  d.push_back(50); d.push_back(50);           // left/right speed
+  return makePgn(229, d);
+}
+
+Frame machineData(uint8_t hydLift, uint8_t sec1to8, uint8_t sec9to16) {   // 0xEF (239) - Machine Data
+  return makePgn(239, { 0, 50, hydLift, 0, 0, 0, sec1to8, sec9to16 });
+}
+
+Frame sectionDims() {                         // 0xEB (235) - Section Dimensions
+  std::vector<uint8_t> d;
+  for (uint8_t i = 0; i < 16; i++) { d.push_back(300 & 0xFF); d.push_back(300 >> 8); }
+  d.push_back(16);
+  return makePgn(235, d);
+}
+
+Frame pinConfig() {                           // 0xEC (236) - Machine Pin Config
+  std::vector<uint8_t> d;
+  for (uint8_t i = 0; i < 24; i++) d.push_back(i < 16 ? i + 1 : 0);
+  return makePgn(236, d);
+}
+
+Frame machineConfig() {                       // 0xEE (238) - Machine Config
+  return makePgn(238, { 2, 4, 1, 0, 0, 0, 0, 0 });
+}
+
+Frame steerData() {                           // 0xFE (254) - Steer Data, not a machine PGN
+  return makePgn(254, { 50, 0, 0, 0, 0, 0, 0, 0 });
+}
+
+Frame helloFromAgIO() { return { 0x80, 0x81, 0x7F, 200, 3, 56, 0, 0, 0x47 }; }      // AgIO doesn't send a real CRC
+Frame scanRequest() { return { 0x80, 0x81, 0x7F, 202, 3, 202, 202, 5, 0x47 }; }
+
+
+// ********************************************* measuring *****************************************
+struct Result {
+  double nsPerFrame;
+  uint32_t allocs;
+};
+
+bool allocsInParsePath = false;
+bool isI2cErrors = false;
+
+// calls parse() iterations times, cycling through frames, and prints one line of results
+Result measure(const char* name, const std::vector<Frame>& frames, uint32_t iterations, bool viaFramer = false) {
+  std::vector<Frame> work = frames;           // parse from our own copy, some handlers might write to the buffer
+  for (uint32_t i = 0; i < 100; i++) {        // warm up caches & branch predictors
+    Frame& f = work[i % work.size()];
+    if (viaFramer) PgnFramer::parseBuffer(f.data(), f.size(), checkPgn);
+    else parse(f.data(), f.size());
+  }
+
+  uint32_t allocStart = allocCount;
+  uint32_t pinWritesStart = hostPins().writes;
+  uint32_t portWritesStart = hostPins().portWrites;
+  uint32_t callbacksStart = callbackCount;
+  uint32_t eeWritesStart = EEPROM.writes;
+  uint32_t numFrames = 0;
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    Frame& f = work[i % work.size()];
+    if (viaFramer) numFrames += PgnFramer::parseBuffer(f.data(), f.size(), checkPgn);
+    else { parse(f.data(), f.size()); numFrames++; }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+  Result r;
+  r.nsPerFrame = numFrames ? ns / numFrames : 0;
+  r.allocs = allocCount - allocStart;
+
+  printf("%-34s %9.1f %12.0f %8.3f %9.3f %10.3f %9.3f %8.3f\n", name, r.nsPerFrame, r.nsPerFrame > 0 ? 1e9 / r.nsPerFrame : 0,
+    numFrames ? (double)r.allocs / numFrames : 0,
+    numFrames ? (double)(hostPins().writes - pinWritesStart) / numFrames : 0,
+    numFrames ? (double)(hostPins().portWrites - portWritesStart) / numFrames : 0,
+    numFrames ? (double)(callbackCount - callbacksStart) / numFrames : 0,
+    numFrames ? (double)(EEPROM.writes - eeWritesStart) / numFrames : 0);
+
+  if (r.allocs > 0 && machine.debugLevel == 0) allocsInParsePath = true;
+  return r;
+}
+
+void printHeader(const char* title) {
+  printf("\n%s\n", title);
+  printf("%-34s %9s %12s %8s %9s %10s %9s %8s\n", "", "ns/frame", "frames/sec", "allocs", "pinWrites", "portWrites", "callbacks", "eeWrites");
+}
+
+
+#ifdef BENCH_TEENSY
+// PCA9555 outputs (AiO v5.0a) through i2cAsyncWriter.h on the mock 400khz bus, a new output word every intervalUs
+// shows what write() costs the parse path and how many words get coalesced when they come faster then the bus
+I2cAsyncWriter i2cWriter;                     // writers stay on the bus once begin() is called, so only one for all the tests
+
+void measureI2cWriter(const char* name, uint32_t intervalUs, uint32_t iterations) {
+  I2cAsyncWriter& writer = i2cWriter;
+  writer.begin(0x20, 2);
+  writer.transfers = writer.coalesced = writer.errors = 0;
+  HostI2cBus& bus = hostI2cBus();
+  uint32_t busStart = bus.transfers;
+  uint64_t us = HostClock::now();
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) {
+    HostClock::set(us += intervalUs);
+    bus.poll();                               // the I2C interrupt
+    writer.write(i & 1 ? 0x00FF : 0xFF00);
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  writer.waitIdle();
+
+  double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+  printf("%-34s %9.1f %10u %10u %10u %8u\n", name, ns / iterations, iterations,
+    bus.transfers - busStart, writer.coalesced, writer.errors);
+  if (writer.errors != 0) isI2cErrors = true;       // nothing on the mock bus fails, it's the timing
+}
+#endif
+
+
+// ********************************************* recordings ****************************************
+// one packet per line as hex, spaces/colons between bytes are ignored
+std::vector<Frame> loadRecording(const char* path) {
+  std::vector<Frame> packets;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    Frame packet;
+    std::string hex;
+    for (char c : line) if (isxdigit((unsigned char)c)) hex += c;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) packet.push_back((uint8_t)strtoul(hex.substr(i, 2).c_str(), NULL, 16));
+    if (!packet.empty()) packets.push_back(packet);
+  }
+  return packets;
+}
+
+
+int main(int argc, char** argv) {
+  uint32_t iterations = 200000;
+  int debugLevel = 0;
+  const char* recording = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) iterations = strtoul(argv[++i], NULL, 10);
+    else if (arg == "-d" && i + 1 < argc) debugLevel = atoi(argv[++i]);
+    else if (arg == "-f" && i + 1 < argc) recording = argv[++i];
+    else {
+      printf("usage: %s [-n frames] [-d debugLevel] [-f recording.hex]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  machineInit();
+  machine.debugLevel = debugLevel;
+
+  // pin config & machine config first so the section/machine data below drives real outputs
+  Frame pins = pinConfig(), config = machineConfig();
+  parse(pins.data(), pins.size());
+  parse(config.data(), config.size());
+
+  printf("\n*** %s MACHINE class, %u frames per test, debugLevel %d ***\n", variant, iterations, debugLevel);
+
+  printHeader("parsePGN() by PGN type");
+  measure("229 Section Data, no change", { sectionData(0x00FF00FF00FF00FFULL) }, iterations);
+  measure("229 Section Data, every frame new", { sectionData(0x00FF00FF00FF00FFULL), sectionData(0xFF00FF00FF00FF00ULL) }, iterations);
+  measure("239 Machine Data, no change", { machineData(1, 0x0F, 0) }, iterations);
+  measure("239 Machine Data, every frame new", { machineData(1, 0x0F, 0), machineData(2, 0xF0, 0xFF) }, iterations);
+  measure("235 Section Dimensions", { sectionDims() }, iterations);
+  measure("236 Pin Config, no change", { pinConfig() }, iterations);
+  measure("238 Machine Config, no change", { machineConfig() }, iterations);
+  measure("200 Hello from AgIO", { helloFromAgIO() }, iterations);
+  measure("202 Scan Request", { scanRequest() }, iterations);
+  measure("254 Steer Data (not machine)", { steerData() }, iterations);
+  Frame badCrc = sectionData(0xFF);
+  badCrc.back()++;
+  measure("229 Section Data, bad CRC", { badCrc }, iterations);
+#ifndef BENCH_ESP32
+  machine.setSectionsOnly(true);              // sections straight to the pins, no pin function map
+  measure("229 Section Data, sections only", { sectionData(0x00FF00FF00FF00FFULL), sectionData(0xFF00FF00FF00FF00ULL) }, iterations);
+  machine.setSectionsOnly(false);
+#endif
+
+  // what AgIO sends every GPS update (10hz), each PGN in its own packet, sections changing every 5th update
+  std::vector<Frame> stream, packed;
+  for (uint8_t cycle = 0; cycle < 50; cycle++) {
+    uint64_t sections = (cycle / 5) & 1 ? 0xFFFFULL : 0x0FF0ULL;
+    Frame cycleFrames[] = { steerData(), machineData(1, sections, sections >> 8), sectionData(sections) };
+    Frame all;
+    for (Frame& f : cycleFrames) {
+      stream.push_back(f);
+      all.insert(all.end(), f.begin(), f.end());
+    }
+    if (cycle % 10 == 0) stream.push_back(helloFromAgIO());
+    packed.push_back(all);
+  }
+  printHeader("synthetic AgIO stream, through PgnFramer");
+  measure("one PGN per packet", stream, iterations, true);
+  measure("one packet per GPS update", packed, iterations / 3, true);
+
+#ifdef BENCH_TEENSY
+  uint64_t clockUs = HostClock::now();
+  printf("\nPCA9555 outputs, i2cAsyncWriter.h on a mock 400khz bus (a 2 byte write takes 95us)\n");
+  printf("%-34s %9s %10s %10s %10s %8s\n", "", "ns/write", "writes", "transfers", "coalesced", "errors");
+  measureI2cWriter("new outputs every 1ms", 1000, iterations);
+  measureI2cWriter("new outputs every 100us", 100, iterations);
+  measureI2cWriter("new outputs every 20us", 20, iterations);
+  HostClock::set(clockUs);
+  HostClock::useRealClock();
+#endif
+
+  if (recording != NULL) {
+    std::vector<Frame> packets = loadRecording(recording);
+    if (packets.empty()) {
+      printf("\nno packets found in %s\n", recording);
+      return 2;
+    }
+
+    // split the recording into single PGNs, by type, so each type can be timed on its own too
+    std::vector<Frame> byPgn[256];
+    for (Frame& p : packets) {
+      PgnFramer::parseBuffer(p.data(), p.size(), [&](uint8_t* pgnData, uint8_t len) { byPgn[pgnData[3]].push_back(Frame(pgnData, pgnData + len)); });
+    }
+
+    char name[40];
+    snprintf(name, sizeof(name), "%s", recording);
+    printHeader("recording, in recorded order through PgnFramer");
+    measure(name, packets, iterations, true);
+
+    printHeader("recording, by PGN type");
+    for (uint16_t pgn = 0; pgn < 256; pgn++) {
+      if (byPgn[pgn].empty()) continue;
+      snprintf(name, sizeof(name), "%3u (%u in recording)", pgn, (unsigned)byPgn[pgn].size());
+      measure(name, byPgn[pgn], iterations);
+    }
+  }
+
+  if (allocsInParsePath) {
+    printf("\n*** heap allocations in the parse path with debugLevel 0 ***\n");
+    return 1;
+  }
+  if (isI2cErrors) {
+    printf("\n*** I2C errors on the mock bus ***\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+  The MACHINE class from one of the sketch folders, set up like the sketch does, for the host tools (bench.cpp, replay.cpp)
+    - pick the sketch with -DBENCH_ESP32, -DBENCH_TEENSY or -DBENCH_NANO (see Makefile)
+    - defines globals (Serial, EEPROM, machine), only include it from the .cpp with main()
+    - onOutputChange is called when the outputs change, the ESP32 output callbacks or a pin changing level on Teensy/Nano
+*/
+
+#ifndef HOSTMACHINE_H
+#define HOSTMACHINE_H
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "IPAddress.h"
+
+HostSerial Serial;
+HostEEPROM EEPROM;
+
+#if defined(BENCH_ESP32)
+  #include "../Machine_ESP32/Machine_ESP32/machine.h"
+  #include "../Machine_ESP32/Machine_ESP32/pgnFramer.h"
+  const char* variant = "ESP32";
+#elif defined(BENCH_TEENSY)
+  #include "../Machine_Teensy/machine.h"
+  #include "../Machine_Teensy/pgnFramer.h"
+  const char* variant = "Teensy";
+#elif defined(BENCH_NANO)
+  #include "../Machine_Nano_ENC28J60/machine.h"
+  #include "../Machine_Nano_ENC28J60/pgnFramer.h"
+  const char* variant = "Nano";
+#else
+  #error "define BENCH_ESP32, BENCH_TEENSY or BENCH_NANO (see Makefile)"
+#endif
+
+MACHINE machine;
+uint8_t outputPins[] = { 2, 3, 4, 5, 6, 7, 8, 9, A0, A1, A2, A3, A4, A5 };    // same as the Nano example
+uint32_t callbackCount = 0;
+void (*onOutputChange)() = NULL;
+
+#ifdef BENCH_ESP32
+  IPAddress sourceIP(192, 168, 5, 10);
+  IPAddress myIP(192, 168, 5, 123);
+
+  void pinsCallback(uint32_t, uint32_t, uint32_t) {
+    callbackCount++;
+    machine.outputWritten(micros());
+    if (onOutputChange != NULL) onOutputChange();
+  }
+  void sectionsCallback(uint64_t, uint64_t, uint64_t) {
+    callbackCount++;
+    machine.outputWritten(micros());
+    if (onOutputChange != NULL) onOutputChange();
+  }
+  void replyCallback(const uint8_t*, uint8_t, IPAddress) { callbackCount++; }
+
+  void machineInit() {
+    machine.init(100);
+    machine.setMachineOutputsHandler(pinsCallback);
+    machine.setSectionOutputsHandler(sectionsCallback);
+    machine.setUdpReplyHandler(replyCallback);
+  }
+  bool parse(uint8_t* pgnData, uint8_t len) { return machine.parsePGN(pgnData, len, sourceIP, myIP); }
+#else
+  uint8_t prevPinLevel[256];
+
+  void pinWritten(uint8_t pin, uint8_t value) {
+    if (value == prevPinLevel[pin]) return;     // forced updates (config changes) write every pin, only count the ones that changed
+    prevPinLevel[pin] = value;
+    if (onOutputChange != NULL) onOutputChange();
+  }
+
+  void machineInit() {
+    hostPins().onWrite = pinWritten;
+    machine.init(outputPins, sizeof(outputPins), 100);
+  }
+  bool parse(uint8_t* pgnData, uint8_t len) { return machine.parsePGN(pgnData, len); }
+#endif
+
+// same as CheckPGN()/parsePgn()/checkForPGN() in the sketches, minus the other modules' PGNs
+void checkPgn(uint8_t* pgnData, uint8_t len) {
+  if (pgnData[0] != 0x80 || pgnData[1] != 0x81 || pgnData[2] != 0x7F) return;
+  if (pgnData[3] == 254 && len == 14) machine.steerDataArrived();     // steerData() in the sketches
+  else parse(pgnData, len);
+}
+
+#endif
@@ -0,0 +1,320 @@
+/*
+  Replays a pcap of AgIO traffic into the MACHINE class and measures how long section changes take to reach the outputs
+    - UDP packets to port 8888 (AgIO > modules) are fed through PgnFramer like the sketches do, everything else is ignored
+    - millis()/micros() follow the capture timestamps, so the watchdog and hyd lift timers see the original timing
+      no matter how fast the capture is replayed, loop() (watchdogCheck) is run every 1ms of capture time between packets
+    - a "section change" is a 64 Section Data PGN that changes any of the watched sections
+    - latency is from that PGN arriving until the outputs change (a pin changing level on Teensy/Nano, the output callbacks on ESP32)
+      capture time in between (if the outputs waited for a later packet) + the host time spent in the packet that changed them
+    - a change is missed if the outputs didn't change before the next section change (or the end of the capture)
+    - MACHINE's own sectionLatency histogram is printed too, it only sees capture time (0 unless the output scheduler holds the writes)
+    - and the 64 Section Data & Steer Data rates commsWatchdog learned, with the alert/OFF times they give
+
+  ./replay_teensy capture.pcap [-x speed] [-s sections] [-p port] [-d debugLevel] [-t tickUs] [-l latencyUs]
+    -x 0 as fast as possible (default), 1 original timing, 10 ten times faster etc
+    -s number of sections to watch, starting with section 1, default 8 (the default pin config is sections 1-8 on pins 1-8)
+    -t Teensy/Nano: write the outputs through the output scheduler (outputScheduler.h) with tickUs ticks, loop() then runs every tick
+    -l output scheduler latency, default 2000us
+    pcapng captures need converting first: editcap -F pcap capture.pcapng capture.pcap
+*/
+
+#include <stdlib.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+
+#include "hostMachine.h"
+
+
+// ********************************************* pcap reading **************************************
+struct UdpPacket {
+  uint64_t timeUs;          // capture timestamp
+  uint16_t srcPort;
+  uint16_t dstPort;
+  std::vector<uint8_t> data;
+};
+
+static uint16_t be16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+
+class PcapReader
+{
+public:
+  std::string error;
+
+  bool open(const char* path) {
+    file = fopen(path, "rb");
+    if (file == NULL) { error = "can't open file"; return false; }
+
+    uint8_t header[24];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)) { error = "too short for a pcap file"; return false; }
+    uint32_t magic;
+    memcpy(&magic, header, 4);
+    if (magic == 0xA1B2C3D4) { swapped = false; nanoRes = false; }
+    else if (magic == 0xD4C3B2A1) { swapped = true; nanoRes = false; }
+    else if (magic == 0xA1B23C4D) { swapped = false; nanoRes = true; }
+    else if (magic == 0x4D3CB2A1) { swapped = true; nanoRes = true; }
+    else if (magic == 0x0A0D0D0A) { error = "pcapng isn't supported, convert it with: editcap -F pcap in.pcapng out.pcap"; return false; }
+    else { error = "not a pcap file"; return false; }
+    linkType = read32(&header[20]);
+    return true;
+  }
+
+  // next IPv4 UDP packet, false at the end of the file
+  bool next(UdpPacket& packet) {
+    uint8_t record[16];
+    std::vector<uint8_t> frame;
+    while (fread(record, 1, sizeof(record), file) == sizeof(record)) {
+      uint32_t seconds = read32(&record[0]);
+      uint32_t fraction = read32(&record[4]);
+      uint32_t capturedLen = read32(&record[8]);
+      frame.resize(capturedLen);
+      if (fread(frame.data(), 1, capturedLen, file) != capturedLen) break;
+
+      packet.timeUs = (uint64_t)seconds * 1000000 + (nanoRes ? fraction / 1000 : fraction);
+      if (decode(frame, packet)) return true;
+    }
+    return false;
+  }
+
+  ~PcapReader() { if (file != NULL) fclose(file); }
+
+private:
+  FILE* file = NULL;
+  bool swapped = false;
+  bool nanoRes = false;
+  uint32_t linkType = 0;
+
+  uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return swapped ? __builtin_bswap32(v) : v;
+  }
+
+  bool decode(const std::vector<uint8_t>& frame, UdpPacket& packet) {
+    size_t ip = 0;
+    uint16_t etherType = 0x0800;
+    if (linkType == 1) {                        // Ethernet
+      if (frame.size() < 14) return false;
+      etherType = be16(&frame[12]);
+      ip = 14;
+      if (etherType == 0x8100 && frame.size() >= 18) { etherType = be16(&frame[16]); ip = 18; }   // VLAN tag
+    } else if (linkType == 113) {               // Linux cooked capture (tcpdump -i any)
+      if (frame.size() < 16) return false;
+      etherType = be16(&frame[14]);
+      ip = 16;
+    } else if (linkType == 276) {               // Linux cooked capture v2
+      if (frame.size() < 20) return false;
+      etherType = be16(&frame[0]);
+      ip = 20;
+    } else if (linkType == 0) {                 // BSD loopback
+      ip = 4;
+    } else if (linkType != 101 && linkType != 12 && linkType != 228) {    // raw IPv4
+      return false;
+    }
+    if (etherType != 0x0800 || frame.size() < ip + 20) return false;
+
+    const uint8_t* p = &frame[ip];
+    if ((p[0] >> 4) != 4 || p[9] != 17) return false;      // IPv4, UDP
+    if (be16(&p[6]) & 0x3FFF) return false;                  // fragments, AgIO packets are never this big
+    size_t udp = ip + (p[0] & 0x0F) * 4;
+    if (frame.size() < udp + 8) return false;
+
+    const uint8_t* u = &frame[udp];
+    packet.srcPort = be16(&u[0]);
+    packet.dstPort = be16(&u[2]);
+    size_t len = std::min((size_t)be16(&u[4]), frame.size() - udp);
+    if (len < 8) return false;
+    packet.data.assign(frame.begin() + udp + 8, frame.begin() + udp + len);
+    return true;
+  }
+};
+
+
+// ********************************************* latency tracking **********************************
+uint64_t watchedSections = 0xFF;
+uint64_t lastSections = 0;
+bool haveSections = false;
+
+bool changePending = false;
+uint64_t changeTimeUs;                                  // capture time of the pending section change
+std::chrono::steady_clock::time_point stepStart;        // host time at the start of the current packet/loop step
+
+std::vector<double> latenciesUs;
+uint32_t sectionChanges = 0, missedChanges = 0, otherOutputChanges = 0;
+uint32_t pgnCount[256];
+uint32_t tickUs = 0, latencyUs = 2000;
+
+// what loop() does in the sketches, plus the output scheduler's timer interrupt
+void runLoop() {
+#ifndef BENCH_ESP32
+  machine.outputScheduler.poll();
+#endif
+  machine.watchdogCheck();
+}
+
+void outputChanged() {
+  static std::chrono::steady_clock::time_point lastStep;
+  if (stepStart == lastStep) return;      // several pins (or both ESP32 callbacks) changing in the same update is one output change
+  lastStep = stepStart;
+
+  if (!changePending) {
+    otherOutputChanges++;       // ie the watchdog turning everything off, hyd lift timers, tramlines
+    return;
+  }
+  double hostUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - stepStart).count();
+  latenciesUs.push_back((HostClock::now() - changeTimeUs) + hostUs);
+  changePending = false;
+}
+
+// looks for section changes before handing the PGN to the MACHINE class
+void replayPgn(uint8_t* pgnData, uint8_t len) {
+  pgnCount[pgnData[3]]++;
+
+  if (pgnData[3] == 229 && len == 16 && pgnData[len - 1] == MACHINE::calculateCRC(pgnData, len)) {
+    uint64_t sections;
+    memcpy(&sections, &pgnData[5], 8);
+    sections &= watchedSections;
+
+    if (haveSections && sections != lastSections) {
+      sectionChanges++;
+      if (changePending) missedChanges++;     // the previous change never reached the outputs
+      changePending = true;
+      changeTimeUs = HostClock::now();
+    }
+    lastSections = sections;
+    haveSections = true;
+  }
+
+  checkPgn(pgnData, len);
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t i = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+
+int main(int argc, char** argv) {
+  const char* path = NULL;
+  double speed = 0;
+  int numSections = 8;
+  uint16_t port = 8888;
+  int debugLevel = 0;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-x" && i + 1 < argc) speed = atof(argv[++i]);
+    else if (arg == "-s" && i + 1 < argc) numSections = atoi(argv[++i]);
+    else if (arg == "-p" && i + 1 < argc) port = atoi(argv[++i]);
+    else if (arg == "-d" && i + 1 < argc) debugLevel = atoi(argv[++i]);
+    else if (arg == "-t" && i + 1 < argc) tickUs = atoi(argv[++i]);
+    else if (arg == "-l" && i + 1 < argc) latencyUs = atoi(argv[++i]);
+    else if (arg[0] != '-' && path == NULL) path = argv[i];
+    else path = NULL, i = argc;
+  }
+  if (path == NULL || numSections < 1 || numSections > 64) {
+    printf("usage: %s capture.pcap [-x speed] [-s sections] [-p port] [-d debugLevel] [-t tickUs] [-l latencyUs]\n", argv[0]);
+    return 2;
+  }
+  watchedSections = numSections == 64 ? ~0ULL : (1ULL << numSections) - 1;
+
+  PcapReader pcap;
+  if (!pcap.open(path)) {
+    printf("%s: %s\n", path, pcap.error.c_str());
+    return 2;
+  }
+
+  // the clock starts where it is now (elapsedMillis timers in MACHINE are already running) and follows the capture from here
+  uint64_t clockStartUs = HostClock::realMicros();
+  HostClock::set(clockStartUs);
+  machineInit();
+  machine.debugLevel = debugLevel;
+  onOutputChange = outputChanged;
+#ifdef BENCH_ESP32
+  if (tickUs) {
+    printf("-t: the ESP32 output scheduler is in the sketch (outputs.ino), not the MACHINE class\n");
+    return 2;
+  }
+#else
+  if (tickUs && !machine.startOutputScheduler(tickUs, latencyUs)) {
+    printf("output scheduler didn't start\n");
+    return 2;
+  }
+#endif
+  uint32_t stepUs = (tickUs ? tickUs : 1000);
+
+  UdpPacket packet;
+  uint64_t firstPacketUs = 0, lastPacketUs = 0;
+  uint32_t numPackets = 0, otherPackets = 0;
+  auto wallStart = std::chrono::steady_clock::now();
+
+  while (pcap.next(packet)) {
+    if (packet.dstPort != port) {
+      otherPackets++;           // ie module replies to AgIO on 9999
+      continue;
+    }
+    if (numPackets == 0) firstPacketUs = packet.timeUs;
+    if (packet.timeUs < lastPacketUs) packet.timeUs = lastPacketUs;     // captures can have timestamps out of order
+    uint64_t packetClockUs = clockStartUs + (packet.timeUs - firstPacketUs);
+
+    // run loop() every 1ms (or on every scheduler tick) of capture time up to this packet
+    while (HostClock::now() + stepUs < packetClockUs) {
+      uint64_t sinceStep = (tickUs ? (HostClock::now() - clockStartUs) % stepUs : 0);    // back on the tick grid after a packet
+      HostClock::set(HostClock::now() + stepUs - sinceStep);
+      stepStart = std::chrono::steady_clock::now();
+      runLoop();
+    }
+    HostClock::set(packetClockUs);
+
+    if (speed > 0) {
+      std::this_thread::sleep_until(wallStart + std::chrono::microseconds((uint64_t)((packet.timeUs - firstPacketUs) / speed)));
+    }
+
+    stepStart = std::chrono::steady_clock::now();
+    machine.stampPacket(micros());
+    PgnFramer::parseBuffer(packet.data.data(), packet.data.size(), replayPgn);
+    runLoop();
+
+    lastPacketUs = packet.timeUs;
+    numPackets++;
+  }
+  for (uint32_t us = 0; tickUs && us <= latencyUs + tickUs; us += stepUs) {     // the last change is still queued
+    HostClock::set(HostClock::now() + stepUs);
+    stepStart = std::chrono::steady_clock::now();
+    runLoop();
+  }
+  if (changePending) missedChanges++;
+
+  double wallSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  double captureSec = (lastPacketUs - firstPacketUs) / 1e6;
+
+  printf("\n*** %s MACHINE class, %s ***\n", variant, path);
+  printf("%u packets to port %u (%u other UDP packets skipped), %.1fs of capture replayed in %.2fs\n",
+    numPackets, port, otherPackets, captureSec, wallSec);
+  printf("PGNs:");
+  for (uint16_t pgn = 0; pgn < 256; pgn++) {
+    if (pgnCount[pgn]) printf(" %u:%u", pgn, pgnCount[pgn]);
+  }
+  printf("\n");
+
+  std::sort(latenciesUs.begin(), latenciesUs.end());
+  printf("\nsection changes (sections 1-%d): %u, reached the outputs: %u, missed: %u, other output changes: %u\n",
+    numSections, sectionChanges, (unsigned)latenciesUs.size(), missedChanges, otherOutputChanges);
+  if (!latenciesUs.empty()) {
+    printf("latency us   p50 %.3f   p90 %.3f   p99 %.3f   p99.9 %.3f   max %.3f\n",
+      percentile(latenciesUs, 50), percentile(latenciesUs, 90), percentile(latenciesUs, 99),
+      percentile(latenciesUs, 99.9), latenciesUs.back());
+  }
+  printf("MACHINE sectionLatency: %u samples   p50 %u   p99 %u   max %u (capture time, so only the time the output scheduler holds the writes)\n",
+    (unsigned)machine.sectionLatency.count, (unsigned)machine.sectionLatency.percentile(50),
+    (unsigned)machine.sectionLatency.percentile(99), (unsigned)machine.sectionLatency.maxUs);
+  const char* streamNames[2] = { "64 Section Data", "Steer Data" };
+  for (uint8_t s = 0; s < 2; s++) {
+    printf("MACHINE commsWatchdog %s: mean %ums   jitter %ums   alert %ums   OFF %ums%s\n", streamNames[s],
+      machine.commsWatchdog.meanMs(s), machine.commsWatchdog.jitterMs(s), machine.commsWatchdog.alertMs(s),
+      machine.commsWatchdog.timeoutMs(s), machine.commsWatchdog.isLearned(s) ? "" : " (not learned)");
+  }
+  return 0;
+}
@@ -0,0 +1,208 @@
+/*
+  Just enough of the Arduino core to compile the machine.h files on Linux (see ../bench.cpp)
+    - Serial output is thrown away, the bench measures the class not the UART
+    - digitalWrite() is recorded in hostPins so tests can see when outputs change, so are the mock port registers (outputPorts.h)
+    - a mock I2C bus for i2cAsyncWriter.h (Teensy PCA9555 outputs), in HostClock time
+    - micros()/millis() follow the real clock unless HostClock::set() is used (ie replaying a capture faster then real time)
+*/
+
+#ifndef ARDUINO_H_STUB
+#define ARDUINO_H_STUB
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <chrono>
+#include <type_traits>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define B0000000 0              // binary.h, only the ones used by machine.h
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+
+#define F(s) s
+#define PROGMEM
+#define memcpy_P memcpy
+
+// the Arduino min/max are macros that take mixed types
+template <class A, class B> inline typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template <class A, class B> inline typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+
+
+// ********************************************* clock *********************************************
+namespace HostClock {
+  inline bool& manual() { static bool isManual = false; return isManual; }
+  inline uint64_t& manualMicros() { static uint64_t us = 0; return us; }
+
+  inline uint64_t realMicros() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+  }
+
+  // from now on micros()/millis() only change when set() is called
+  inline void set(uint64_t us) { manual() = true; manualMicros() = us; }
+  inline void useRealClock() { manual() = false; }
+
+  inline uint64_t now() { return manual() ? manualMicros() : realMicros(); }
+}
+
+// 32 bits like the targets, so they wrap the same way (micros() every 71 minutes) and uint32_t time maths sees what it would there
+inline uint32_t micros() { return uint32_t(HostClock::now()); }
+inline uint32_t millis() { return uint32_t(HostClock::now() / 1000); }
+inline void delay(unsigned long) {}
+inline void delayMicroseconds(unsigned int) {}
+
+
+// ********************************************* pins **********************************************
+struct HostPins {
+  uint8_t level[256];
+  uint8_t mode[256];
+  uint32_t writes = 0;                                  // total digitalWrite() calls
+  uint32_t portWrites = 0;                              // total mock port register writes (outputPorts.h)
+  void (*onWrite)(uint8_t pin, uint8_t value) = NULL;   // optional, ie to timestamp output changes
+};
+inline HostPins& hostPins() { static HostPins pins; return pins; }
+
+inline void pinMode(uint8_t pin, uint8_t mode) { hostPins().mode[pin] = mode; }
+inline int digitalRead(uint8_t pin) { return hostPins().level[pin]; }
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+  HostPins& pins = hostPins();
+  pins.level[pin] = value ? HIGH : LOW;
+  pins.writes++;
+  if (pins.onWrite != NULL) pins.onWrite(pin, pins.level[pin]);
+}
+
+// mock GPIO set/clear registers for outputPorts.h, 8 pins per port (pin 10 is port 1 bit 2)
+// writing a mask to one sets/clears those pins in hostPins, like a digitalWrite() for each of them
+#define HOST_GPIO_PORTS
+struct HostPortRegister {
+  uint8_t port;
+  bool isSet;
+
+  void operator=(uint32_t mask) {
+    HostPins& pins = hostPins();
+    pins.portWrites++;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      if (!(mask & (1UL << bit))) continue;
+      uint8_t pin = port * 8 + bit;
+      pins.level[pin] = isSet ? HIGH : LOW;
+      if (pins.onWrite != NULL) pins.onWrite(pin, pins.level[pin]);
+    }
+  }
+};
+inline HostPortRegister* hostPortRegisters(bool isSet) {
+  static HostPortRegister regs[2][32];
+  static bool isInit = false;
+  if (!isInit) {
+    for (uint8_t port = 0; port < 32; port++) {
+      regs[0][port].port = regs[1][port].port = port;
+      regs[1][port].isSet = true;
+    }
+    isInit = true;
+  }
+  return regs[isSet];
+}
+inline HostPortRegister* hostPortSetRegister(uint8_t pin) { return &hostPortRegisters(true)[pin >> 3]; }
+inline HostPortRegister* hostPortClearRegister(uint8_t pin) { return &hostPortRegisters(false)[pin >> 3]; }
+inline uint32_t hostPinBitMask(uint8_t pin) { return 1UL << (pin & 7); }
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+
+// ********************************************* I2C ***********************************************
+// mock bus for i2cAsyncWriter.h, one transfer at a time that takes as long as it would on a real bus
+// (9 bits per byte incl the address, + start & stop), poll() finishes it once HostClock gets there, like the interrupt would
+#define HOST_I2C_BUS
+struct HostI2cBus {
+  uint32_t clockHz = 400000;
+  bool isNack = false;                                  // no chip at the address, every transfer fails
+  uint32_t transfers = 0;                               // total started
+  uint8_t lastAddress = 0;
+  uint8_t lastData[8];                                  // bytes after the address of the last transfer started
+  uint8_t lastLen = 0;
+  bool isBusy = false;
+  uint64_t doneUs = 0;
+  void (*onDone)(bool isOK) = NULL;
+
+  void start(uint8_t address, const uint8_t* data, uint8_t len, void (*_onDone)(bool isOK)) {
+    lastAddress = address;
+    lastLen = len < sizeof(lastData) ? len : sizeof(lastData);
+    memcpy(lastData, data, lastLen);
+    transfers++;
+    onDone = _onDone;
+    isBusy = true;
+    uint32_t bits = (1 + len) * 9 + 2;
+    doneUs = HostClock::now() + (bits * 1000000ULL + clockHz - 1) / clockHz;
+  }
+  void poll() { if (isBusy && HostClock::now() >= doneUs) finish(); }
+  void finish() {                                       // done right now, no matter the time
+    if (!isBusy) return;
+    isBusy = false;
+    if (onDone != NULL) onDone(!isNack);                // might start the next transfer
+  }
+  void abort() { isBusy = false; }
+};
+inline HostI2cBus& hostI2cBus() { static HostI2cBus bus; return bus; }
+
+
+// ********************************************* String ********************************************
+class String : public std::string
+{
+public:
+  String() {}
+  String(const char* s) : std::string(s) {}
+  String(const std::string& s) : std::string(s) {}
+  String(int v) : std::string(std::to_string(v)) {}
+  String(unsigned int v) : std::string(std::to_string(v)) {}
+  String(long v) : std::string(std::to_string(v)) {}
+  String(unsigned long v) : std::string(std::to_string(v)) {}
+
+  String operator+(const String& s) const { return String(std::string(*this) + std::string(s)); }
+  String operator+(const char* s) const { return String(std::string(*this) + s); }
+  String operator+(int v) const { return *this + String(v); }
+  String operator+(unsigned int v) const { return *this + String(v); }
+  String operator+(long v) const { return *this + String(v); }
+  String operator+(unsigned long v) const { return *this + String(v); }
+};
+
+
+// ********************************************* Serial ********************************************
+class HostSerial
+{
+public:
+  template <class T> size_t print(const T&) { return 0; }
+  template <class T> size_t print(const T&, int) { return 0; }
+  size_t println() { return 0; }
+  template <class T> size_t println(const T&) { return 0; }
+  template <class T> size_t println(const T&, int) { return 0; }
+  template <class... Args> size_t printf(const char*, Args...) { return 0; }
+  size_t write(uint8_t) { return 0; }
+  void begin(long) {}
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+};
+extern HostSerial Serial;
+
+#endif
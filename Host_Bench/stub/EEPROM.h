@@ -0,0 +1,25 @@
+// EEPROM in RAM, starts erased (0xFF) like a new board
+#ifndef EEPROM_H_STUB
+#define EEPROM_H_STUB
+
+#include "Arduino.h"
+
+class HostEEPROM
+{
+public:
+  uint8_t mem[4096];
+  uint32_t writes = 0;
+
+  HostEEPROM() { memset(mem, 0xFF, sizeof(mem)); }
+
+  template <class T> T& get(int addr, T& t) { memcpy(&t, &mem[addr], sizeof(T)); return t; }
+  template <class T> const T& put(int addr, const T& t) { memcpy(&mem[addr], &t, sizeof(T)); writes++; return t; }
+  uint8_t read(int addr) { return mem[addr]; }
+  void update(int addr, uint8_t value) { if (mem[addr] != value) put(addr, value); }
+  void write(int addr, uint8_t value) { put(addr, value); }
+  bool begin(size_t) { return true; }
+  bool commit() { return true; }
+};
+extern HostEEPROM EEPROM;
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef IPADDRESS_H_STUB
+#define IPADDRESS_H_STUB
+
+#include "Arduino.h"
+
+class IPAddress
+{
+public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { bytes[0] = a; bytes[1] = b; bytes[2] = c; bytes[3] = d; }
+  IPAddress(const uint8_t* address) { memcpy(bytes, address, 4); }
+
+  uint8_t operator[](int i) const { return bytes[i]; }
+  uint8_t& operator[](int i) { return bytes[i]; }
+
+private:
+  uint8_t bytes[4] = { 0, 0, 0, 0 };
+};
+
+#endif
@@ -0,0 +1,934 @@
+/*
+  Host (Linux) tests for the output path headers, no hardware needed
+    - machine.h calculateCRC() against a plain byte sum, any length & alignment, and a bad CRC dropped & counted by parsePGN()
+    - pgnFramer.h, UDP packets & byte streams: resync after garbage, split & cut off PGNs, bad lengths, CRCs left to parsePGN()
+    - outputPorts.h on the mock port registers in stub/Arduino.h, and the active low inversion in front of it in machine.h
+    - Teensy: i2cAsyncWriter.h on the mock I2C bus, in HostClock time
+    - machine.h hyd lift: the lift output drops when its time runs out between PGNs, from watchdogCheck() in HostClock time
+    - sectionTiming.h on its own: look ahead - valve delay, behindCm at the section speed, edge order, speed 0 and the ms wrap
+    - outputScheduler.h, TimingWheel on its own and OutputScheduler run by poll() in HostClock time
+    - commsWatchdog.h: the learned mean & jitter, alert/timeout periods, the 300ms floor, the fixed period caps & long gaps
+    - speedPulse.h, frequencyFor() and the Nano's Timer2 prescaler/TOP/dither choice (the HOST_GPIO_PORTS backend) over speed
+    - Teensy/Nano: sectionTiming.h edges on the machine's output scheduler go out latency after they came due, not when loop() got to them
+    - prints each failed CHECK() and exits with 1 if there were any
+
+  make test         builds test_esp32, test_teensy & test_nano and runs them
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "hostMachine.h"
+#include "../Machine_Teensy/outputPorts.h"           // the ESP32 sketch includes it from the .ino, not machine.h
+#include "../Machine_Teensy/outputScheduler.h"
+#ifdef BENCH_TEENSY
+  #include "../Machine_Teensy/i2cAsyncWriter.h"
+#endif
+
+
+// ********************************************* checks ********************************************
+uint32_t checks = 0;
+uint32_t failures = 0;
+
+#define CHECK(x) check((x), #x, __LINE__)
+
+void check(bool isOK, const char* what, int line) {
+  checks++;
+  if (isOK) return;
+  failures++;
+  printf("test.cpp:%d: %s failed\n", line, what);
+}
+
+
+// ********************************************* PGN builders **************************************
+typedef std::vector<uint8_t> Frame;
+
+Frame makePgn(uint8_t pgn, const std::vector<uint8_t>& data) {
+  Frame f(PgnFramer::HEADER_LEN + data.size() + 1);
+  f[0] = 0x80; f[1] = 0x81; f[2] = 0x7F; f[3] = pgn; f[4] = data.size();
+  memcpy(&f[PgnFramer::HEADER_LEN], data.data(), data.size());
+  machine.calculateAndSetCRC(f.data(), f.size());
+  return f;
+}
+
+void sendSectionData(uint64_t sections) {     // 0xE5 (229) - 64 Section Data
+  std::vector<uint8_t> d;
+  for (uint8_t i = 0; i < 8; i++) d.push_back(sections >> (i * 8));
+  d.push_back(50); d.push_back(50);           // left/right speed
+  Frame f = makePgn(229, d);
+  parse(f.data(), f.size());
+}
+
+// hydLiftSecs is the raise & lower time, 0 turns the hyd lift off
+void sendMachineConfig(bool isActiveHigh, uint8_t hydLiftSecs = 0) {   // 0xEE (238) - Machine Config
+  uint8_t set0 = (isActiveHigh ? 1 : 0) | (hydLiftSecs != 0 ? 2 : 0);
+  Frame f = makePgn(238, { uint8_t(hydLiftSecs ? hydLiftSecs : 2), uint8_t(hydLiftSecs ? hydLiftSecs : 4), 0, set0, 0, 0, 0, 0 });
+  parse(f.data(), f.size());
+}
+
+void sendPinConfig(const std::vector<uint8_t>& functions) {   // 0xEC (236) - Machine Pin Config, functions for pin 1 on
+  std::vector<uint8_t> d(functions);
+  d.resize(24);
+  Frame f = makePgn(236, d);
+  parse(f.data(), f.size());
+}
+
+void sendMachineData(uint8_t hydLift) {       // 0xEF (239) - Machine Data
+  Frame f = makePgn(239, { 0, 50, hydLift, 0, 0, 0, 0, 0 });
+  parse(f.data(), f.size());
+}
+
+
+// ********************************************* calculateCRC **************************************
+// AOG's CRC the slow way, the low byte of the sum of everything after 0x80 0x81 but the CRC byte
+uint8_t byteSumCRC(const uint8_t* frame, uint32_t len) {
+  if (len <= 2) return 0;
+  uint8_t sum = 0;
+  for (uint32_t i = 2; i < len - 1; i++) sum += frame[i];
+  return sum;
+}
+
+void testCalculateCRC() {
+  // every length from every start in an 8 byte word, random bytes and all 0xFF (the most carry into the lanes)
+  uint8_t buf[8 + 256];
+  srand(1);
+  bool isSame = true;
+  for (uint8_t fill = 0; fill < 2; fill++) {
+    for (uint32_t i = 0; i < sizeof(buf); i++) buf[i] = (fill ? 0xFF : rand());
+    for (uint32_t start = 0; start < 8; start++) {
+      for (uint32_t len = 0; len < 256; len++) {
+        if (MACHINE::calculateCRC(buf + start, len) != byteSumCRC(buf + start, len)) isSame = false;
+      }
+    }
+  }
+  CHECK(isSame);
+
+  // the Hello reply is patched a byte at a time, its CRC stays right
+  sendSectionData(0xA5C3);
+  const uint8_t* hello = machine.getHelloReply();
+  CHECK(hello[5] == 0xC3 && hello[6] == 0xA5 && hello[10] == byteSumCRC(hello, 11));
+  sendSectionData(0);
+  hello = machine.getHelloReply();
+  CHECK(hello[5] == 0 && hello[6] == 0 && hello[10] == byteSumCRC(hello, 11));
+
+  // a Section Data with a bad CRC is dropped before it changes anything, and counted
+  Frame f = makePgn(229, { 0x01, 0, 0, 0, 0, 0, 0, 0, 50, 50 });
+  f.back()++;
+  uint32_t badCRC = machine.pgnCounters[229 - MACHINE::PGN_TABLE_FIRST].badCRC;
+  CHECK(parse(f.data(), f.size()));
+  CHECK(machine.pgnCounters[229 - MACHINE::PGN_TABLE_FIRST].badCRC == badCRC + 1);
+  CHECK(machine.getSectionState(0) == 0);
+}
+
+
+// ********************************************* pgnFramer.h ***************************************
+std::vector<Frame> framed;
+
+void collectFrame(uint8_t* pgnData, uint8_t len) { framed.push_back(Frame(pgnData, pgnData + len)); }
+
+Frame operator+(Frame a, const Frame& b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+void testPgnFramer() {
+  const Frame a = makePgn(239, { 0, 50, 0, 0, 0, 0, 0x01, 0 });                // Machine Data
+  const Frame b = makePgn(229, { 0x01, 0, 0, 0, 0, 0, 0, 0, 50, 50 });        // 64 Section Data
+  const Frame c = makePgn(200, { 0, 0, 0 });                                  // Hello from AgIO
+  const Frame garbage = { 0x81, 0x00, 0x80, 0x7F, 0x80, 0x80, 0x01, 0xFF };   // lone 0x80s & 0x81s, no 0x80 0x81
+
+  // UDP: several PGNs in a packet, with garbage before, between & after
+  framed.clear();
+  Frame packet = garbage + a + garbage + b + c + garbage;
+  CHECK(PgnFramer::parseBuffer(packet.data(), packet.size(), collectFrame) == 3);
+  CHECK(framed.size() == 3 && framed[0] == a && framed[1] == b && framed[2] == c);
+
+  // a PGN split across two packets is lost, the rest of it in the next packet doesn't make a bogus PGN
+  framed.clear();
+  Frame first = a + Frame(b.begin(), b.begin() + 7);
+  Frame second = Frame(b.begin() + 7, b.end()) + c;
+  CHECK(PgnFramer::parseBuffer(first.data(), first.size(), collectFrame) == 1);
+  CHECK(PgnFramer::parseBuffer(second.data(), second.size(), collectFrame) == 1);
+  CHECK(framed.size() == 2 && framed[0] == a && framed[1] == c);
+
+  // a header cut off before its length byte
+  framed.clear();
+  packet = a + Frame(b.begin(), b.begin() + 4);
+  CHECK(PgnFramer::parseBuffer(packet.data(), packet.size(), collectFrame) == 1);
+
+  // a length byte that's too long runs off the end of the packet, too short hands over a short PGN
+  // and the rest is skipped to the next header: parsePGN() counts it as a bad length
+  Frame tooLong = b;
+  tooLong[4] = 60;
+  packet = a + tooLong;
+  framed.clear();
+  CHECK(PgnFramer::parseBuffer(packet.data(), packet.size(), collectFrame) == 1 && framed[0] == a);
+  Frame tooShort = b;
+  tooShort[4] = 2;
+  packet = tooShort + c;
+  framed.clear();
+  CHECK(PgnFramer::parseBuffer(packet.data(), packet.size(), collectFrame) == 2);
+  CHECK(framed.size() == 2 && framed[0].size() == 8 && framed[1] == c);
+  uint32_t badLength = machine.pgnCounters[229 - MACHINE::PGN_TABLE_FIRST].badLength;
+  PgnFramer::parseBuffer(packet.data(), packet.size(), checkPgn);
+  CHECK(machine.pgnCounters[229 - MACHINE::PGN_TABLE_FIRST].badLength == badLength + 1);
+
+  // the framer doesn't look at the CRC, parsePGN() drops it
+  Frame badCRC = b;
+  badCRC[b.size() - 1] ^= 0x10;
+  packet = badCRC + a;
+  framed.clear();
+  CHECK(PgnFramer::parseBuffer(packet.data(), packet.size(), collectFrame) == 2 && framed[0] == badCRC);
+  uint32_t badCRCs = machine.pgnCounters[229 - MACHINE::PGN_TABLE_FIRST].badCRC;
+  PgnFramer::parseBuffer(packet.data(), packet.size(), checkPgn);
+  CHECK(machine.pgnCounters[229 - MACHINE::PGN_TABLE_FIRST].badCRC == badCRCs + 1);
+
+  // byte stream: resyncs after garbage, incl 0x80 0x80 0x81 where the 2nd 0x80 is the real start
+  uint8_t buffer[32];
+  PgnFramer stream(buffer, sizeof(buffer));
+  framed.clear();
+  Frame bytes = garbage + a + Frame{ 0x80 } + b + garbage + c;
+  uint32_t completed = 0;
+  for (uint8_t byte : bytes) if (stream.write(byte, collectFrame)) completed++;
+  CHECK(completed == 3 && framed.size() == 3 && framed[0] == a && framed[1] == b && framed[2] == c);
+  CHECK(stream.skippedBytes == 2 * 6 + 1);                    // a false start 0x80 isn't counted, the byte that showed it was false is
+
+  // split anywhere it's put back together, whatever comes between the writes
+  framed.clear();
+  for (uint32_t split = 1; split < b.size(); split++) {
+    for (uint32_t i = 0; i < split; i++) stream.write(b[i], collectFrame);
+    PgnFramer::parseBuffer(packet.data(), packet.size(), [](uint8_t*, uint8_t) {});     // something else on the way
+    for (uint32_t i = split; i < b.size(); i++) stream.write(b[i], collectFrame);
+  }
+  bool isWhole = (framed.size() == b.size() - 1);
+  for (const Frame& f : framed) if (f != b) isWhole = false;
+  CHECK(isWhole);
+
+  // longer then the buffer is skipped, the next PGN still comes through
+  Frame big = makePgn(201, Frame(40, 0x55));
+  framed.clear();
+  bytes = big + a;
+  for (uint8_t byte : bytes) stream.write(byte, collectFrame);
+  CHECK(stream.skippedPgns == 1 && framed.size() == 1 && framed[0] == a);
+
+  // a bad length in a stream eats into the next PGN, it's back in step by the one after
+  framed.clear();
+  tooLong = b;
+  tooLong[4] = b[4] + 3;                                      // takes b's 0x80 0x81 0x7F
+  bytes = tooLong + b + c;
+  for (uint8_t byte : bytes) stream.write(byte, collectFrame);
+  CHECK(framed.size() == 2 && framed[0].size() == b.size() + 3 && framed[1] == c);
+}
+
+
+// ********************************************* outputPorts.h *************************************
+uint32_t changeWrite[256];            // hostPins().portWrites when each pin last changed level
+uint32_t pinChanges = 0;
+
+void stampPinChange(uint8_t pin, uint8_t) {
+  changeWrite[pin] = hostPins().portWrites;
+  pinChanges++;
+}
+
+void testOutputPorts() {
+  HostPins& pins = hostPins();
+  void (*prevOnWrite)(uint8_t, uint8_t) = pins.onWrite;
+  pins.onWrite = stampPinChange;
+
+  // mock ports are 8 pins each: 40, 41 & 42 on port 5, 49 on port 6, 32 on port 4 (none of them hostMachine.h's outputPins)
+  const uint8_t portPins[] = { 40, 41, 42, 49, 32 };
+  OutputPorts<8> ports;
+  CHECK(ports.begin(portPins, sizeof(portPins)));
+  CHECK(ports.numPorts == 3);
+
+  uint32_t portWrites = pins.portWrites;
+  ports.write(0x1F, 0x1F);
+  CHECK(pins.portWrites - portWrites == 3);                   // one set write per port, nothing to clear
+  for (uint8_t i = 0; i < sizeof(portPins); i++) CHECK(pins.level[portPins[i]] == HIGH);
+
+  // pins on the same port change in the same register write
+  portWrites = pins.portWrites;
+  ports.write(0x1A, 0x05);                                    // 40 & 42 LOW
+  CHECK(pins.portWrites - portWrites == 1);
+  CHECK(pins.level[40] == LOW && pins.level[42] == LOW);
+  CHECK(changeWrite[40] == changeWrite[42]);
+
+  portWrites = pins.portWrites;
+  ports.write(0x05, 0x07);                                    // 40 & 42 HIGH, 41 LOW on the same port
+  CHECK(pins.portWrites - portWrites == 2);                   // one set & one clear
+  CHECK(pins.level[40] == HIGH && pins.level[41] == LOW && pins.level[42] == HIGH);
+  CHECK(changeWrite[40] == changeWrite[42]);
+
+  // pins without a changed bit are left alone, whatever their level bit says
+  portWrites = pins.portWrites;
+  pinChanges = 0;
+  ports.write(0x00, 0x08);                                    // only 49
+  CHECK(pins.portWrites - portWrites == 1);
+  CHECK(pinChanges == 1);
+  CHECK(pins.level[49] == LOW);
+  CHECK(pins.level[32] == HIGH && pins.level[40] == HIGH && pins.level[42] == HIGH);
+
+  portWrites = pins.portWrites;
+  ports.write(0x00, 0x00);
+  CHECK(pins.portWrites == portWrites);
+
+  // a pin on a port that didn't fit falls back to digitalWrite()
+  OutputPorts<8, 2> twoPorts;
+  CHECK(!twoPorts.begin(portPins, sizeof(portPins)));
+  uint32_t writes = pins.writes;
+  twoPorts.write(0x00, 0x10);                                 // 32 is on the third port
+  CHECK(pins.writes - writes == 1);
+  CHECK(pins.level[32] == LOW);
+
+  pins.onWrite = prevOnWrite;
+}
+
+// level of outputPins[i] (pin i + 1 in the pin config)
+bool isPinHigh(uint8_t i) {
+#ifdef BENCH_ESP32
+  return machine.pinLevels & (1UL << i);                     // levels for the output callback, already inverted
+#else
+  return hostPins().level[outputPins[i]] == HIGH;
+#endif
+}
+
+// the machine inverts active low pins before OutputPorts gets them, the default pin config has section 1 on pin 1
+void testActiveLow() {
+  sendMachineConfig(false);
+  sendSectionData(0x01);                                      // section 1 ON: LOW, section 2 OFF: HIGH
+  CHECK(!isPinHigh(0) && isPinHigh(1));
+
+  sendMachineConfig(true);
+  sendSectionData(0x02);                                      // section 1 OFF: LOW, section 2 ON: HIGH
+  CHECK(!isPinHigh(0) && isPinHigh(1));
+
+  sendSectionData(0x00);
+  CHECK(!isPinHigh(0) && !isPinHigh(1));
+  sendMachineConfig(false);
+  sendSectionData(0x00);                                      // ESP32 applies the new polarity on the next update
+  CHECK(isPinHigh(0) && isPinHigh(1));
+}
+
+
+// ********************************************* hyd lift ******************************************
+// pin 9 (outputPins[8]) is function 17 & pin 10 function 18, the ESP32 sketch lowers on 18, Teensy/Nano on 17
+#ifdef BENCH_ESP32
+  const uint8_t LOWER = 9, RAISE = 8;
+#else
+  const uint8_t LOWER = 8, RAISE = 9;
+#endif
+
+void testHydLift() {
+  uint64_t us = 20000000;
+  HostClock::set(us);
+  sendPinConfig({ 1, 2, 3, 4, 5, 6, 7, 8, 17, 18 });
+  sendMachineConfig(true, 1);                                 // 1 sec raise & lower
+  machine.commsWatchdog.reset();                              // so nothing times out while no PGNs come
+
+  // lower: ON from the PGN, still ON just before the lower time, OFF from watchdogCheck() with no PGN in between
+  sendMachineData(1);
+  sendSectionData(0x01);
+  CHECK(isPinHigh(LOWER) && !isPinHigh(RAISE) && isPinHigh(0));
+  bool isEarly = false;
+  for (uint32_t ms = 10; ms < 1000; ms += 10) {
+    HostClock::set(us + ms * 1000);
+    machine.watchdogCheck();
+    if (!isPinHigh(LOWER)) isEarly = true;
+  }
+  CHECK(!isEarly);
+  HostClock::set(us + 999999);
+  machine.watchdogCheck();
+  CHECK(isPinHigh(LOWER));
+  HostClock::set(us += 1000000);
+  machine.watchdogCheck();
+  CHECK(!isPinHigh(LOWER) && !isPinHigh(RAISE));
+  CHECK(isPinHigh(0));                                        // only the lift dropped, not a comms timeout
+
+  // stays OFF while AOG keeps sending the same hydLift
+  sendMachineData(1);
+  sendSectionData(0x01);
+  CHECK(!isPinHigh(LOWER));
+
+  // raise: the same on the other pin
+  HostClock::set(us += 100000);
+  sendMachineData(2);
+  sendSectionData(0x01);
+  CHECK(!isPinHigh(LOWER) && isPinHigh(RAISE));
+  HostClock::set(us += 1000000);
+  machine.watchdogCheck();
+  CHECK(!isPinHigh(LOWER) && !isPinHigh(RAISE) && isPinHigh(0));
+
+  sendMachineData(0);
+  sendMachineConfig(false);
+  sendPinConfig({ 1, 2, 3, 4, 5, 6, 7, 8 });
+  sendSectionData(0x00);
+  machine.commsWatchdog.reset();
+  HostClock::useRealClock();
+}
+
+
+#ifdef BENCH_TEENSY
+// ********************************************* i2cAsyncWriter.h **********************************
+I2cAsyncWriter writerA, writerB, writerC;     // writers stay on the bus once begin() is called, so the same ones for all the checks
+uint64_t i2cUs = 0;
+
+// the value in the transfer on the mock bus, 0xFFFFFFFF if there isn't one
+uint32_t busValue() {
+  HostI2cBus& bus = hostI2cBus();
+  if (!bus.isBusy) return 0xFFFFFFFF;
+  return bus.lastData[1] | (bus.lastData[2] << 8);
+}
+
+// moves HostClock to the end of the transfer in flight and lets the mock bus finish it, like the interrupt would
+void finishTransfer() {
+  HostI2cBus& bus = hostI2cBus();
+  if (!bus.isBusy) return;
+  HostClock::set(i2cUs = bus.doneUs);
+  bus.poll();
+}
+
+void testI2cAsyncWriter() {
+  HostI2cBus& bus = hostI2cBus();
+  HostClock::set(i2cUs);
+  CHECK(writerA.begin(0x20, 2) && writerB.begin(0x21, 2) && writerC.begin(0x22, 2));
+
+  // started right away, the register then the low & high bytes
+  uint32_t transfers = bus.transfers;
+  CHECK(writerA.write(0x0102));
+  CHECK(bus.transfers - transfers == 1);
+  CHECK(bus.lastAddress == 0x20 && bus.lastLen == 3 && bus.lastData[0] == 2 && busValue() == 0x0102);
+
+  // values written while a transfer is in flight are coalesced, only the latest is sent
+  CHECK(writerA.write(0x0304));
+  CHECK(writerA.write(0x0506));
+  CHECK(writerA.write(0x0708));
+  CHECK(writerA.coalesced == 2);
+  CHECK(bus.transfers - transfers == 1);
+  finishTransfer();
+  CHECK(bus.transfers - transfers == 2);
+  CHECK(busValue() == 0x0708);
+  finishTransfer();
+  CHECK(!bus.isBusy && !writerA.isBusy());
+  CHECK(writerA.transfers == 2);
+
+  // already on the chip, or on its way, isn't sent again
+  transfers = bus.transfers;
+  CHECK(!writerA.write(0x0708));
+  CHECK(bus.transfers == transfers);
+  CHECK(writerA.write(0x090A));
+  CHECK(!writerA.write(0x090A));                              // on its way
+  finishTransfer();
+  CHECK(bus.transfers - transfers == 1);
+
+  // changed and changed back before it was sent, nothing to send
+  CHECK(writerB.write(0x1111));                               // B has the bus
+  CHECK(writerA.write(0x0B0C));
+  CHECK(writerA.write(0x090A));                               // back to what the chip has
+  transfers = bus.transfers;
+  finishTransfer();
+  CHECK(bus.transfers == transfers && !bus.isBusy);
+
+  // devices waiting for the bus are served in turn after the one that had it, not in the order they wrote
+  CHECK(writerA.write(0x2222));                               // A has the bus
+  CHECK(writerC.write(0x3333));
+  CHECK(writerB.write(0x4444));
+  CHECK(writerA.write(0x5555));
+  uint8_t order[3];
+  for (uint8_t i = 0; i < 3; i++) {
+    finishTransfer();
+    order[i] = bus.lastAddress;
+  }
+  CHECK(order[0] == 0x21 && order[1] == 0x22 && order[2] == 0x20);   // B, C, then A again
+  finishTransfer();
+  CHECK(!bus.isBusy);
+
+  CHECK(I2cAsyncWriter::waitIdle());
+  CHECK(writerA.errors == 0 && writerB.errors == 0 && writerC.errors == 0);
+
+  // a NACK is an error, and the next write is sent even if it's the same value
+  bus.isNack = true;
+  CHECK(writerC.write(0x6666));
+  finishTransfer();
+  bus.isNack = false;
+  CHECK(writerC.errors == 1);
+  transfers = bus.transfers;
+  CHECK(writerC.write(0x6666));
+  CHECK(bus.transfers - transfers == 1);
+  finishTransfer();
+
+  // waitIdle() gives up on a transfer that never finishes (lost interrupt), and forgets what's queued
+  CHECK(writerA.write(0x7777));
+  CHECK(writerB.write(0x8888));
+  bus.abort();                                                // the mock bus won't call transferDone() now
+  HostClock::useRealClock();                                  // so micros() moves on for the timeout
+  CHECK(!I2cAsyncWriter::waitIdle(500));
+  i2cUs = HostClock::now();
+  HostClock::set(i2cUs);
+  CHECK(writerA.errors == 1 && writerB.errors == 0);          // the one on the bus
+  CHECK(!writerA.isBusy() && !writerB.isBusy());
+  transfers = bus.transfers;
+  CHECK(writerA.write(0x7777));                               // chip state unknown, sent again
+  CHECK(bus.transfers - transfers == 1);
+  CHECK(I2cAsyncWriter::waitIdle());
+
+  HostClock::useRealClock();
+}
+#endif
+
+
+// ********************************************* sectionTiming.h ***********************************
+void testSectionTiming() {
+  SectionTiming<8, uint8_t> timing;
+
+  // off, the outputs follow the PGN
+  CHECK(timing.command(0x05, 0, 100, 0, 0) && timing.outputs == 0x05 && timing.changed == 0x05);
+  CHECK(!timing.isPending());
+  timing.command(0, 0, 100, 0, 0);
+
+  // held back by look ahead - valve delay, not before it
+  timing.isEnabled = true;
+  timing.lookAheadOnMs = 500;
+  timing.lookAheadOffMs = 300;
+  timing.setValveDelays(350, 150);
+  CHECK(timing.edgeDelay(0, true) == 150 && timing.edgeDelay(0, false) == 150);
+  CHECK(!timing.command(0x01, 1000, 100, 0, 0) && timing.outputs == 0 && timing.isPending());
+  CHECK(!timing.update(1149) && timing.outputs == 0);
+  CHECK(timing.update(1150) && timing.outputs == 0x01 && timing.changed == 0x01 && timing.dueMs == 1150);
+  CHECK(!timing.isPending());
+
+  // a valve slower then the look ahead goes out right away
+  timing.setSection(1, 600, 150);
+  CHECK(timing.command(0x03, 2000, 100, 0, 0) && timing.changed == 0x02 && timing.outputs == 0x03);
+  timing.setSection(1, 350, 150);
+
+  // OFF and back ON before the OFF went out, nothing changes
+  CHECK(!timing.command(0x02, 3000, 100, 0, 0));
+  CHECK(!timing.command(0x03, 3050, 100, 0, 0));
+  CHECK(!timing.update(3300) && timing.outputs == 0x03 && !timing.isPending());
+
+  // edges go out in due order, not command order: section 4's valve is 100ms slower so its ON is held 100ms less
+  timing.setSection(3, 450, 150);
+  CHECK(!timing.command(0x07, 4000, 100, 0, 0));             // section 3 due 4150
+  CHECK(!timing.command(0x0F, 4050, 100, 0, 0));             // section 4 due 4100
+  CHECK(timing.update(4120) && timing.changed == 0x08 && timing.dueMs == 4100);
+  CHECK(timing.update(4150) && timing.changed == 0x04 && timing.outputs == 0x0F);
+
+  // due in the same update() they go out together, dueMs is the later one
+  timing.command(0x0E, 5000, 100, 0, 0);                      // section 1 OFF due 5150
+  timing.command(0x0A, 5050, 100, 0, 0);                      // section 3 OFF due 5200
+  CHECK(timing.update(5300) && timing.changed == 0x05 && timing.outputs == 0x0A && timing.dueMs == 5200);
+
+  // reset() is all OFF right now
+  timing.command(0x0F, 6000, 100, 0, 0);
+  timing.reset();
+  CHECK(timing.changed == 0x0A && timing.outputs == 0 && !timing.isPending());
+  timing.setSection(3, 350, 150);
+
+  // behindCm: 100cm at 10 km/hr is 360ms on top of the look ahead - valve delay
+  timing.setSection(2, 350, 150, 100);
+  CHECK(!timing.command(0x04, 7000, 100, 0, 0));
+  CHECK(!timing.update(7509));                                // 7000 + 150 + 360
+  CHECK(timing.update(7510) && timing.changed == 0x04);
+  CHECK(timing.edgeDelay(2, false) == 150 + 360);
+  CHECK(timing.edgeDelay(2, true) == 150 + 360);
+
+  // faster is shorter, creeping is capped at maxDelayMs, speed 0 (and under 0.05 km/hr) leaves behindCm out
+  timing.command(0x04, 0, 200, 0, 0);
+  CHECK(timing.edgeDelay(2, true) == 150 + 180);
+  timing.command(0x04, 0, 1, 0, 0);
+  CHECK(timing.edgeDelay(2, true) == timing.maxDelayMs);
+  timing.command(0x04, 0, 0, 0, 0);
+  CHECK(timing.edgeDelay(2, true) == 150);
+
+  // -ve behindCm is ahead, the edge goes out sooner
+  timing.setSection(2, 350, 150, -20);
+  timing.command(0x04, 0, 100, 0, 0);
+  CHECK(timing.edgeDelay(2, true) == 150 - 72);
+
+  // section speed across the tool from the left/right tool speeds: left 50 & right 150 relative, the GPS speed (100) is in the middle
+  const int16_t offsets[8] = { -150, -50, 50, 150 };
+  timing.setGeometry(offsets, 4, 400);
+  timing.command(0x04, 0, 100, 50, 150);
+  CHECK(fabs(timing.sectionSpeed(0) - 62.5f) < 0.01f);          // 1/8 of the way across
+  CHECK(fabs(timing.sectionSpeed(3) - 137.5f) < 0.01f);
+  CHECK(fabs(timing.sectionSpeed(5) - 100.0f) < 0.01f);         // no dimensions, GPS speed
+  timing.setGeometry(NULL, 0, 0);
+  timing.setSection(2, 350, 150);
+
+  // the 16 bit ms wraps
+  timing.command(0, 0, 100, 0, 0);
+  timing.reset();
+  CHECK(!timing.command(0x01, 65500, 100, 0, 0));
+  CHECK(!timing.update(65530) && !timing.update(113));        // due 65650, 114 after the wrap
+  CHECK(timing.update(114) && timing.outputs == 0x01 && timing.dueMs == 114);
+}
+
+
+// ********************************************* outputScheduler.h *********************************
+void testTimingWheel() {
+  TimingWheel<16, 8> wheel;
+  uint32_t levels, changed;
+
+  // events go out on their own tick, in order, not before
+  wheel.reset(0);
+  wheel.schedule(5, 0x02, 0x02);
+  wheel.schedule(2, 0x01, 0x01);                              // queued after, due first
+  CHECK(!wheel.advance(1, levels, changed));
+  CHECK(wheel.advance(2, levels, changed) && levels == 0x01 && changed == 0x01);
+  CHECK(!wheel.advance(4, levels, changed));
+  CHECK(wheel.advance(5, levels, changed) && levels == 0x02 && changed == 0x02);
+  CHECK(wheel.isEmpty());
+
+  // a tick that's already been run goes out on the next one
+  wheel.schedule(3, 0x04, 0x04);
+  CHECK(wheel.advance(6, levels, changed) && changed == 0x04);
+
+  // events for the same tick go out together, the later one wins where they overlap
+  wheel.schedule(8, 0x01, 0x01);
+  wheel.schedule(8, 0x00, 0x02);
+  wheel.schedule(8, 0x04, 0x05);                              // turns 1 back off
+  CHECK(wheel.advance(8, levels, changed) && levels == 0x04 && changed == 0x07);
+
+  // more then SLOTS ticks ahead waits a trip round the wheel, its bucket comes up at tick 12 first
+  wheel.reset(100);
+  wheel.schedule(100 + 16 + 12, 0x08, 0x08);
+  bool isEarly = false;
+  for (uint32_t t = 101; t < 128; t++) if (wheel.advance(t, levels, changed)) isEarly = true;
+  CHECK(!isEarly);
+  CHECK(wheel.advance(128, levels, changed) && changed == 0x08);
+
+  // and past the tick counter wrapping
+  wheel.reset(0xFFFFFFF8);
+  wheel.schedule(0xFFFFFFF8 + 20, 0x10, 0x10);                // tick 12
+  isEarly = false;
+  for (uint32_t t = 0xFFFFFFF9; t != 12; t++) if (wheel.advance(t, levels, changed)) isEarly = true;
+  CHECK(!isEarly);
+  CHECK(wheel.advance(12, levels, changed) && changed == 0x10);
+
+  // way behind, one advance() picks up everything that's due
+  wheel.reset(0);
+  wheel.schedule(3, 0x01, 0x01);
+  wheel.schedule(40, 0x02, 0x02);
+  CHECK(wheel.advance(50, levels, changed) && changed == 0x03);
+  CHECK(wheel.isEmpty());
+
+  // full: merged into the last one queued, early but nothing lost or out of order
+  TimingWheel<16, 4> small;
+  small.reset(0);
+  small.schedule(1, 0x01, 0x01);
+  small.schedule(2, 0x02, 0x02);
+  small.schedule(3, 0x04, 0x04);
+  small.schedule(4, 0x08, 0x08);
+  small.schedule(9, 0x10, 0x10);
+  small.schedule(10, 0x00, 0x08);                             // the merged event turns 8 back off
+  CHECK(small.merged == 2);
+  uint32_t allChanged = 0;
+  for (uint32_t t = 1; t < 4; t++) {
+    CHECK(small.advance(t, levels, changed));
+    allChanged |= changed;
+  }
+  CHECK(small.advance(4, levels, changed) && levels == 0x10 && changed == 0x18);
+  allChanged |= changed;
+  CHECK(allChanged == 0x1F);
+  CHECK(small.isEmpty());
+  small.schedule(5, 0x20, 0x20);                              // room again
+  CHECK(small.merged == 2);
+}
+
+struct RecordedWrites {
+  uint32_t writes = 0;
+  uint32_t lastUs = 0;
+  uint32_t levels = 0;
+  uint32_t changed = 0;
+  void write(uint32_t _levels, uint32_t _changed) {
+    writes++;
+    lastUs = micros();
+    levels = _levels;
+    changed = _changed;
+  }
+};
+
+void testOutputScheduler() {
+  const uint32_t TICK_US = 250;
+  const uint32_t POLL_US = 10;                                // how often the host "timer" runs
+  RecordedWrites ports;
+  OutputScheduler<RecordedWrites> scheduler;
+
+  CHECK(!scheduler.write(1, 1, 0));                           // not running, the caller writes
+  uint64_t us = 0xFFFFFFFFULL - 20000;                        // micros() wraps part way through
+  HostClock::set(us);
+  CHECK(scheduler.begin(&ports, TICK_US));
+  CHECK(scheduler.isRunning());
+
+  // every write lands on the first tick at or after the time asked for, so within one tick of it
+  bool isEarly = false, isLate = false, isMissing = false;
+  for (uint32_t i = 0; i < 200; i++) {
+    uint32_t atUs = uint32_t(us) + 2000 + i * 37 % 1000;
+    uint32_t bit = 1UL << (i % 8);
+    uint32_t writes = ports.writes;
+    CHECK(scheduler.write(i & 8 ? bit : 0, bit, atUs));
+    CHECK(int32_t(scheduler.dueUs - atUs) >= 0 && scheduler.dueUs - atUs < TICK_US);
+    while (ports.writes == writes && int32_t(uint32_t(us) - atUs) < int32_t(2 * TICK_US)) {
+      HostClock::set(us += POLL_US);
+      scheduler.poll();
+    }
+    if (ports.writes == writes) isMissing = true;
+    else if (int32_t(ports.lastUs - atUs) < 0) isEarly = true;
+    else if (ports.lastUs - atUs >= TICK_US + POLL_US) isLate = true;
+    CHECK(ports.changed == bit && ports.levels == (i & 8 ? bit : 0));
+  }
+  CHECK(!isEarly && !isLate && !isMissing);
+
+  // already due goes out on the next tick
+  uint32_t writes = ports.writes;
+  CHECK(scheduler.write(1, 1, uint32_t(us) - 500));
+  for (uint32_t t = 0; t < TICK_US; t += POLL_US) {
+    HostClock::set(us += POLL_US);
+    scheduler.poll();
+  }
+  CHECK(ports.writes - writes == 1);
+  CHECK(scheduler.wheel.isEmpty() && scheduler.wheel.merged == 0);
+
+  HostClock::useRealClock();
+}
+
+
+// ********************************************* commsWatchdog.h ***********************************
+// count frames of stream s, intervalMs apart from nowMs (0 is a jittery 90/110ms), returns when the last one came
+uint32_t arrive(CommsWatchdog<2>& watchdog, uint8_t s, uint32_t nowMs, uint32_t intervalMs, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    watchdog.arrived(s, nowMs);
+    if (i + 1 < count) nowMs += (intervalMs != 0 ? intervalMs : (i & 1 ? 110 : 90));
+  }
+  return nowMs;
+}
+
+void testCommsWatchdog() {
+  CommsWatchdog<2> watchdog(1000, 4000);
+
+  // nothing's late until a stream has learned its rate
+  uint32_t t = arrive(watchdog, 0, 1000, 200, CommsWatchdog<2>::MIN_SAMPLES);    // one interval short
+  CHECK(!watchdog.isLearned(0));
+  CHECK(!watchdog.isLate(t + 5000) && !watchdog.isTimedOut(t + 5000));
+
+  // steady 5hz: mean 200, the jitter dies away, alert at 3 periods & OFF at 6
+  t = arrive(watchdog, 0, t + 200, 200, 40);
+  CHECK(watchdog.isLearned(0));
+  CHECK(watchdog.meanMs(0) == 200 && watchdog.jitterMs(0) == 0);
+  CHECK(watchdog.alertMs(0) == 600 && watchdog.timeoutMs(0) == 1200);
+  CHECK(watchdog.sinceMs(t + 250) == 250);
+  CHECK(!watchdog.isLate(t + 600) && watchdog.isLate(t + 601));
+  CHECK(!watchdog.isTimedOut(t + 1200));
+  CHECK(watchdog.isTimedOut(t + 1201));
+  CHECK(!watchdog.isTimedOut(t + 1500));                        // once per outage
+  watchdog.arrived(0, t + 1600);                                // back, the outage is over
+  CHECK(!watchdog.isLate(t + 1700));
+  CHECK(watchdog.isTimedOut(t + 1600 + watchdog.timeoutMs(0) + 1));    // the next outage trips again
+
+  // jittery 10hz: the mean settles on 100, jitter on the 10ms each interval is out
+  watchdog.reset();
+  CHECK(!watchdog.isLearned(0));
+  t = arrive(watchdog, 0, 0, 0, 200);
+  CHECK(watchdog.meanMs(0) >= 99 && watchdog.meanMs(0) <= 101);
+  CHECK(watchdog.jitterMs(0) >= 8 && watchdog.jitterMs(0) <= 12);
+  CHECK(watchdog.alertMs(0) == 3 * watchdog.periodMs(0) && watchdog.periodMs(0) == watchdog.meanMs(0) + 4UL * watchdog.jitterMs(0));
+
+  // a gap longer then maxTimeoutMs is comms lost, not the rate, so it isn't learned
+  uint16_t mean = watchdog.meanMs(0), jitter = watchdog.jitterMs(0);
+  watchdog.arrived(0, t + 4001);
+  CHECK(watchdog.meanMs(0) == mean && watchdog.jitterMs(0) == jitter);
+
+  // 50hz: 3 & 6 periods would be 60 & 120ms, the floor is minMs
+  watchdog.reset();
+  t = arrive(watchdog, 0, 0, 20, 40);
+  CHECK(watchdog.meanMs(0) == 20);
+  CHECK(watchdog.alertMs(0) == 300 && watchdog.timeoutMs(0) == 300);
+  CHECK(!watchdog.isLate(t + 300) && watchdog.isLate(t + 301));
+
+  // 1hz: 3 & 6 periods would be 3s & 6s, capped at the fixed periods
+  watchdog.reset();
+  t = arrive(watchdog, 0, 0, 1000, 40);
+  CHECK(watchdog.meanMs(0) == 1000);
+  CHECK(watchdog.alertMs(0) == 1000 && watchdog.timeoutMs(0) == 4000);
+  CHECK(!watchdog.isTimedOut(t + 4000) && watchdog.isTimedOut(t + 4001));
+
+  // two streams: late only when every learned one is, a stream that hasn't learned doesn't count
+  watchdog.reset();
+  t = arrive(watchdog, 0, 0, 100, 20);
+  watchdog.arrived(1, t);                                       // seen once, not learned
+  CHECK(watchdog.isLate(t + 301));
+  uint32_t t1 = arrive(watchdog, 1, t + 100, 100, 20);          // stream 1 keeps going after stream 0 stops
+  CHECK(!watchdog.isLate(t1 + 100) && !watchdog.isTimedOut(t1 + 100));
+  CHECK(watchdog.isLate(t1 + 301) && watchdog.isTimedOut(t1 + 601));
+}
+
+
+// ********************************************* speedPulse.h **************************************
+struct SpeedPulseRow {
+  uint32_t pulsesPerKm;
+  uint8_t gpsSpeed;             // km/hr * 10
+  uint32_t frequencyQ8;         // frequencyFor()
+  uint8_t prescaler;            // Timer2 CS22:0 - 1, SLOW for the tick & phase accumulator, OFF for held LOW
+  uint8_t top;
+  uint8_t fraction;
+};
+const uint8_t SLOW = 0xFE, OFF = 0xFF;
+
+void testSpeedPulse() {
+  SpeedPulse pulse;
+  CHECK(pulse.begin(3));
+  SpeedPulseTimer2& t = speedPulseTimer2();
+
+  // a few worked out by hand, 16mhz: f = 16e6 / (2 * prescaler * (top + fraction / 256))
+  const SpeedPulseRow rows[] = {
+    { 130000,   0,      0, OFF,    0,   0 },
+    {   5000,   5,    177, OFF,    0,   0 },      // 0.69hz, under 1hz
+    {   5000,   8,    284, SLOW,   0,   0 },      // 1.1hz
+    { 130000,   5,   4622, SLOW,   0,   0 },      // 18.06hz, under the 30.7hz prescaler 1024 & TOP 254 goes down to
+    { 130000,  10,   9244,   6,  216,  91 },      // 36.1hz, 1024 * 216.36
+    { 130000, 100,  92444,   4,  173,  20 },      // 361hz, 128 * 173.08
+    {  58600, 255, 106261,   4,  150, 147 },      // 415hz, 128 * 150.57
+    {16000000, 30, 3413333,  1,   75,   0 },      // 13.3khz, 8 * 75, not dithered over 10khz
+    {16000000, 255, 29013333, 0,  71,   0 },      // 113khz, 1 * 70.6 rounded to 71
+  };
+  for (const SpeedPulseRow& r : rows) {
+    pulse.pulsesPerKm = r.pulsesPerKm;
+    pulse.setSpeed(r.gpsSpeed);
+    CHECK(pulse.frequencyFor(r.gpsSpeed) == r.frequencyQ8);
+    if (r.prescaler == OFF) CHECK(pulse.frequencyQ8 == 0);
+    else if (r.prescaler == SLOW) CHECK(t.phaseStep != 0 && pulse.frequencyQ8 != 0);
+    else CHECK(t.phaseStep == 0 && t.prescaler == r.prescaler && t.top == r.top && t.fraction == r.fraction);
+  }
+
+  // every speed: frequencyFor() rounds down to 1/256 hz, the smallest prescaler that fits is used, the output is within
+  // ~0.01% (+ the 1/256 hz) up to 10khz, 1/(2 * TOP) above it, nothing under 1hz
+  const uint32_t perKm[] = { 5000, 58600, 130000, 1000000, 16000000 };
+  bool isRounded = true, isPrescaler = true, isInError = true, isCutOff = true;
+  for (uint32_t ppk : perKm) {
+    pulse.pulsesPerKm = ppk;
+    for (uint32_t speed = 0; speed < 256; speed++) {
+      uint32_t fQ8 = pulse.frequencyFor(speed);
+      if (fQ8 != uint64_t(speed) * ppk * 256 / 36000) isRounded = false;
+      pulse.setSpeed(speed);
+      double hz = speed * ppk / 36000.0, outHz = pulse.frequencyQ8 / 256.0;
+      if (fQ8 < 256) {
+        if (pulse.frequencyQ8 != 0) isCutOff = false;
+        continue;
+      }
+      uint32_t countsQ8 = SpeedPulseTimer2::CLOCK * 128UL;        // CLOCK / 2 in 1/256 hz
+      double maxError = hz * 0.0001 + 2 / 256.0;
+      if (t.phaseStep != 0) {
+        if (countsQ8 / 1024 / fQ8 <= 254) isPrescaler = false;     // prescaler 1024 would have done
+      } else {
+        const uint16_t* prescalers = SpeedPulseTimer2::prescalers();
+        if (t.top < 2 || t.top + (t.fraction ? 1 : 0) > 255) isPrescaler = false;
+        if (t.prescaler > 0 && countsQ8 / prescalers[t.prescaler - 1] / fQ8 <= 254) isPrescaler = false;
+        if (fQ8 > SpeedPulseTimer2::DITHER_MAX_Q8) maxError += hz / (2.0 * t.top);
+      }
+      if (fabs(outHz - hz) > maxError) isInError = false;
+    }
+  }
+  CHECK(isRounded);
+  CHECK(isPrescaler);
+  CHECK(isInError);
+  CHECK(isCutOff);
+
+  // the dither adds fraction 1s to TOP in every 256 periods
+  pulse.pulsesPerKm = 130000;
+  pulse.setSpeed(10);
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < 256; i++) sum += t.nextTop();
+  CHECK(sum == 216 * 256 + 91);
+
+  // slow mode toggles the pin 2 * f times a second, 18.06hz for 10s of 2khz ticks
+  pulse.setSpeed(5);
+  uint32_t toggles = 0;
+  for (uint32_t i = 0; i < 10 * SpeedPulseTimer2::TICK_HZ; i++) if (t.tick()) toggles++;
+  CHECK(toggles == 361);
+  CHECK(pulse.frequencyQ8 == 4622 || pulse.frequencyQ8 == 4621);
+
+  pulse.setSpeed(0);
+  CHECK(pulse.frequencyQ8 == 0);
+}
+
+
+// ********************************************* sectionTiming.h on the output scheduler ***********
+#ifndef BENCH_ESP32
+uint32_t section1ChangeUs = 0;
+
+void stampSection1(uint8_t pin, uint8_t) {
+  if (pin == outputPins[0]) section1ChangeUs = micros();
+}
+
+// starts the machine's output scheduler for good, so it runs last
+void testScheduledSectionEdges() {
+  const uint32_t TICK_US = 250, LATENCY_US = 10000;           // has to cover the loop period
+  const uint32_t POLL_US = 10;                                // how often the host "timer" runs
+  const uint32_t LOOP_US = 7130;                              // a slow loop(), watchdogCheck() up to 7ms after the edges came due
+  HostPins& pins = hostPins();
+  void (*prevOnWrite)(uint8_t, uint8_t) = pins.onWrite;
+  pins.onWrite = stampSection1;
+
+  uint64_t us = 5000370;
+  HostClock::set(us);
+  CHECK(machine.startOutputScheduler(TICK_US, LATENCY_US));
+  machine.sectionTiming.lookAheadOnMs = 400;
+  machine.sectionTiming.lookAheadOffMs = 300;
+  machine.sectionTiming.setValveDelays(200, 250);
+  machine.sectionTiming.isEnabled = true;
+
+  // each edge lands latency after its due ms, within a tick + the ms it came due in, whichever loop() pass saw it
+  bool isEarly = false, isLate = false, isMissing = false;
+  for (uint32_t i = 0; i < 20; i++) {
+    bool isOn = !(i & 1);
+    section1ChangeUs = 0;
+    sendSectionData(isOn ? 1 : 0);
+    uint32_t dueUs = (millis() + (isOn ? 200 : 50)) * 1000UL + LATENCY_US;
+    uint32_t nextLoopUs = uint32_t(us) + i * 1009 % LOOP_US;
+    while (section1ChangeUs == 0 && int32_t(uint32_t(us) - dueUs) < int32_t(LOOP_US + 2000)) {
+      HostClock::set(us += POLL_US);
+      if (int32_t(uint32_t(us) - nextLoopUs) >= 0) {
+        machine.watchdogCheck();
+        nextLoopUs += LOOP_US;
+      }
+      machine.outputScheduler.poll();
+    }
+    if (section1ChangeUs == 0) isMissing = true;
+    else if (int32_t(section1ChangeUs - dueUs) < 0) isEarly = true;
+    else if (section1ChangeUs - dueUs >= 1000 + TICK_US + POLL_US) isLate = true;
+    HostClock::set(us += 50000);
+  }
+  CHECK(!isEarly && !isLate && !isMissing);
+
+  machine.sectionTiming.isEnabled = false;
+  sendSectionData(0);
+  pins.onWrite = prevOnWrite;
+  HostClock::useRealClock();
+}
+#endif
+
+
+int main() {
+  machineInit();
+
+  testCalculateCRC();
+  testPgnFramer();
+  testOutputPorts();
+  testActiveLow();
+  testHydLift();
+  testSectionTiming();
+  testCommsWatchdog();
+  testTimingWheel();
+  testOutputScheduler();
+  testSpeedPulse();
+#ifdef BENCH_TEENSY
+  testI2cAsyncWriter();
+#endif
+#ifndef BENCH_ESP32
+  testScheduledSectionEdges();                                // last, the output scheduler can't be stopped
+#endif
+
+  printf("%s: %u checks, %u failed\n", variant, checks, failures);
+  return failures ? 1 : 0;
+}
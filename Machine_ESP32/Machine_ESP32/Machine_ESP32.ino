@@ -34,7 +34,12 @@ uint16_t udpListenPort = 8888;         // UDP port to listen for AOG PGNs
 uint16_t udpSendPort   = 9999;         // UDP port to send PGN data back to AgIO/AOG
 IPAddress udpDestIP;              // assigned in wifi.ino, myIP.255
 
+//#define CYCLE_BENCH                          // uncomment to time the PGN to outputs stages in CPU cycles, 'b' on Serial prints them (see cycleBench.h)
 #include "machine.h"
+#include "pgnFramer.h"
+#include "pgnRouter.h"
+#include "outputPorts.h"
+#include "outputScheduler.h"
 MACHINE machine;
 //MACHINE::States machineStates;   
 
@@ -49,6 +54,10 @@ byte machineOutputPins[numMachineOutputs] = { D0, D1, D2, D3, D4, D5, D8, D9 };
 //const byte numMachineOutputs = 8;
 //byte machineOutputPins[numMachineOutputs] = { 12, 13, 5, 23, 19, 18, 21, 22 };
 
+OutputPorts<numMachineOutputs> machineOutputPorts;     // writes machineOutputPins with the GPIO set/clear registers, see outputs.ino
+OutputScheduler<OutputPorts<numMachineOutputs>> outputScheduler;    // writes machineOutputPorts from an esp_timer, a fixed time after the PGN
+const uint32_t OUTPUT_LATENCY_US = 3000;               // PGN in to outputs out, has to cover the slowest PGN parse incl Serial prints
+
 void setup() {
   delay(500);           // for ESP, to settle boot up power surges
   Serial.begin(115200);
@@ -56,13 +65,19 @@ void setup() {
 
   setupWifi();    // blocks further execution if connecting fails
   setupUDP();
-  EEPROM.begin(150);    // enough for all needed EEPROM storage (only needed for ESP)
+  EEPROM.begin(200);    // enough for all needed EEPROM storage (only needed for ESP)
 
-  machine.init(100);    // 100 is address for machine EEPROM storage (uses 33 bytes)
+  machine.init(100);    // 100 is address for machine EEPROM storage (uses 68 bytes)
   //machine.setSectionOutputsHandler(updateSectionOutputs);
   machine.setMachineOutputsHandler(updateMachineOutputs);
   machine.setUdpReplyHandler(pgnReplies);
+  //machine.speedPulse.pulsesPerKm = 130000;           // radar style GPS speed output, 130000 is 36.1hz per km/hr
+  //machine.speedPulse.begin(D10);                     // any free GPIO (LEDC)
   setOutputPinModes();
+  //outputScheduler.begin(&machineOutputPorts, 250);   // outputs on a 250us tick OUTPUT_LATENCY_US after the PGN, instead of straight from it
+#ifdef CYCLE_BENCH
+  cycleBench().begin();
+#endif
 
   Serial.print("\r\n\nSetup complete\r\n*******************************************\r\n");
 }
@@ -74,13 +89,15 @@ void loop() {
   yield();
 
   machine.watchdogCheck();
+  printOutputChanges();
 
   if (Serial.available()) parseSerial();
 }
 
 
 void parseSerial() {
-  if (Serial.read() == 'm'){
+  char cmd = Serial.read();
+  if (cmd == 'm'){
     if (Serial.available()) {
       if (Serial.peek() >= '0' && Serial.peek() <= '5') {
         machine.debugLevel = Serial.read() - '0';   // -0 to convert ASCII char value to numerical ('0' is ASCII #48)
@@ -88,4 +105,34 @@ void parseSerial() {
     }
     Serial.print("\r\nMachine debug level: "); Serial.print(machine.debugLevel);
   }
+  else if (cmd == 'c'){                            // print (and reset with "cr") PGN accepted/rejected/dropped counters
+    machine.printPgnCounters();
+    printPgnDrops();
+    if (Serial.available() && Serial.peek() == 'r') {
+      Serial.read();
+      machine.resetPgnCounters();
+      resetPgnDrops();
+      Serial.print("\r\n- counters reset");
+    }
+  }
+  else if (cmd == 'l'){                            // print (and reset with "lr") the 64 Section Data to outputs latency histogram
+    machine.printSectionLatency();
+    if (Serial.available() && Serial.peek() == 'r') {
+      Serial.read();
+      machine.sectionLatency.reset();
+      Serial.print("\r\n- latency reset");
+    }
+  }
+  else if (cmd == 'b'){                           // print (and reset with "br") the CYCLE_BENCH stage timings
+#ifdef CYCLE_BENCH
+    cycleBench().print();
+    if (Serial.available() && Serial.peek() == 'r') {
+      Serial.read();
+      cycleBench().reset();
+      Serial.print("\r\n- cycle bench reset");
+    }
+#else
+    Serial.print("\r\nCYCLE_BENCH isn't defined");
+#endif
+  }
 }
\ No newline at end of file
@@ -8,108 +8,112 @@
 //#define UDP_MAX_PACKET_SIZE 40         // Buffer For Receiving 8888 UDP PGN Data
 uint32_t pgn254Time, pgn254MaxDelay, pgn254AveDelay, pgn254MinDelay = 99999;
 
-void checkForPGNs(AsyncUDPPacket packet)
+AsyncUDPPacket* pgnPacket;        // packet currently being parsed, for the PGN handlers below
+
+void checkForPGNs(AsyncUDPPacket& packet)
 {
+  CYCLE_BENCH_SCOPE(CycleBench::NETWORK);     // the AsyncUDP callback, parsing the PGNs (lwIP's receive is in its own task, not counted)
   if (packet.remotePort() != 9999 || packet.length() < 5) return;  //make sure from AgIO
 
-  if (packet.data()[0] != 0x80 || packet.data()[1] != 0x81 || packet.data()[2] != 0x7F) return;  // verify first 3 PGN header bytes
-
-
-
-  #ifdef MACHINE_H
-    // 0xE5 (229) - 64 Section Data
-    // 0xEB (235) - Section Dimensions
-    // 0xEC (236) - Machine Pin Config
-    // 0xEE (238) - Machine Config
-    // 0xEF (239) - Machine Data
-    if (machine.parsePGN(packet.data(), packet.length(), packet.remoteIP(), myIP))    // look for Machine PGNs, return TRUE if machine specific PGN was found
-    {
-      return;   // abort further PGN processing if machine specific PGN as received/parsed
-    }
-  #endif
+  // there can be more then one PGN in each packet
+  machine.stampPacket(micros());      // start of the 64 Section Data to outputs latency
+  pgnPacket = &packet;
+  PgnFramer::parseBuffer(packet.data(), packet.length(), checkForPGN);
+}
 
 
 
-  if (packet.data()[3] == 100 && packet.length() == 30)         // 0x64 (100) - Corrected Position
-  {
-    //printPgnAnnoucement(packet, (char*)"Corrected Position");
-    return;                    // no other processing needed
-  }
+// each PGN this module uses has its own handler, SketchPGNs (below) lists them
+bool machinePGNs(uint8_t* pgnData, uint8_t len)
+{
+  // 0xC8 (200) - Hello from AgIO, returns false so it's also printed below
+  // 0xCA (202) - Scan Request, returns false so it's also printed below
+  // 0xD1 (209) - Latency Request, 64 Section Data to outputs latency histogram
+  // 0xE5 (229) - 64 Section Data
+  // 0xEB (235) - Section Dimensions
+  // 0xEC (236) - Machine Pin Config
+  // 0xEE (238) - Machine Config
+  // 0xEF (239) - Machine Data
+  return machine.parsePGN(pgnData, len, pgnPacket->remoteIP(), myIP);   // return TRUE if machine specific PGN was found
+}
 
 
 
-  if (packet.data()[3] == 200 && packet.length() == 9)          // 0xC8 (200) - Hello from AgIO
-  {
-    printPgnAnnoucement(packet, (char*)"Hello from AgIO");
-    return;
-  } // 0xC8 (200) - Hello from AgIO
+bool helloFromAgIO(uint8_t* pgnData, uint8_t len)       // 0xC8 (200) - Hello from AgIO
+{
+  printPgnAnnoucement(pgnData, len, (char*)"Hello from AgIO");
+  return true;
+}
 
 
 
-  if (packet.data()[3] == 201 && packet.length() == 11)         // 0xC9 (201) - Subnet Change
+bool subnetChange(uint8_t* pgnData, uint8_t len)        // 0xC9 (201) - Subnet Change
+{
+  printPgnAnnoucement(pgnData, len, (char*)"Subnet Change");
+  if (pgnData[4] == 5 && pgnData[5] == 201 && pgnData[6] == 201)
   {
-    printPgnAnnoucement(packet, (char*)"Subnet Change");
-    if (packet.data()[4] == 5 && packet.data()[5] == 201 && packet.data()[6] == 201)
-    {
-      Serial.print("\r\n- IP changed from "); Serial.print(myIP);
-      myIP[0] = packet.data()[7];
-      myIP[1] = packet.data()[8];
-      myIP[2] = packet.data()[9];
-
-      Serial.print(" to "); Serial.print(myIP);
-
-      //Serial.print("\r\n- Saving to EEPROM and restarting Teensy");
-      //UDP.SaveModuleIP();  //save in EEPROM and restart
-      delay(10);
-      // reboot ESP here?
-    }
-    return; // no other processing needed
-  }  // 0xC9 (201) - Subnet Change
+    Serial.print("\r\n- IP changed from "); Serial.print(myIP);
+    myIP[0] = pgnData[7];
+    myIP[1] = pgnData[8];
+    myIP[2] = pgnData[9];
 
+    Serial.print(" to "); Serial.print(myIP);
 
+    //Serial.print("\r\n- Saving to EEPROM and restarting Teensy");
+    //UDP.SaveModuleIP();  //save in EEPROM and restart
+    delay(10);
+    // reboot ESP here?
+  }
+  return true;
+}
 
-  if (packet.data()[3] == 202 && packet.length() == 9)          // 0xCA (202) - Scan Request
-  {
-    printPgnAnnoucement(packet, (char*)"Scan Request");
-    Serial.print("\r\nAgIO   "); Serial.print(packet.remoteIP());
-    Serial.print(":"); Serial.print(packet.remotePort());
-    Serial.print("\r\nModule "); Serial.print(myIP);   // packet.localIP() returns the dest IP of 255.255.255.255.255 for Scan Request
-    Serial.print(":"); Serial.print(packet.localPort());
-    return;
-  } // 0xCA (202) - Scan Request
 
 
+bool scanRequest(uint8_t* pgnData, uint8_t len)         // 0xCA (202) - Scan Request
+{
+  printPgnAnnoucement(pgnData, len, (char*)"Scan Request");
+  Serial.print("\r\nAgIO   "); Serial.print(pgnPacket->remoteIP());
+  Serial.print(":"); Serial.print(pgnPacket->remotePort());
+  Serial.print("\r\nModule "); Serial.print(myIP);   // packet.localIP() returns the dest IP of 255.255.255.255.255 for Scan Request
+  Serial.print(":"); Serial.print(pgnPacket->localPort());
+  return true;
+}
 
-  if (packet.data()[3] == 251 && packet.length() == 14)         // 0xFB (251) - SteerConfig
-  {
-    //printPgnAnnoucement(packet, (char*)"Steer Config");
-    return; // no other processing needed
-  }  // 0xFB (251) - SteerConfig
 
 
+bool steerData(uint8_t* pgnData, uint8_t len)           // 0xFE (254) - Steer Data, only its arrival time is used here
+{
+  machine.steerDataArrived();         // AOG sends it every GPS fix, so machine.commsWatchdog learns the rate from it too
+  return true;
+}
 
-  if (packet.data()[3] == 252 && packet.length() == 14)         // 0xFC (252) - Steer Settings
-  {
-    //printPgnAnnoucement(packet, (char*)"Steer Settings");
-    return; // no other processing needed
-  }  // 0xFC (252) - Steer Settings
 
 
+// resolved at compile time, only the handlers listed here are compiled in
+typedef PgnRouter<
+  PgnRange<MACHINE::PGN_TABLE_FIRST, MACHINE::PGN_TABLE_FIRST + MACHINE::PGN_TABLE_SIZE - 1, machinePGNs>,
+  PgnIgnore<100, 30>,                           // 0x64 (100) - Corrected Position
+  PgnHandler<200, 9, helloFromAgIO>,
+  PgnHandler<201, 11, subnetChange>,
+  PgnHandler<202, 9, scanRequest>,
+  PgnIgnore<251, 14>,                           // 0xFB (251) - SteerConfig
+  PgnIgnore<252, 14>,                           // 0xFC (252) - Steer Settings
+  PgnHandler<254, 14, steerData>                // 0xFE (254) - Steer Data (sent at GPS freq, ie 10hz (100ms))
+> SketchPGNs;
 
-  if (packet.data()[3] == 254 && packet.length() == 14)        // 0xFE (254) - Steer Data (sent at GPS freq, ie 10hz (100ms))
-  {
-    //printPgnAnnoucement(packet, (char*)"Steer Data");
-    return; // no other processing needed
-  }  // 0xFE (254) - Steer Data
+PgnFilter<SketchPGNs, 16> pgnFilter;           // drops everything SketchPGNs doesn't handle (ie Corrected Position) in one bit test
 
+void printPgnDrops() { pgnFilter.printDrops(Serial); }
+void resetPgnDrops() { pgnFilter.resetDrops(); }
 
+void checkForPGN(uint8_t* pgnData, uint8_t len)
+{
+  if (!pgnFilter.pass(pgnData[3])) return;                                       // not used by this module, counted in pgnFilter
+  if (pgnData[0] != 0x80 || pgnData[1] != 0x81 || pgnData[2] != 0x7F) return;  // verify first 3 PGN header bytes
 
-  printPgnAnnoucement(packet, (char*)"Unprocessed/unrecognized PGN");
-}
+  if (SketchPGNs::handle(pgnData, len)) return;
 
-void printPgnAnnoucement(AsyncUDPPacket packet, char* _pgnName)
-{
-  printPgnAnnoucement(packet.data(), packet.length(), _pgnName);
+  printPgnAnnoucement(pgnData, len, (char*)"Unprocessed/unrecognized PGN");
 }
 
 void printPgnAnnoucement(uint8_t* _data, uint8_t _len, char* _pgnName)
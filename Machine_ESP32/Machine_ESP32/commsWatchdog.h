@@ -0,0 +1,134 @@
+/*
+  Comms watchdog that learns how often AOG's PGNs really arrive, instead of a fixed few seconds
+    - arrived() is called for each frame of a stream (ie 64 Section Data, Steer Data), each stream keeps its own
+      inter-arrival mean & mean deviation (jitter) with integer moving averages, the same way TCP times its retransmits
+      - mean moves 1/8 & jitter 1/4 of the way to each new interval, a gap longer then maxTimeoutMs isn't learned
+    - a stream's period is mean + 4 x jitter, so a jittery link (ie ESP32 WiFi) gets more room than a steady one
+      - alert after alertPeriods x period, timeout after timeoutPeriods x period, never less then minMs
+        and never more then maxAlertMs/maxTimeoutMs (the old fixed periods)
+    - comms are late only when every stream that's learned its rate (MIN_SAMPLES) is late, so a stream AOG stops sending
+      (ie autosteer turned off) doesn't trip it, until a stream has learned isLate()/isTimedOut() are false
+    - isTimedOut() is true once per outage, the next frame of any stream starts over
+    - integer math only, millis() is passed in so it runs on the host too (Host_Bench)
+
+  Example:
+    CommsWatchdog<2> commsWatchdog(1000, 4000);           // the fixed alert/timeout periods are the upper bounds
+    commsWatchdog.arrived(0, millis());                   // 64 Section Data
+    commsWatchdog.arrived(1, millis());                   // Steer Data
+    if (commsWatchdog.isTimedOut(millis())) allOff();     // 10hz with 5ms of jitter: alert at 360ms, OFF at 720ms
+*/
+
+#ifndef COMMSWATCHDOG_H
+#define COMMSWATCHDOG_H
+
+#include <stdint.h>
+
+template <uint8_t STREAMS = 2>
+class CommsWatchdog
+{
+public:
+  static const uint8_t MIN_SAMPLES = 8;   // intervals before a stream's rate is trusted
+
+  uint8_t alertPeriods = 3;
+  uint8_t timeoutPeriods = 6;
+  uint16_t minMs = 300;                   // so a fast stream can't trip on one slow AgIO loop
+  uint16_t maxAlertMs;
+  uint16_t maxTimeoutMs;
+
+  // the fixed alert/timeout periods are the upper bounds
+  CommsWatchdog(uint16_t _maxAlertMs = 1000, uint16_t _maxTimeoutMs = 4000)
+    : maxAlertMs(_maxAlertMs), maxTimeoutMs(_maxTimeoutMs) {}
+
+  void arrived(uint8_t s, uint32_t nowMs)
+  {
+    if (s >= STREAMS) return;
+    Arrivals& st = streams[s];
+    isTripped = false;
+    if (!st.isSeen) {
+      st.isSeen = true;
+      st.lastMs = nowMs;
+      return;
+    }
+
+    uint32_t interval = nowMs - st.lastMs;
+    st.lastMs = nowMs;
+    if (interval > maxTimeoutMs) return;          // comms were lost, not the stream's rate
+
+    if (st.samples == 0) {
+      st.mean8 = interval << 3;
+      st.jitter4 = interval << 1;                 // half the first interval until there's more to go on
+    } else {
+      int32_t err = int32_t(interval) - int32_t(st.mean8 >> 3);
+      st.mean8 += err;                            // mean += err / 8
+      if (err < 0) err = -err;
+      st.jitter4 += err - int32_t(st.jitter4 >> 2);   // jitter += (|err| - jitter) / 4
+    }
+    if (st.samples < 0xFF) st.samples++;
+  }
+
+  bool isLearned(uint8_t s) { return s < STREAMS && streams[s].samples >= MIN_SAMPLES; }
+  uint16_t meanMs(uint8_t s) { return s < STREAMS ? streams[s].mean8 >> 3 : 0; }
+  uint16_t jitterMs(uint8_t s) { return s < STREAMS ? streams[s].jitter4 >> 2 : 0; }
+  uint32_t periodMs(uint8_t s) { return meanMs(s) + 4UL * jitterMs(s); }
+
+  uint16_t alertMs(uint8_t s) { return limit(alertPeriods * periodMs(s), maxAlertMs); }
+  uint16_t timeoutMs(uint8_t s) { return limit(timeoutPeriods * periodMs(s), maxTimeoutMs); }
+
+  // since the last frame of any stream
+  uint32_t sinceMs(uint32_t nowMs)
+  {
+    uint32_t since = 0xFFFFFFFF;
+    for (uint8_t s = 0; s < STREAMS; s++) {
+      if (streams[s].isSeen && nowMs - streams[s].lastMs < since) since = nowMs - streams[s].lastMs;
+    }
+    return since;
+  }
+
+  // every learned stream is past its alert period
+  bool isLate(uint32_t nowMs) { return isPast(nowMs, false); }
+
+  // every learned stream is past its timeout period, only true once until a frame arrives
+  bool isTimedOut(uint32_t nowMs)
+  {
+    if (isTripped || !isPast(nowMs, true)) return false;
+    isTripped = true;
+    return true;
+  }
+
+  // forget the learned rates, ie AgIO restarted at a different GPS rate
+  void reset()
+  {
+    for (uint8_t s = 0; s < STREAMS; s++) streams[s] = Arrivals();
+    isTripped = false;
+  }
+
+private:
+  struct Arrivals {
+    bool isSeen = false;
+    uint8_t samples = 0;
+    uint32_t lastMs = 0;
+    uint32_t mean8 = 0;           // ms * 8
+    uint32_t jitter4 = 0;         // ms * 4
+  } streams[STREAMS];
+
+  bool isTripped = false;
+
+  uint16_t limit(uint32_t ms, uint16_t maxMs)
+  {
+    if (ms < minMs) ms = minMs;
+    return (ms > maxMs ? maxMs : uint16_t(ms));
+  }
+
+  bool isPast(uint32_t nowMs, bool isTimeout)
+  {
+    bool isAnyLearned = false;
+    for (uint8_t s = 0; s < STREAMS; s++) {
+      if (!isLearned(s)) continue;
+      isAnyLearned = true;
+      if (nowMs - streams[s].lastMs <= (isTimeout ? timeoutMs(s) : alertMs(s))) return false;
+    }
+    return isAnyLearned;
+  }
+};
+
+#endif
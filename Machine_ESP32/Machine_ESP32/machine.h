@@ -6,13 +6,24 @@
     - uses a callback function for the hardware interfacing (ie Arduino digitalWrite or PCA9685 I2C cmds)
       - SectionOutputs_Handler() callback function is called by 0xE5 (229) "64 Section Data" PGN updates
       - MachineOutputs_Handler() is called by updateMachineStates()
+      - both get the old & new states and a mask of the bits that changed, so only the outputs that changed need writing
         - which is also called by the 64 Section PGN because updateMachineStates() uses the section 1-16 data in the 64 Section PGN
     - currently only properly supports 24 output pins
+    - optional valve latency compensation for the sections (sectionTiming), edges go out from watchdogCheck() when they're due
+      so their timing is only as good as the loop period, unless the output scheduler writes them (see sectionTiming.h)
+      - the callbacks get the compensated section states, states.sections has them as AOG sent them
+    - 64 Section Data in to outputs written latency histogram (sectionLatency), the sketch stamps packets with stampPacket()
+    - optional GPS speed pulse output from a timer/PWM peripheral (speedPulse.begin(pin))
+    - comms watchdog learns the 64 Section Data & Steer Data rates (commsWatchdog), outputs go OFF after a few missed periods
+      the fixed watchdogTimeoutPeriod is the upper bound, the sketch calls steerDataArrived() as Steer Data isn't a machine PGN
+    - #define CYCLE_BENCH before including this to time the PGN to outputs stages in CPU cycles (see cycleBench.h)
+      - the callbacks call outputWritten() when they write the outputs (or with when a queued write goes out, ie OutputScheduler)
+    - the AsyncUDP task (PGNs) and loop() (watchdogCheck()) both update the states & outputs, maybe on different cores
+      so the updates & the callbacks run in a critical section (lockOutputs()), the callbacks have to be short: no Serial, no delay()
 
 
   To do:
     - add section switch code, maybe in it's own class?
-    - add GPS speed output options/code
     - maybe split up machine functions and sections into seperate classes or seperate output groups
 */
 
@@ -23,6 +34,11 @@
 #include "elapsedMillis.h"
 #include "IPAddress.h"
 #include <stdint.h>
+#include "sectionTiming.h"
+#include "speedPulse.h"
+#include "commsWatchdog.h"
+#include "cycleBench.h"
+#include "latencyHistogram.h"
 
 class MACHINE
 {
@@ -58,8 +74,9 @@ public:
     uint8_t sec1to8;              // section 1 to 8 from Machine Data PGN
     uint8_t sec9to16;             // section 9 to 16 from Machine Data PGN
 
-    // read value from Machine Data and set 1 or zero according to list, 21 different function types
-    bool functions[1 + 21] = { 0, 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };   // index 0 is not used
+    // 21 different function types, bit n is function n (bit 0 is not used), all set in one go by updateMachineStates()
+    uint32_t functions = 0;
+    uint32_t changedFunctions = 0;  // functions that changed in the last update (XOR of the old & new states)
     /* function numbers as below
     1-16   Section 1-16
     17,18  Hyd Up, Hyd Down,
@@ -85,13 +102,22 @@ public:
     uint8_t user4;
 
     uint8_t pinFunction[1 + 24] = { 0, 1,2,3,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+
+    uint8_t numSections = 0;              // from Section Dimensions PGN
+    uint16_t sectionWidth[16] = { 0 };    // cm, section 1 is the left most
   };
   /* function numbers as below, assigned to pinFunction[], the default above has pin 1-3 as section 1-3
   1-16   Section 1-16
   17,18  Hyd Up, Hyd Down,
   19,20  Tramline Right, Left
   21     Geo Stop  */
-  Config config;   // 33 bytes
+  Config config;   // 66 bytes
+
+  // worked out from config.sectionWidth[] once, when it changes, see updateSectionGeometry()
+  struct SectionGeometry {
+    uint16_t totalWidth = 0;      // cm
+    int16_t offset[16] = { 0 };   // cm, from the centre of the machine to the centre of each section, left is -ve
+  }; SectionGeometry sectionGeometry;
 
   // 24 is max function selectable pins currently supported in AoG
   // all the '1 +' are to eliminate 0 indexing so that outputPinNumber[1] is pin 1 (the first pin)
@@ -106,68 +132,137 @@ public:
 
 private:
   int16_t eeAddr = -1;                            // -1 defaults to no EEPROM saving/loading
-  #define EE_IDENT 11                             // change to force EE to reset to defaults
+  #define EE_IDENT 12                             // change to force EE to reset to defaults
   //bool eeLoadedAtStartup;
 
   //uint8_t numOutputPins = 0;                      // 0 defaults to no direct Arduino pin control
   //const uint8_t maxOutputPins = 24;               // 24 pins can be configured in AoG (Machine Pin Config PGN), 64 sections currently the max supported by AoG
   bool triggerOutputUpdate;
 
+#if defined(ESP32)
+  portMUX_TYPE outputsMux = portMUX_INITIALIZER_UNLOCKED;
+  void lockOutputs() { portENTER_CRITICAL(&outputsMux); }
+  void unlockOutputs() { portEXIT_CRITICAL(&outputsMux); }
+#else
+  void lockOutputs() {}
+  void unlockOutputs() {}
+#endif
+
+  // config.pinFunction/isPinActiveHigh compiled by compilePinMap(), so the pin levels are a bit gather and one XOR
+  struct PinMap {
+    uint8_t functionBit[24];      // states.functions bit for each pin (pin 1 is [0]), 0 is always OFF
+    uint32_t invertMask;          // pins that are LOW when ON (isPinActiveHigh = 0)
+  }; PinMap pinMap;
+
   elapsedMillis watchdogTimer;
   //const uint8_t LOOP_TIME = 200;                  // 5hz
   const uint16_t watchdogTimeoutPeriod = 5000;    // ms, originally was 20 update cycles (4 secs)
   const uint16_t watchdogAlertPeriod = 2000;      // ms, how long after UDP comms lost to alert to possible comms issues
   bool watchdogAlertTriggered;
 
-  typedef void (*ExternalHandler)(void);
-  ExternalHandler SectionOutputs_Handler = NULL;
-  ExternalHandler MachineOutputs_Handler = NULL;
+  // hyd lift runs for config.lowerTime/raiseTime secs of millis() from when AOG's hydLift changes, whatever rate the PGNs come at
+  uint8_t hydTrigger;             // hydLift that started the lift: 1 - lower, 2 - raise, 0 - none
+  bool isHydRunning;              // ON until hydRunMs after hydStartMs, watchdogCheck() turns it OFF between PGNs
+  uint32_t hydStartMs;
+  uint32_t hydRunMs;
+
+  // bit 0 is section 1
+  using SectionsHandler = void (*)(uint64_t oldSections, uint64_t newSections, uint64_t changedSections);
+  // bit 0 is pin 1 (config.pinFunction[1]), levels already inverted for isPinActiveHigh, changedPins is all 24 after a config change
+  using PinsHandler = void (*)(uint32_t oldLevels, uint32_t newLevels, uint32_t changedPins);
+  SectionsHandler SectionOutputs_Handler = NULL;
+  PinsHandler MachineOutputs_Handler = NULL;
 
   using ReplyHandler = void (*)(const uint8_t*, uint8_t, IPAddress);
   ReplyHandler UDPReplyHandler = NULL;
 
+  uint32_t packetUs;              // stampPacket(), when the packet being parsed came in
+  bool isPacketStamped;
+  uint32_t outputWriteUs;         // when the last output write goes out, see outputWritten()
+  bool isOutputWritten;           // cleared at the start of each 64 Section Data
+
 public:
 
   //const States& state = states;
   bool isInit;
+  SectionTiming<64> sectionTiming;    // section valve latency compensation, off until sectionTiming.isEnabled is set (see sectionTiming.h)
+  SpeedPulse speedPulse;             // GPS speed pulse output, off until speedPulse.begin(pin) (see speedPulse.h)
+  CommsWatchdog<2> commsWatchdog{ watchdogAlertPeriod, watchdogTimeoutPeriod };   // learned comms timeout, the fixed periods are its upper bounds (see commsWatchdog.h)
+  static const uint8_t COMMS_SECTION_DATA = 0, COMMS_STEER_DATA = 1;               // commsWatchdog streams
+  LatencyHistogram<24, 2> sectionLatency;   // us from 64 Section Data received to the outputs it changed written, printSectionLatency()
+
+  // pin levels for the machine outputs callback, bit 0 is pin 1 (config.pinFunction[1]), already inverted for isPinActiveHigh
+  uint32_t pinLevels;
+  uint32_t prevPinLevels;         // pinLevels before the last update
+  uint32_t changedPinLevels;      // pins to write, all of them after a config change
+  uint32_t eventUs;               // micros() when the PGN (or watchdogCheck()) that called the callbacks started, ie for an OutputScheduler
 
   MACHINE(void) {}
   ~MACHINE(void) {}
 
-  // 33 bytes of EEPROM used
-  void init(int16_t _eeAddr = -1, const uint8_t _eeSize = 33)
+  // 68 bytes of EEPROM used
+  void init(int16_t _eeAddr = -1, const uint8_t _eeSize = 68)
   {
+    (void)_eeSize;
     eeAddr = _eeAddr;
     /*#ifdef ESP32
       EEPROM.begin();            // needed for ESP
     #endif*/
     loadFromEeprom();
+    compilePinMap();
+    pinLevels = pinMap.invertMask;    // all OFF
 
     // trigger output callback to set all outputs to OFF
 
     isInit = true;
   }
 
+  // Steer Data (254) isn't a machine PGN, the sketch calls this when one arrives so commsWatchdog learns AOG's rate from it too
+  void steerDataArrived() { commsWatchdog.arrived(COMMS_STEER_DATA, millis()); }
+
   void watchdogCheck()
   {
-    if (watchdogTimer > watchdogTimeoutPeriod)    // watchdogTimer reset with Machine Data PGN, should be 64 Section instead or both?
+    CYCLE_BENCH_SCOPE(CycleBench::WATCHDOG);
+    eventUs = micros();
+    lockOutputs();
+    if (sectionTiming.update(millis())) {      // compensated section edges that came due since the PGN
+      // an OutputScheduler in the callback writes them latency after they came due, not after loop() got here
+      eventUs = micros() - uint16_t(uint16_t(millis()) - sectionTiming.dueMs) * 1000UL;
+      updateSectionEdges();
+      eventUs = micros();
+    }
+    if (isHydRunning && millis() - hydStartMs >= hydRunMs) updateHydLiftEdge();    // lift time is up, no need to wait for a PGN
+    unlockOutputs();
+
+    // commsWatchdog trips a few of AOG's periods after the last 64 Section/Steer Data, watchdogTimer (reset when 64 Section Data updates the outputs) is the upper bound
+    uint32_t nowMs = millis();
+    bool isCommsTimedOut = commsWatchdog.isTimedOut(nowMs);
+    if (isCommsTimedOut || watchdogTimer > watchdogTimeoutPeriod)
     {
-      if (debugLevel > 0) Serial.print((String)"\r\n*** UDP Machine Comms lost for " + watchdogTimeoutPeriod / 1000 + "s, setting all outputs OFF! ***");
-      for (uint8_t i = 1; i <= 21; i++) {
-        states.functions[i] = 0;            // set all functions OFF
-      }
+      if (debugLevel > 0) Serial.print((String)"\r\n*** UDP Machine Comms lost for " + (isCommsTimedOut ? commsWatchdog.sinceMs(nowMs) : uint32_t(watchdogTimer)) + "ms, setting all outputs OFF! ***");
+      watchdogAlertTriggered = true;        // so it says when they resume
+      lockOutputs();
+      states.changedFunctions = states.functions;
+      states.functions = 0;                 // set all functions OFF
+      uint64_t prevSections = sectionTiming.outputs;
       states.sections.allSections = 0;      // set all sections OFF
-
-      if (MachineOutputs_Handler != NULL) MachineOutputs_Handler();     // callback function to update machine outputs (incl sections 1-16)
-      if (SectionOutputs_Handler != NULL) SectionOutputs_Handler();     // callback function to update section only outputs
+      sectionTiming.reset();                // right now, no compensation
+      isHydRunning = false;
+      updatePinLevels();
+
+      // callback functions to update machine outputs (incl sections 1-16) & section only outputs, changed is 0 if they're already OFF
+      if (MachineOutputs_Handler != NULL) MachineOutputs_Handler(prevPinLevels, pinLevels, changedPinLevels);
+      if (SectionOutputs_Handler != NULL) SectionOutputs_Handler(prevSections, 0, prevSections);
+      unlockOutputs();
+      speedPulse.setSpeed(0);               // speed unknown, stop the pulses
       watchdogTimer = 0;            // only output timed out OFF every watchdogTimeoutPeriod
     }
-    else if (watchdogTimer > watchdogAlertPeriod)
+    else if (watchdogTimer > watchdogAlertPeriod || commsWatchdog.isLate(nowMs))
     {
       if (debugLevel > 0 && !watchdogAlertTriggered) {
-        Serial.print("\r\n** UDP Machine Comms lost for 2s **\r\n");
-        watchdogAlertTriggered = true;
+        Serial.print((String)"\r\n** UDP Machine Comms lost for " + min(commsWatchdog.sinceMs(nowMs), uint32_t(watchdogTimer)) + "ms **\r\n");
       }
+      watchdogAlertTriggered = true;
     }
   }
 
@@ -175,81 +270,35 @@ public:
   // updating outputs from PGN should be slightly quicker response then waiting for old update loop to trigger, at times the delay was almost 200ms
   void updateMachineStates()
   {
+    CYCLE_BENCH_SCOPE(CycleBench::MACHINE_STATES);
     //Serial.print("\r\nUpdating Machine States");
-    if (debugLevel > 0 && watchdogTimer > watchdogAlertPeriod) {
+    if (debugLevel > 0 && watchdogAlertTriggered) {
       Serial.print("\r\n*** UDP Machine Comms resumed ***");
     }
     watchdogAlertTriggered = false;
     watchdogTimer = 0;   //reset watchdog timer
 
-    static uint8_t lastTrigger;          // "static" means this var is accessible only to this function but its value persists (it's not destroyed)
-    static uint8_t raiseTimer = 0;
-    static uint8_t lowerTimer = 0;
-    bool isRaise, isLower;
-
-    bool prevFunctions[sizeof(states.functions)];
-    memcpy(prevFunctions, states.functions, sizeof(states.functions));
+    lockOutputs();
+    uint8_t hydOutput = updateHydLift();
+    bool isLower = (hydOutput == 1);
+    bool isRaise = (hydOutput == 2);
 
-    if (config.hydLiftEnable)       // hydraulic lift
-    {
-      if (states.hydLift != lastTrigger && (states.hydLift == 1 || states.hydLift == 2))
-      {
-        lastTrigger = states.hydLift;
-        lowerTimer = 0;
-        raiseTimer = 0;
-
-        switch (states.hydLift) {
-          case 1:   //lower
-            lowerTimer = config.lowerTime * 5;      // secs * 5 update cycles per second (5hz)
-            break;
-          case 2:   //raise
-            raiseTimer = config.raiseTime * 5;
-            break;
-        }
-      }
+    // build all the functions at once, sections 1-16 shift straight into functions 1-16
+    uint32_t functions = uint32_t(uint16_t(sectionTiming.outputs)) << 1;
+    if (isRaise) functions |= 1UL << 17;                  // Hydraulics
+    if (isLower) functions |= 1UL << 18;
+    functions |= uint32_t(states.tramline & 0x03) << 19;  // Tram, bit 0 right, bit 1 left
+    if (states.geoStop) functions |= 1UL << 21;           // GeoStop
 
-      if (raiseTimer) {
-        raiseTimer--;
-        lowerTimer = 0;
-      }
-      if (lowerTimer) lowerTimer--;
-
-      //if anything wrong, shut off hydraulics, reset last
-      if (states.hydLift != 1 && states.hydLift != 2) { //|| gpsSpeed < 2)
-        lowerTimer = 0;
-        raiseTimer = 0;
-        lastTrigger = 0;
-      }
+    states.changedFunctions = functions ^ states.functions;
+    states.functions = functions;
 
-      isLower = isRaise = false;          // set both OFF
-      if (lowerTimer) isLower = true;     // if lower is active, set ON
-      if (raiseTimer) isRaise = true;     // if raise is active, set ON
-    }
-    else {      // hyd lift is disabled, make sure any hyd lift pins are OFF
-      isLower = false;
-      isRaise = false;
-    }
-
-    //Load the current output states for section 1-16 only from 64 Sections PGN
-    for (uint8_t i = 0; i < 16; i++) {
-        states.functions[1 + i] = (bool)getSectionState(i);    // copy from 64 Sections PGN
-    }
-  
-    // Hydraulics
-    states.functions[17] = isRaise;
-    states.functions[18] = isLower;
-
-    //Tram
-    states.functions[19] = bitRead(states.tramline, 0); //right
-    states.functions[20] = bitRead(states.tramline, 1); //left
-
-    //GeoStop
-    states.functions[21] = states.geoStop;
-
-    if (triggerOutputUpdate || memcmp(states.functions, prevFunctions, sizeof(states.functions))) {
-      if (MachineOutputs_Handler != NULL) MachineOutputs_Handler();  // callback function to update machine outputs (incl sections 1-16)
+    if (triggerOutputUpdate || states.changedFunctions) {
+      updatePinLevels();
+      if (MachineOutputs_Handler != NULL) MachineOutputs_Handler(prevPinLevels, pinLevels, changedPinLevels);  // callback function to update machine outputs (incl sections 1-16)
       triggerOutputUpdate = false;
     }
+    unlockOutputs();
 
     // *** Sending PGN_237 isn't necessary, doesn't do anything?
     // generic "from machine" PGN template
@@ -269,213 +318,419 @@ public:
     //_udp->endPacket();
   }
 
+  // which hyd lift output is ON: 1 - lower, 2 - raise, 0 - none
+  uint8_t updateHydLift()
+  {
+    if (!config.hydLiftEnable || (states.hydLift != 1 && states.hydLift != 2)) {    // disabled, or anything wrong, shut off hydraulics, reset last
+      hydTrigger = 0;
+      isHydRunning = false;
+      return 0;
+    }
+    if (states.hydLift != hydTrigger) {
+      hydTrigger = states.hydLift;
+      hydStartMs = millis();
+      hydRunMs = (hydTrigger == 1 ? config.lowerTime : config.raiseTime) * 1000UL;
+      isHydRunning = true;
+    }
+    if (isHydRunning && millis() - hydStartMs >= hydRunMs) isHydRunning = false;
+    return (isHydRunning ? hydTrigger : 0);
+  }
+
+  // the hyd lift time ran out between PGNs, only the hyd lift functions change, lockOutputs() first
+  void updateHydLiftEdge()
+  {
+    isHydRunning = false;
+    uint32_t functions = states.functions & ~(3UL << 17);      // Hydraulics OFF
+    states.changedFunctions = functions ^ states.functions;
+    states.functions = functions;
+    if (states.changedFunctions) {
+      updatePinLevels();
+      if (MachineOutputs_Handler != NULL) MachineOutputs_Handler(prevPinLevels, pinLevels, changedPinLevels);
+    }
+  }
+
+  // a compensated section edge came due, only sections 1-16 in states.functions change, the hyd lift is left alone, lockOutputs() first
+  void updateSectionEdges()
+  {
+    uint64_t changedSections = sectionTiming.changed;
+    uint32_t functions = (states.functions & ~0x0001FFFEUL) | (uint32_t(uint16_t(sectionTiming.outputs)) << 1);
+    states.changedFunctions = functions ^ states.functions;
+    states.functions = functions;
+
+    if (states.changedFunctions) {
+      updatePinLevels();
+      if (MachineOutputs_Handler != NULL) MachineOutputs_Handler(prevPinLevels, pinLevels, changedPinLevels);
+    }
+    if (SectionOutputs_Handler != NULL) {
+      SectionOutputs_Handler(sectionTiming.outputs ^ changedSections, sectionTiming.outputs, changedSections);
+    }
+  }
+
 
   // ***************************************************************************************************************************************************
   // ****************************************************** PGN PARSING ********************************************************************************
   // ***************************************************************************************************************************************************
 
+  // packed views of the machine PGNs, cast straight over the receive buffer to read the fields without copying the PGN
+  // all three boards are little endian, so multi byte fields can be read as is (LSB first like AOG sends them)
+  struct __attribute__((packed)) PgnHeader {
+    uint8_t aogHeader[2];           // 0x80, 0x81
+    uint8_t source;                 // 0x7F from AgIO
+    uint8_t pgn;
+    uint8_t dataLen;                // number of data bytes (excludes header & CRC)
+  };
+
+  struct __attribute__((packed)) SectionDataPgn {       // 0xE5 (229) - 64 Section Data
+    PgnHeader header;
+    uint64_t sections;              // bit 0 is section 1
+    uint8_t leftSpeed;
+    uint8_t rightSpeed;
+    uint8_t crc;
+  };
+
+  struct __attribute__((packed)) SectionDimsPgn {       // 0xEB (235) - Section Dimensions
+    PgnHeader header;
+    uint16_t sectionWidth[16];      // cm
+    uint8_t numSections;
+    uint8_t crc;
+  };
+
+  struct __attribute__((packed)) PinConfigPgn {         // 0xEC (236) - Machine Pin Config
+    PgnHeader header;
+    uint8_t pinFunction[24];        // function number for pin 1-24
+    uint8_t crc;
+  };
+
+  struct __attribute__((packed)) MachineConfigPgn {     // 0xEE (238) - Machine Config
+    PgnHeader header;
+    uint8_t raiseTime;
+    uint8_t lowerTime;
+    uint8_t hydLiftEnable;          // not used, see set0
+    uint8_t set0;                   // bit 0: relayActiveHigh, bit 1: hydLiftEnable
+    uint8_t user[4];
+    uint8_t crc;
+  };
+
+  struct __attribute__((packed)) MachineDataPgn {       // 0xEF (239) - Machine Data
+    PgnHeader header;
+    uint8_t uTurn;
+    uint8_t gpsSpeed;               // km/hr * 10
+    uint8_t hydLift;                // 0 - off, 1 - down, 2 - up
+    uint8_t tramline;               // bit 0: right, bit 1: left
+    uint8_t geoStop;
+    uint8_t reserved;
+    uint8_t sec1to8;
+    uint8_t sec9to16;
+    uint8_t crc;
+  };
+
+  static_assert(sizeof(SectionDataPgn) == 16, "64 Section Data PGN is 16 bytes");
+  static_assert(sizeof(SectionDimsPgn) == 39, "Section Dimensions PGN is 39 bytes");
+  static_assert(sizeof(PinConfigPgn) == 30, "Machine Pin Config PGN is 30 bytes");
+  static_assert(sizeof(MachineConfigPgn) == 14, "Machine Config PGN is 14 bytes");
+  static_assert(sizeof(MachineDataPgn) == 14, "Machine Data PGN is 14 bytes");
+  static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "PGN views need a little endian CPU");
+
+
   
+  // all the PGNs this class handles are between 0xC8 (200) and 0xEF (239) so the PGN number can index straight into the dispatch table
+  static const uint8_t PGN_TABLE_FIRST = 200;
+  static const uint8_t PGN_TABLE_SIZE = 40;
+
+  bool checkCRC = true;             // drop machine PGNs with a bad CRC before they change any states/config
+
+  struct PgnCounters {
+    uint32_t accepted;
+    uint32_t badLength;
+    uint32_t badCRC;
+  };
+  PgnCounters pgnCounters[PGN_TABLE_SIZE];    // indexed the same as the dispatch table, see getPgnEntry()
+  uint32_t unknownPgns;                       // AOG PGNs not handled by this class
+
   bool parsePGN(uint8_t *pgnData, uint8_t len, IPAddress sourceIP, IPAddress myIP)
   {
+    CYCLE_BENCH_SCOPE(CycleBench::PARSE_PGN);
     if (len < 5) return false;
-    // should check CRC here too???
     if (pgnData[0] != 0x80 || pgnData[1] != 0x81 || pgnData[2] != 0x7F) return false;    // skip the rest if the first three bytes are NOT AoG headers
 
+    // one table lookup by PGN number instead of checking every PGN number & length in turn
+    const PgnEntry* entry = getPgnEntry(pgnData[3]);
+    if (entry == NULL) {
+      unknownPgns++;
+      return false;   // not a machine PGN, return false for further PGN processing in main/host code
+    }
 
+    PgnCounters& counters = pgnCounters[pgnData[3] - PGN_TABLE_FIRST];
+    if (entry->len != len) {
+      counters.badLength++;
+      return false;
+    }
+    if (checkCRC && entry->hasCRC && pgnData[len - 1] != calculateCRC(pgnData, len)) {
+      counters.badCRC++;
+      if (debugLevel > 0) printPgnAnnoucement(pgnData, len, (char*)"Bad CRC, dropped");
+      return true;    // it is a machine PGN, just a corrupt one, nothing else should use it either
+    }
+    counters.accepted++;
 
-    if (pgnData[3] == 200 && len == 9)  // 0xC8 (200) - Hello from AgIO
-    {
-      if (debugLevel > 3) printPgnAnnoucement(pgnData, len, (char*)"Hello from AgIO");
+    eventUs = micros();
+    return (this->*entry->handler)(pgnData, len, sourceIP, myIP);
+  }
 
-      if (isInit) {
-        uint8_t helloFromMachine[] = { 0x80, 0x81, 123, 123, 5, 0, 0, 0, 0, 0, 71 };
-        helloFromMachine[5] = states.sections.groupsofeight[0];
-        helloFromMachine[6] = states.sections.groupsofeight[1];
-        if (UDPReplyHandler != NULL) {
-          UDPReplyHandler(helloFromMachine, sizeof(helloFromMachine), sourceIP);
-          if (debugLevel > 3) printPgnAnnoucement(helloFromMachine, sizeof(helloFromMachine), (char*)"Machine Reply");
-        }
-      } else {
-        if (debugLevel > 3) Serial.print("\r\nMachine not initialized");
-      }
-      if (debugLevel > 3) Serial.println();
+  // handlers for each PGN in the dispatch table, return true if the PGN shouldn't be processed any further by the main/host code
+  typedef bool (MACHINE::*PgnHandler)(uint8_t*, uint8_t, IPAddress&, IPAddress&);
 
-      return false;   // allow other classes to pickup this PGN in the main/host code
-    } // 0xC8 (200) - Hello from AgIO
+  struct PgnEntry {
+    uint8_t len;              // expected length of the whole PGN, incl header & CRC
+    bool hasCRC;              // AgIO sends Hello & Scan Request with a fixed 0x47 instead of a real CRC
+    PgnHandler handler;       // NULL if this PGN isn't handled by the Machine class
+  };
 
+  static const PgnEntry* getPgnEntry(uint8_t pgn)
+  {
+    #define NO_PGN { 0, false, NULL }
+    static const PgnEntry pgnTable[PGN_TABLE_SIZE] = {
+      { 9, false, &MACHINE::parseHello },                                 // 0xC8 (200) - Hello from AgIO
+      NO_PGN,                                                             // 0xC9 (201) - Subnet Change, handled by main/host code
+      { 9, false, &MACHINE::parseScanRequest },                           // 0xCA (202) - Scan Request
+      NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN,                                   // 203 - 208
+      { 7, true, &MACHINE::parseLatencyRequest },                         // 0xD1 (209) - Latency Request
+      NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN,   // 210 - 219
+      NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN,           // 220 - 228
+      { sizeof(SectionDataPgn), true, &MACHINE::parseSectionData },       // 0xE5 (229) - 64 Section Data
+      NO_PGN, NO_PGN, NO_PGN, NO_PGN, NO_PGN,                             // 230 - 234
+      { sizeof(SectionDimsPgn), true, &MACHINE::parseSectionDims },       // 0xEB (235) - Section Dimensions
+      { sizeof(PinConfigPgn), true, &MACHINE::parsePinConfig },           // 0xEC (236) - Machine Pin Config
+      NO_PGN,                                                             // 0xED (237) - From Machine
+      { sizeof(MachineConfigPgn), true, &MACHINE::parseMachineConfig },   // 0xEE (238) - Machine Config
+      { sizeof(MachineDataPgn), true, &MACHINE::parseMachineData }        // 0xEF (239) - Machine Data
+    };
+    #undef NO_PGN
+
+    uint8_t index = pgn - PGN_TABLE_FIRST;          // PGNs below the table wrap around to > PGN_TABLE_SIZE
+    if (index >= PGN_TABLE_SIZE || pgnTable[index].handler == NULL) return NULL;
+    return &pgnTable[index];
+  }
 
 
-    if (pgnData[3] == 202 && len == 9)    // 0xCA (202) - Scan Request
-    {
-      if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Scan Request");
-
-      if (isInit) {
-        if (pgnData[4] == 3 && pgnData[5] == 202 && pgnData[6] == 202) {
-          IPAddress destIP = { 255, 255, 255, 255 };
-          uint8_t scanReplyMachine[] = { 128, 129, 123, 203, 7,
-                                  myIP[0], myIP[1], myIP[2], myIP[3],
-                                  sourceIP[0], sourceIP[1], sourceIP[2], 23 };
-          /*uint8_t CK_A = 0;
-          for (uint8_t i = 2; i < sizeof(scanReplyMachine) - 1; i++) {
-            CK_A = (CK_A + scanReplyMachine[i]);
-          }
-          scanReplyMachine[sizeof(scanReplyMachine) - 1] = CK_A;*/
-
-          if (UDPReplyHandler != NULL) {
-            UDPReplyHandler(scanReplyMachine, sizeof(scanReplyMachine), destIP);
-            if (debugLevel > 2) printPgnAnnoucement(scanReplyMachine, sizeof(scanReplyMachine), (char*)"Machine Reply");
-          }
-        }
-      }
+  bool parseHello(uint8_t *pgnData, uint8_t len, IPAddress& sourceIP, IPAddress& myIP)   // 0xC8 (200) - Hello from AgIO
+  {
+    (void)myIP;
+    if (debugLevel > 3) printPgnAnnoucement(pgnData, len, (char*)"Hello from AgIO");
 
-      if (debugLevel > 2) Serial.println();
-      return false;   // allow other classes to pickup this PGN in the main/host code
-    } // 0xCA (202) - Scan Request
+    if (isInit) {
+      if (UDPReplyHandler != NULL) {
+        UDPReplyHandler(getHelloReply(), sizeof(helloReply), sourceIP);
+        if (debugLevel > 3) printPgnAnnoucement(helloReply, sizeof(helloReply), (char*)"Machine Reply");
+      }
+    } else {
+      if (debugLevel > 3) Serial.print("\r\nMachine not initialized");
+    }
+    if (debugLevel > 3) Serial.println();
 
+    return false;   // allow other classes to pickup this PGN in the main/host code
+  } // 0xC8 (200) - Hello from AgIO
 
 
-    // use this instead of relayLo/Hi from other PGNs because it works for zones/groups too
-    if (pgnData[3] == 229 && len == 16)               // 0xE5 (229) - 64 Section Data, len: 16
-    {                                                      
-      if (debugLevel > 3) printPgnAnnoucement(pgnData, len, (char*)"64 Section Data");
 
-      uint64_t prevSections = states.sections.allSections;
-      if (debugLevel > 3) Serial.println();
+  bool parseScanRequest(uint8_t *pgnData, uint8_t len, IPAddress& sourceIP, IPAddress& myIP)   // 0xCA (202) - Scan Request
+  {
+    if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Scan Request");
 
-      for (uint8_t j = 0; j < 8; j++) {
-        states.sections.groupsofeight[j] = pgnData[5 + j];    // read all 8 bytes of section state data
-        if (debugLevel > 3) {
-          Serial.print(j); Serial.print(":");
-          printBinaryByteLSB(states.sections.groupsofeight[j], 8);
-          Serial.print(" ");
+    if (isInit) {
+      if (pgnData[4] == 3 && pgnData[5] == 202 && pgnData[6] == 202) {
+        IPAddress destIP = { 255, 255, 255, 255 };
+        if (UDPReplyHandler != NULL) {
+          UDPReplyHandler(getScanReply(myIP, sourceIP), sizeof(scanReply), destIP);
+          if (debugLevel > 2) printPgnAnnoucement(scanReply, sizeof(scanReply), (char*)"Machine Reply");
         }
       }
+    }
 
-      states.leftSpeed = pgnData[13];
-      states.rightSpeed = pgnData[14];
+    if (debugLevel > 2) Serial.println();
+    return false;   // allow other classes to pickup this PGN in the main/host code
+  } // 0xCA (202) - Scan Request
 
-      if (debugLevel > 3) {
-        Serial.println();
-        Serial.print("Left speed: "); Serial.print(states.leftSpeed);
-        Serial.print(" Right speed: "); Serial.print(states.rightSpeed);
-        Serial.println(); 
-      }
 
-      updateMachineStates();
-      if (prevSections != states.sections.allSections) {
-        if (SectionOutputs_Handler != NULL) SectionOutputs_Handler();     // callback function to update section only outputs
-      }
 
-      return true;
-    } // 0xE5 (229) - 64 Section Data
+  bool parseLatencyRequest(uint8_t *pgnData, uint8_t len, IPAddress& sourceIP, IPAddress& myIP)   // 0xD1 (209) - Latency Request, len: 7
+  {
+    (void)myIP;
+    if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Latency Request");
 
+    if (UDPReplyHandler != NULL) UDPReplyHandler(getLatencyReply(), sizeof(latencyReply), sourceIP);
+    if (debugLevel > 2) printSectionLatency();
+    if (pgnData[5] & 0x01) sectionLatency.reset();
 
+    if (debugLevel > 2) Serial.println();
+    return true;
+  } // 0xD1 (209) - Latency Request
 
-    if (pgnData[3] == 235 && len == 39)               // 0xEB (235) - Section Dimensions, len: 39
-    {
-      if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Section Dims");
-      
-      // parse section dims here
-      
-      if (debugLevel > 2) Serial.println(); 
-      return true;
-    } // 0xEB (235) - Section Dimensions
 
 
+  // use this instead of relayLo/Hi from other PGNs because it works for zones/groups too
+  bool parseSectionData(uint8_t *pgnData, uint8_t len, IPAddress& sourceIP, IPAddress& myIP)   // 0xE5 (229) - 64 Section Data, len: 16
+  {
+    (void)sourceIP; (void)myIP;
+    if (debugLevel > 3) printPgnAnnoucement(pgnData, len, (char*)"64 Section Data");
+    uint32_t rxUs = (isPacketStamped ? packetUs : micros());
+    isPacketStamped = false;
+    isOutputWritten = false;
 
-    if (pgnData[3] == 236 && len == 30)               // 0xEC (236) - Machine Pin Config, len: 30
-    {
-      if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Machine Pin Config");
+    const SectionDataPgn* pgn = (const SectionDataPgn*)pgnData;
+    states.sections.allSections = pgn->sections;      // read all 8 bytes of section state data at once
 
-      uint8_t tempFunction[sizeof(config.pinFunction)];
-      memcpy(tempFunction, config.pinFunction, sizeof(config.pinFunction));   // make a copy to compare after the update
-      for (uint8_t i = 5; i < len - 1; i++) {
-        config.pinFunction[i - 4] = pgnData[i];     // update each pin's function from PGN (from AOG machine pin config screen)
-      }
-      if (tempFunction != config.pinFunction) {        // compare, if different do stuff
-        if (debugLevel > 2) printPinConfig();
-        saveToEeprom();
-        triggerOutputUpdate = true;
+    if (debugLevel > 3) {
+      Serial.println();
+      for (uint8_t j = 0; j < 8; j++) {
+        Serial.print(j); Serial.print(":");
+        printBinaryByteLSB(states.sections.groupsofeight[j], 8);
+        Serial.print(" ");
       }
+    }
 
-      if (debugLevel > 2) Serial.println();
-      return true;
-    } // 0xEC (236) - Machine Pin Config
+    states.leftSpeed = pgn->leftSpeed;
+    states.rightSpeed = pgn->rightSpeed;
+    lockOutputs();                  // loop() applies the compensated edges, watchdogCheck()
+    sectionTiming.command(states.sections.allSections, millis(), states.gpsSpeed, states.leftSpeed, states.rightSpeed);    // the outputs get sectionTiming.outputs
+    uint64_t changedSections = sectionTiming.changed;     // before an update() from loop() clears it
+    unlockOutputs();
+
+    if (debugLevel > 3) {
+      Serial.println();
+      Serial.print("Left speed: "); Serial.print(states.leftSpeed);
+      Serial.print(" Right speed: "); Serial.print(states.rightSpeed);
+      Serial.println(); 
+    }
 
+    updateMachineStates();
+    if (changedSections && SectionOutputs_Handler != NULL) {      // callback function to update section only outputs
+      lockOutputs();
+      SectionOutputs_Handler(sectionTiming.outputs ^ changedSections, sectionTiming.outputs, changedSections);
+      unlockOutputs();
+    }
+    if (isOutputWritten) sectionLatency.record(outputWriteUs - rxUs);   // only frames that changed an output, compensated edges go out later
+    commsWatchdog.arrived(COMMS_SECTION_DATA, millis());
 
+    return true;
+  } // 0xE5 (229) - 64 Section Data
 
-    if (pgnData[3] == 238 && len == 14)                // 0xEE (238) - Machine Config, len: 14
-    {
-      if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Machine Config");
 
-      config.raiseTime = pgnData[5];
-      config.lowerTime = pgnData[6];
-      //config.hydLiftEnable = pgnData[7];    // not used?
 
-      uint8_t set0 = pgnData[8];  // setting0
-                                  // bit 0: relayActiveHigh
-                                  // bit 1: hydLiftEnable
-      config.isPinActiveHigh = bitRead(set0, 0) ? 1 : 0;
-      config.hydLiftEnable   = bitRead(set0, 1) ? 1 : 0;
+  bool parseSectionDims(uint8_t *pgnData, uint8_t len, IPAddress& sourceIP, IPAddress& myIP)   // 0xEB (235) - Section Dimensions, len: 39
+  {
+    (void)sourceIP; (void)myIP;
+    if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Section Dims");
+    
+    const SectionDimsPgn* pgn = (const SectionDimsPgn*)pgnData;
+    uint8_t numSections = min(pgn->numSections, (uint8_t)16);     // the PGN only has room for 16 widths
+    if (numSections != config.numSections || memcmp(config.sectionWidth, pgn->sectionWidth, sizeof(config.sectionWidth))) {
+      config.numSections = numSections;
+      memcpy(config.sectionWidth, pgn->sectionWidth, sizeof(config.sectionWidth));
+      updateSectionGeometry();
+      saveToEeprom();             // only when something changed
+    }
+    if (debugLevel > 2) printSectionGeometry();
+    
+    if (debugLevel > 2) Serial.println(); 
+    return true;
+  } // 0xEB (235) - Section Dimensions
+
+
+
+  bool parsePinConfig(uint8_t *pgnData, uint8_t len, IPAddress& sourceIP, IPAddress& myIP)   // 0xEC (236) - Machine Pin Config, len: 30
+  {
+    (void)sourceIP; (void)myIP;
+    if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Machine Pin Config");
 
-      config.user1 = pgnData[9];
-      config.user2 = pgnData[10];
-      config.user3 = pgnData[11];
-      config.user4 = pgnData[12];
+    const PinConfigPgn* pgn = (const PinConfigPgn*)pgnData;
+    static_assert(sizeof(config.pinFunction) == 1 + sizeof(pgn->pinFunction), "pinFunction[0] is not used");
 
-      //Serial << "\r\n- set0: " << set0 << " " << (bitRead(set0, 3) ? 1 : 0) << (bitRead(set0, 2) ? 1 : 0) << (bitRead(set0, 1) ? 1 : 0) << (bitRead(set0, 0) ? 1 : 0);
-      if (debugLevel > 2) printConfig();
+    if (memcmp(&config.pinFunction[1], pgn->pinFunction, sizeof(pgn->pinFunction))) {    // compare, if different do stuff
+      memcpy(&config.pinFunction[1], pgn->pinFunction, sizeof(pgn->pinFunction));      // update all pin functions from PGN (from AOG machine pin config screen)
+      if (debugLevel > 2) printPinConfig();
+      compilePinMap();
       saveToEeprom();
-      triggerOutputUpdate = true;
-      //rebootFunc();    // from old code, is there any reason to reboot?
+    }
 
-      if (debugLevel > 2) Serial.println();
-      return true;
-    } // 0xEE (238) - Machine Config
+    if (debugLevel > 2) Serial.println();
+    return true;
+  } // 0xEC (236) - Machine Pin Config
 
 
 
-    if (pgnData[3] == 239 && len == 14)                // 0xEF (239) - Machine Data, len: 14
-    {
-      if (debugLevel > 3) printPgnAnnoucement(pgnData, len, (char*)"Machine Data");
-      
-      states.uTurn = pgnData[5];
-
-      //gpsSpeed = (float)pgnData[6] * 0.1;     // gpsSpeed is 10x actual speed
-      states.gpsSpeed = pgnData[6];
-      //speedPulseUpdate();
-
-      states.hydLift = pgnData[7];
-      states.tramline = pgnData[8];  // bit 0 is right bit 1 is left
-      states.geoStop = (pgnData[9] > 0 ? 1 : 0);
-
-      //Serial.print("\r\n 0xEF[10]"); Serial.print(pgnData[10]); // prints '0'
-
-      states.sec1to8 = pgnData[11];   // use 64 Sections PGN data instead, works properly with zones?
-      states.sec9to16 = pgnData[12];  // i think zones has been fixed now in this PGN
-
-      if (debugLevel > 4) {
-        Serial.print("\r\nuTurn: "); Serial.print(states.uTurn);
-        Serial.print("\r\ngpsSpeed: "); Serial.print(pgnData[6]); Serial.print(" > "); Serial.print(states.gpsSpeed);
-        Serial.print("\r\nhydLift(1:D 2:U): "); Serial.print(states.hydLift); Serial.print((states.hydLift == 1 ? ":DOWN" : states.hydLift == 2 ? ":UP" : ":OFF"));
-        Serial.print("\r\ntramline(1:R 2:L): "); Serial.print(states.tramline); Serial.print((states.tramline == 1 ? ":RIGHT" : states.tramline == 2 ? ":LEFT" : ":OFF"));
-        Serial.print("\r\ngeoStop(0:OK 1:STOP): "); Serial.print(states.geoStop); Serial.print((states.geoStop == 1 ? ":STOP!!!" : ":GOOD"));
-        Serial.print("\r\nsec 1-8: "); printBinaryByteLSB(pgnData[11], 8);
-        Serial.print(" sec 9-16: "); printBinaryByteLSB(pgnData[12], 8);
-      } else if (debugLevel > 3) {
-        Serial.print("\r\n0:"); printBinaryByteLSB(states.sec1to8, 8);
-        Serial.print(" 1:"); printBinaryByteLSB(states.sec9to16, 8);
-      }
+  bool parseMachineConfig(uint8_t *pgnData, uint8_t len, IPAddress& sourceIP, IPAddress& myIP)   // 0xEE (238) - Machine Config, len: 14
+  {
+    (void)sourceIP; (void)myIP;
+    if (debugLevel > 2) printPgnAnnoucement(pgnData, len, (char*)"Machine Config");
 
-      //updateMachineStates();   // 64 Section PGN comes after Machine Data, so states/outputs are updated there
-      if (debugLevel > 3) Serial.println();
-      return true;
-    } // 0xEF (239) - Machine Data
+    const MachineConfigPgn* pgn = (const MachineConfigPgn*)pgnData;
+    config.raiseTime = pgn->raiseTime;
+    config.lowerTime = pgn->lowerTime;
+    //config.hydLiftEnable = pgn->hydLiftEnable;    // not used?
 
+    uint8_t set0 = pgn->set0;   // setting0
+                                // bit 0: relayActiveHigh
+                                // bit 1: hydLiftEnable
+    uint8_t wasPinActiveHigh = config.isPinActiveHigh;
+    config.isPinActiveHigh = bitRead(set0, 0) ? 1 : 0;
+    config.hydLiftEnable   = bitRead(set0, 1) ? 1 : 0;
+    if (config.isPinActiveHigh != wasPinActiveHigh) compilePinMap();
 
+    config.user1 = pgn->user[0];
+    config.user2 = pgn->user[1];
+    config.user3 = pgn->user[2];
+    config.user4 = pgn->user[3];
+
+    //Serial << "\r\n- set0: " << set0 << " " << (bitRead(set0, 3) ? 1 : 0) << (bitRead(set0, 2) ? 1 : 0) << (bitRead(set0, 1) ? 1 : 0) << (bitRead(set0, 0) ? 1 : 0);
+    if (debugLevel > 2) printConfig();
+    saveToEeprom();
+    //rebootFunc();    // from old code, is there any reason to reboot?
+
+    if (debugLevel > 2) Serial.println();
+    return true;
+  } // 0xEE (238) - Machine Config
+
+
+
+  bool parseMachineData(uint8_t *pgnData, uint8_t len, IPAddress& sourceIP, IPAddress& myIP)   // 0xEF (239) - Machine Data, len: 14
+  {
+    (void)sourceIP; (void)myIP;
+    if (debugLevel > 3) printPgnAnnoucement(pgnData, len, (char*)"Machine Data");
+    
+    const MachineDataPgn* pgn = (const MachineDataPgn*)pgnData;
+    states.uTurn = pgn->uTurn;
+
+    //gpsSpeed = (float)pgn->gpsSpeed * 0.1;     // gpsSpeed is 10x actual speed
+    states.gpsSpeed = pgn->gpsSpeed;
+    speedPulse.setSpeed(states.gpsSpeed);       // nothing if it's not running or the speed didn't change
+
+    states.hydLift = pgn->hydLift;
+    states.tramline = pgn->tramline;  // bit 0 is right bit 1 is left
+    states.geoStop = (pgn->geoStop > 0 ? 1 : 0);
+
+    //Serial.print("\r\n 0xEF[10]"); Serial.print(pgn->reserved); // prints '0'
+
+    states.sec1to8 = pgn->sec1to8;    // use 64 Sections PGN data instead, works properly with zones?
+    states.sec9to16 = pgn->sec9to16;  // i think zones has been fixed now in this PGN
+
+    if (debugLevel > 4) {
+      Serial.print("\r\nuTurn: "); Serial.print(states.uTurn);
+      Serial.print("\r\ngpsSpeed: "); Serial.print(pgn->gpsSpeed); Serial.print(" > "); Serial.print(states.gpsSpeed);
+      Serial.print("\r\nhydLift(1:D 2:U): "); Serial.print(states.hydLift); Serial.print((states.hydLift == 1 ? ":DOWN" : states.hydLift == 2 ? ":UP" : ":OFF"));
+      Serial.print("\r\ntramline(1:R 2:L): "); Serial.print(states.tramline); Serial.print((states.tramline == 1 ? ":RIGHT" : states.tramline == 2 ? ":LEFT" : ":OFF"));
+      Serial.print("\r\ngeoStop(0:OK 1:STOP): "); Serial.print(states.geoStop); Serial.print((states.geoStop == 1 ? ":STOP!!!" : ":GOOD"));
+      Serial.print("\r\nsec 1-8: "); printBinaryByteLSB(pgn->sec1to8, 8);
+      Serial.print(" sec 9-16: "); printBinaryByteLSB(pgn->sec9to16, 8);
+    } else if (debugLevel > 3) {
+      Serial.print("\r\n0:"); printBinaryByteLSB(states.sec1to8, 8);
+      Serial.print(" 1:"); printBinaryByteLSB(states.sec9to16, 8);
+    }
+
+    //updateMachineStates();   // 64 Section PGN comes after Machine Data, so states/outputs are updated there
+    if (debugLevel > 3) Serial.println();
+    return true;
+  } // 0xEF (239) - Machine Data
 
-    return false;   // no matching PGN, return false for further PGN processing in main/host code
-  }
 
   void printPgnAnnoucement(uint8_t* _data, uint8_t _len, char* _pgnName)
   {
@@ -519,6 +774,67 @@ public:
     return bitRead(states.sections.allSections, secNum);
   }
 
+  // funcNum 1-21, see functionNames[]
+  bool getFunctionState(uint8_t funcNum)
+  {
+    return bitRead(states.functions, funcNum);
+  }
+
+  // rebuilds pinMap, only needed when config.pinFunction or config.isPinActiveHigh change
+  void compilePinMap()
+  {
+    lockOutputs();                  // loop() might be building pin levels from it
+    for (uint8_t i = 0; i < 24; i++) {
+      uint8_t function = config.pinFunction[1 + i];
+      pinMap.functionBit[i] = (function <= 21 ? function : 0);    // unknown function numbers stay OFF
+    }
+    pinMap.invertMask = (config.isPinActiveHigh ? 0 : 0x00FFFFFF);
+    triggerOutputUpdate = true;     // write every pin once with the new map
+    unlockOutputs();
+  }
+
+  // sets pinLevels/prevPinLevels/changedPinLevels from the current states.functions, just before the machine outputs callback
+  void updatePinLevels()
+  {
+    uint32_t levels = 0, pinBit = 1;
+    for (uint8_t i = 0; i < 24; i++, pinBit <<= 1) {
+      if (bitRead(states.functions, pinMap.functionBit[i])) levels |= pinBit;
+    }
+    levels ^= pinMap.invertMask;
+    changedPinLevels = (triggerOutputUpdate ? 0x00FFFFFF : levels ^ pinLevels);
+    prevPinLevels = pinLevels;
+    pinLevels = levels;
+  }
+
+  // secNum 0 is section 1, only the first 16 sections have dimensions
+  uint16_t getSectionWidth(byte secNum)
+  {
+    return (secNum < config.numSections) ? config.sectionWidth[secNum] : 0;
+  }
+
+  int16_t getSectionOffset(byte secNum)
+  {
+    return (secNum < config.numSections) ? sectionGeometry.offset[secNum] : 0;
+  }
+
+  void updateSectionGeometry()
+  {
+    uint16_t totalWidth = 0;
+    for (uint8_t i = 0; i < config.numSections; i++) totalWidth += config.sectionWidth[i];
+    sectionGeometry.totalWidth = totalWidth;
+
+    int16_t leftEdge = -(int16_t)(totalWidth / 2);      // of section 1
+    for (uint8_t i = 0; i < 16; i++) {
+      if (i < config.numSections) {
+        sectionGeometry.offset[i] = leftEdge + config.sectionWidth[i] / 2;
+        leftEdge += config.sectionWidth[i];
+      } else {
+        sectionGeometry.offset[i] = 0;
+      }
+    }
+    sectionTiming.setGeometry(sectionGeometry.offset, config.numSections, totalWidth);
+  }
+
   void loadFromEeprom()
   {
     //if (eeLoadedAtStartup) return;
@@ -534,6 +850,7 @@ public:
       EEPROM.get(eeAddr + 2, config);
       Serial.print("\r\n\nMachine config loaded from EEPROM");
     }
+    updateSectionGeometry();
     if (debugLevel > 1) printConfig();
     if (debugLevel > 1) printPinConfig();
     #ifdef ESP32
@@ -552,11 +869,11 @@ public:
     if (debugLevel > 1) Serial.print("\r\nNew Machine config saved to EEPROM");
   }
 
-  void setSectionOutputsHandler(ExternalHandler _extHandler) {
+  void setSectionOutputsHandler(SectionsHandler _extHandler) {
     SectionOutputs_Handler = _extHandler;
   }
 
-  void setMachineOutputsHandler(ExternalHandler _extHandler) {
+  void setMachineOutputsHandler(PinsHandler _extHandler) {
     MachineOutputs_Handler = _extHandler;
   }
 
@@ -576,6 +893,14 @@ public:
     Serial.print("\r\n- user4: "); Serial.print(config.user4);
   }
 
+  void printSectionGeometry()
+  {
+    Serial.printf("\r\n- sections: %i, total width: %icm", config.numSections, sectionGeometry.totalWidth);
+    for (uint8_t i = 0; i < config.numSections; i++) {
+      Serial.printf("\r\n- Section %2i width: %5icm offset: %6icm", i + 1, config.sectionWidth[i], sectionGeometry.offset[i]);
+    }
+  }
+
   void printPinConfig()
   {
     for (uint8_t i = 1; i < uint8_t(sizeof(config.pinFunction)); i++) {
@@ -598,12 +923,100 @@ public:
 
   void calculateAndSetCRC(uint8_t myMessage[], uint8_t myLen) {
     if (myLen <= 2 ) return;
+    myMessage[myLen - 1] = calculateCRC(myMessage, myLen);
+  }
+
+  // AOG CRC is the low byte of the sum of all bytes after 0x80 0x81, up to (not incl) the CRC byte
+  static uint8_t calculateCRC(const uint8_t* myMessage, uint8_t myLen) {
+    if (myLen <= 2) return 0;
+
+    const uint8_t* data = myMessage + 2;
+    uint8_t count = myLen - 3;
+    uint32_t sum = 0;
+    // sum 4 bytes per load, every 2nd byte goes into its own 16 bit lane so carries never cross into the next byte
+    while (count >= 4) {
+      uint32_t word;
+      memcpy(&word, data, 4);       // data isn't word aligned, memcpy lets the compiler pick the fastest safe load
+      sum += (word & 0x00FF00FF) + ((word >> 8) & 0x00FF00FF);
+      data += 4;
+      count -= 4;
+    }
+    sum += sum >> 16;               // add the two lanes together, only the low byte matters
+    while (count--) sum += *data++; // last 0-3 bytes
+    return (uint8_t)sum;
+  }
 
-    uint8_t crc = 0;
-    for (byte i = 2; i < myLen - 1; i++) {
-      crc = (crc + myMessage[i]);
+  // Hello & Scan replies are kept ready to send, get*Reply() updates them and they're sent as is, sizeof() bytes
+  uint8_t helloReply[11] = { 0x80, 0x81, 123, 123, 5, 0, 0, 0, 0, 0, 0xFB };        // 0x7B (123) - Hello from Machine: relayLo, relayHi, 0, 0, 0
+  uint8_t scanReply[13] = { 0x80, 0x81, 123, 203, 7, 0, 0, 0, 0, 0, 0, 0, 0x4D };   // 0xCB (203) - Scan Reply: module IP, AgIO subnet
+
+  // the reply frames are only patched where a byte changed, the CRC is adjusted by the same difference
+  // (AOG CRC is a plain 8 bit sum) so it never has to be summed again
+  static void setReplyByte(uint8_t* frame, uint8_t len, uint8_t index, uint8_t value) {
+    if (frame[index] == value) return;
+    frame[len - 1] += uint8_t(value - frame[index]);
+    frame[index] = value;
+  }
+
+  // Hello reply with the current section states 1-16
+  const uint8_t* getHelloReply() {
+    setReplyByte(helloReply, sizeof(helloReply), 5, states.sections.groupsofeight[0]);   // relayLo
+    setReplyByte(helloReply, sizeof(helloReply), 6, states.sections.groupsofeight[1]);   // relayHi
+    return helloReply;
+  }
+
+  // Scan reply with this module's IP and the subnet the request came from, IP can be IPAddress or a byte array
+  template <typename IP1, typename IP2>
+  const uint8_t* getScanReply(const IP1& moduleIP, const IP2& agioIP) {
+    for (uint8_t i = 0; i < 4; i++) setReplyByte(scanReply, sizeof(scanReply), 5 + i, moduleIP[i]);
+    for (uint8_t i = 0; i < 3; i++) setReplyByte(scanReply, sizeof(scanReply), 9 + i, agioIP[i]);
+    return scanReply;
+  }
+
+  // call from the UDP receive callback with micros() when the packet came in, before it's parsed
+  // so sectionLatency includes the time in the network stack & PGN routing, without it the time starts at parseSectionData()
+  void stampPacket(uint32_t us)
+  {
+    packetUs = us;
+    isPacketStamped = true;
+  }
+
+  // micros() time an output write goes out (now, or when a queued write will), the last one in a 64 Section Data is the sample
+  // called by the output callbacks, there's no sample for a 64 Section Data if they don't
+  void outputWritten(uint32_t us)
+  {
+    if (isOutputWritten && int32_t(us - outputWriteUs) < 0) return;
+    outputWriteUs = us;
+    isOutputWritten = true;
+  }
+
+  // Latency reply to 0xD1 (209) - Latency Request: samples, p50, p99, max (us), each uint32 LSB first
+  uint8_t latencyReply[22] = { 0x80, 0x81, 123, 209, 16 };
+
+  const uint8_t* getLatencyReply() {
+    uint32_t values[4] = { sectionLatency.count, sectionLatency.percentile(50), sectionLatency.percentile(99), sectionLatency.maxUs };
+    memcpy(&latencyReply[5], values, sizeof(values));     // all three boards are little endian
+    latencyReply[sizeof(latencyReply) - 1] = calculateCRC(latencyReply, sizeof(latencyReply));
+    return latencyReply;
+  }
+
+  void printSectionLatency() { sectionLatency.print("64 Section Data to outputs"); }
+
+  void printPgnCounters()
+  {
+    Serial.print("\r\nMachine PGN counters   accepted  bad len  bad CRC");
+    for (uint8_t i = 0; i < PGN_TABLE_SIZE; i++) {
+      if (getPgnEntry(PGN_TABLE_FIRST + i) == NULL) continue;
+      Serial.printf("\r\n- %3i%20lu %8lu %8lu", PGN_TABLE_FIRST + i,
+                    (unsigned long)pgnCounters[i].accepted, (unsigned long)pgnCounters[i].badLength, (unsigned long)pgnCounters[i].badCRC);
     }
-    myMessage[myLen - 1] = crc;
+    Serial.printf("\r\n- not machine PGNs: %lu", (unsigned long)unknownPgns);
+  }
+
+  void resetPgnCounters()
+  {
+    memset(pgnCounters, 0, sizeof(pgnCounters));
+    unknownPgns = 0;
   }
 
 
@@ -1,26 +1,72 @@
+// the callbacks run in the Machine class's critical section (PGNs from the AsyncUDP task & watchdogCheck() from loop()),
+// so they can't use Serial, they note what changed and printOutputChanges() prints it from loop()
+portMUX_TYPE printMux = portMUX_INITIALIZER_UNLOCKED;
+uint64_t sectionsToPrint = 0;
+uint64_t sectionStates = 0;           // the latest newSections
+uint32_t pinsToPrint = 0;
+
 // callback function triggered by Machine class to update 1-64 "section" outputs only
-void updateSectionOutputs()
+// bit 0 is section 1, only the sections with a changedSections bit need writing
+void updateSectionOutputs(uint64_t oldSections, uint64_t newSections, uint64_t changedSections)
 {
-  Serial.print("\r\n*** Section Outputs update! *** ");
+  CYCLE_BENCH_SCOPE(CycleBench::OUTPUTS);
+  portENTER_CRITICAL(&printMux);
+  sectionsToPrint |= changedSections;
+  sectionStates = newSections;
+  portEXIT_CRITICAL(&printMux);
 }
 
 
 // callback function triggered by Machine class to update "machine" outputs
 // this updates the Machine Module Pin Configuration outputs
 // - sections 1-16, Hyd Up/Down, Tramline Right/Left, Geo Stop
-void updateMachineOutputs()
+// - levels are already inverted for isPinActiveHigh, bit 0 is machineOutputPins[0]
+void updateMachineOutputs(uint32_t oldLevels, uint32_t newLevels, uint32_t changedPins)
 {
-  Serial.print("\r\n*** Machine Outputs update! *** ");
+  CYCLE_BENCH_SCOPE(CycleBench::OUTPUTS);
+  // only the changed pins are written, all in the same instant, on the scheduler's tick OUTPUT_LATENCY_US after the PGN came in
+  if (outputScheduler.write(newLevels, changedPins, machine.eventUs + OUTPUT_LATENCY_US)) {
+    machine.outputWritten(outputScheduler.dueUs);     // for the latency histogram, the write goes out on a later tick
+  } else {
+    machineOutputPorts.write(newLevels, changedPins);
+    machine.outputWritten(micros());
+  }
+
+  portENTER_CRITICAL(&printMux);
+  pinsToPrint |= changedPins;
+  portEXIT_CRITICAL(&printMux);
+}
+
+// from loop(), the outputs the callbacks changed since the last call
+void printOutputChanges()
+{
+  portENTER_CRITICAL(&printMux);
+  uint64_t sections = sectionsToPrint;
+  uint64_t states = sectionStates;
+  uint32_t pins = pinsToPrint;
+  sectionsToPrint = 0;
+  pinsToPrint = 0;
+  portEXIT_CRITICAL(&printMux);
+
+  if (sections) {
+    Serial.print("\r\n*** Section Outputs update! *** ");
+    for (uint8_t i = 0; i < 64; i++) {
+      if (!((sections >> i) & 1)) continue;
+      Serial.print("\r\n- Section "); Serial.print(i + 1); Serial.print(": ");
+      Serial.print(uint8_t((states >> i) & 1));
+    }
+  }
 
+  if (!pins) return;
+  Serial.print("\r\n*** Machine Outputs update! *** ");
   for (uint8_t i = 1; i <= numMachineOutputs; i++) {
+    if (!bitRead(pins, i - 1)) continue;
     Serial.print("\r\n- Pin ");
     Serial.print((machineOutputPins[i - 1] < 10 ? " " : ""));
     Serial.print(machineOutputPins[i - 1]); Serial.print(": ");
-    Serial.print(machine.states.functions[machine.config.pinFunction[i]]);
+    Serial.print(machine.getFunctionState(machine.config.pinFunction[i]));
     Serial.print(" ");
     Serial.print(machine.functionNames[machine.config.pinFunction[i]]);
-
-    digitalWrite(machineOutputPins[i - 1], machine.states.functions[machine.config.pinFunction[i]] == machine.config.isPinActiveHigh); // == does a XOR bit operation
   }
 }
 
@@ -30,5 +76,6 @@ void setOutputPinModes() {
       pinMode(machineOutputPins[i], OUTPUT);
       digitalWrite(machineOutputPins[i], !machine.config.isPinActiveHigh);  // set OFF
     }
+    machineOutputPorts.begin(machineOutputPins, numMachineOutputs);
   }
 }
\ No newline at end of file
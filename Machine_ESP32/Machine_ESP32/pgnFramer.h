@@ -0,0 +1,91 @@
+/*
+  Splits AgOpenGPS PGNs out of a UDP packet or a serial byte stream
+
+    - every PGN starts with 0x80 0x81 and byte 4 is the number of data bytes, so the whole PGN is that + 6 bytes (header & CRC)
+    - lets AgIO (or a bridge) send several PGNs in one packet, ie Machine Data + 64 Section Data
+    - bytes that aren't part of a PGN are skipped until the next 0x80 0x81 header
+    - does not check the CRC, MACHINE::parsePGN() does that (Hello/Scan from AgIO don't have a real CRC anyways)
+*/
+
+#ifndef PGNFRAMER_H
+#define PGNFRAMER_H
+
+#include <stdint.h>
+
+class PgnFramer
+{
+public:
+  static const uint8_t HEADER_LEN = 5;    // 0x80, 0x81, source, PGN, data length
+
+  // length of the whole PGN (header + data + CRC) from the header
+  static uint16_t pgnLength(const uint8_t* pgn) { return pgn[4] + HEADER_LEN + 1; }
+
+  // calls handler(pgnData, len) for each complete PGN in a UDP packet, returns the number of PGNs found
+  // handler can be a function or a lambda, ie [&](uint8_t* pgnData, uint8_t len) { machine.parsePGN(pgnData, len); }
+  template <typename Handler>
+  static uint8_t parseBuffer(uint8_t* data, uint16_t len, Handler handler)
+  {
+    uint8_t numPgns = 0;
+    uint16_t i = 0;
+    while (i + HEADER_LEN <= len) {
+      if (data[i] != 0x80 || data[i + 1] != 0x81) {   // not the start of a PGN, look for the next header
+        i++;
+        continue;
+      }
+      uint16_t pgnLen = pgnLength(&data[i]);
+      if (i + pgnLen > len) break;                      // last PGN was cut off, nothing more to find
+      if (pgnLen <= 255) {                              // parsePGN() etc only take uint8_t lengths
+        handler(&data[i], (uint8_t)pgnLen);
+        numPgns++;
+      }
+      i += pgnLen;
+    }
+    return numPgns;
+  }
+
+
+  // for byte streams (ie Serial), the PGN is put together in _buffer one byte at a time
+  PgnFramer(uint8_t* _buffer, uint8_t _bufferSize) : buffer(_buffer), bufferSize(_bufferSize) {}
+
+  uint16_t skippedBytes = 0;    // bytes outside of any PGN
+  uint16_t skippedPgns = 0;     // PGNs longer than the buffer
+
+  // add the next byte from the stream, calls handler(pgnData, len) and returns true when a PGN is complete
+  template <typename Handler>
+  bool write(uint8_t b, Handler handler)
+  {
+    if (index == 0 && b != 0x80) {
+      skippedBytes++;
+      return false;
+    }
+    if (index == 1 && b != 0x81) {        // false start, but this byte could be the start of the next PGN
+      skippedBytes++;
+      index = (b == 0x80) ? 1 : 0;
+      return false;
+    }
+
+    buffer[index++] = b;
+    if (index < HEADER_LEN) return false;
+
+    uint16_t pgnLen = pgnLength(buffer);
+    if (pgnLen > bufferSize) {            // won't fit, drop it and look for the next header
+      skippedPgns++;
+      index = 0;
+      return false;
+    }
+    if (index < pgnLen) return false;
+
+    index = 0;
+    handler(buffer, (uint8_t)pgnLen);
+    return true;
+  }
+
+  void reset() { index = 0; }
+
+private:
+  uint8_t* buffer;
+  uint8_t bufferSize;
+  uint8_t index = 0;
+};
+
+#endif
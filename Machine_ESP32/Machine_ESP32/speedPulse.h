@@ -0,0 +1,348 @@
+/*
+  Radar style speed pulse output from the GPS speed, the pulses come from a timer/PWM peripheral so there's little or no CPU time per pulse
+    - pulsesPerKm is the calibration, the default 130000 is the same as the old tone(gpsSpeed * 36.1111) (36.1hz per km/hr)
+      - ie a controller that wants 94.3hz per mph (58.6 pulses/m) is 58600 pulses/km, up to 16 million pulses/km
+    - the frequency is worked out in 1/256 hz (8 fractional bits) with integer math, tone() only does whole hz
+      which is 25% out at 4hz, so the fraction carries through to the peripheral and low speeds stay in step
+    - setSpeed() only touches the peripheral when the frequency changes, the new period is double buffered by the hardware
+      so it takes over at the end of the current period, no short or stretched pulse like restarting tone()
+    - 50% duty, below the lowest frequency (or at 0 speed) the output is held LOW, frequencyQ8 is what the output averages
+    - Teensy 4.x: FlexPWM/QuadTimer through analogWriteFrequency(), any PWM pin, down to ~18hz (0.5 km/hr at 130000/km)
+      - below that an IntervalTimer toggles the pin every half period, down to 1hz
+      - the other pins on the same PWM submodule get the same frequency, pick one that isn't used for analogWrite()
+    - ESP32: LEDC timer 3 & channel 5, the divider has 8 fractional bits so the hardware keeps the fraction too, down to ~0.1hz
+      (~5hz on the C3/S3, their LEDC timers are 14 bit)
+    - Nano: Timer2 on pin 3 (OC2B) only, Timer1 is the output scheduler's and the other Timer2 pin (11) is the ENC28J60's MOSI
+      - only with #define SPEED_PULSE_TIMER2 before including this (before machine.h in the sketch), it takes the Timer2
+        interrupts so tone() can't be used, without it begin() returns false
+      - phase correct PWM down to ~31hz, the period is only 8 bits (TOP) so the overflow interrupt adds 1 to TOP for
+        fraction/256 of the periods, which keeps the average to ~0.01% up to 10khz (an interrupt every period)
+      - above 10khz TOP isn't dithered, up to 1/(2 * TOP) out: ~0.8% at 15khz, 1.6% just under 31khz,
+        0.2% just over (prescaler 1) and climbing again with the frequency
+      - below ~31hz a 2khz Timer2 tick toggles pin 3 from a 32 bit phase accumulator, down to 1hz, the average is exact
+        and each edge is within a tick (0.5ms) of where it should be
+    - Host_Bench: the Nano's Timer2 maths at 16mhz without the registers, so the prescaler/TOP choice can be checked
+    - anything else: begin() returns false
+
+  Example:
+    #define SPEED_PULSE_TIMER2                // Nano only, before #include "machine.h"
+    machine.speedPulse.pulsesPerKm = 58600;
+    machine.speedPulse.begin(3);            // MACHINE sets the speed from each Machine Data PGN
+*/
+
+#ifndef SPEEDPULSE_H
+#define SPEEDPULSE_H
+
+#include <stdint.h>
+
+#if defined(__IMXRT1062__)
+  #include <IntervalTimer.h>
+#elif defined(ESP32)
+  #include "driver/ledc.h"
+#endif
+
+#if (defined(__AVR__) && defined(SPEED_PULSE_TIMER2)) || defined(HOST_GPIO_PORTS)
+// Timer2 settings for a frequency, a plain struct so the interrupts can get at it and the host can check the maths
+struct SpeedPulseTimer2
+{
+#if defined(__AVR__)
+  static const uint32_t CLOCK = F_CPU;
+#else
+  static const uint32_t CLOCK = 16000000UL;         // a 16mhz Nano
+#endif
+  static const uint32_t DITHER_MAX_Q8 = 10000UL * 256;  // one interrupt a period, so not above 10khz
+  static const uint8_t TICK_PRESCALER = 3, TICK_TOP = 124;  // slow mode tick: CTC, 64 * 125 counts, 2khz at 16mhz
+  static const uint32_t TICK_HZ = CLOCK / (64 * 125);
+
+  uint8_t prescaler;            // index into prescalers(), CS22:0 is this + 1
+  uint8_t top;                  // OCR2A, the period is 2 * prescaler * (top + fraction / 256) clocks
+  uint8_t fraction;             // 1/256 counts, added to top that many periods in 256
+  uint8_t dither;               // fraction accumulator, carries into top
+  uint32_t phaseStep;           // != 0 is slow mode, added to phase each tick, the pin toggles when phase wraps
+  uint32_t phase;
+
+  static const uint16_t* prescalers() { static const uint16_t p[7] = { 1, 8, 32, 64, 128, 256, 1024 }; return p; }
+
+  // false under 1hz, 32 bit math for the Nano
+  bool set(uint32_t fQ8)
+  {
+    prescaler = top = fraction = dither = 0;
+    phaseStep = phase = 0;
+    if (fQ8 < 256) return false;
+
+    // f = CLOCK / (2 * prescaler * TOP), the smallest prescaler TOP (+1 to dither) fits in 8 bits with, for the finest period
+    for (; prescaler < 7; prescaler++) {
+      uint32_t countsQ8 = CLOCK * 128UL / prescalers()[prescaler];    // CLOCK / (2 * prescaler) in 1/256 hz
+      uint32_t counts = countsQ8 / fQ8;
+      if (counts > 254) continue;
+      if (counts < 2) {         // as fast as it goes
+        top = 2;
+        return true;
+      }
+      uint32_t rem = countsQ8 % fQ8;
+      uint16_t frac = (fQ8 <= DITHER_MAX_Q8 ? (rem * 256 + fQ8 / 2) / fQ8 : (rem * 2 >= fQ8 ? 256 : 0));
+      top = counts + (frac >> 8);
+      fraction = uint8_t(frac);
+      return true;
+    }
+
+    // slower then the PWM goes: phaseStep = 2 toggles a period * fQ8 / 256 / TICK_HZ * 2^32, in two halves to stay in 32 bits
+    uint32_t f16 = fQ8 << 16;
+    phaseStep = ((f16 / TICK_HZ) << 9) + ((f16 % TICK_HZ) << 9) / TICK_HZ;
+    return true;
+  }
+
+  // hz * 256 the output averages
+  uint32_t frequencyQ8()
+  {
+    if (phaseStep != 0) return (((phaseStep >> 9) * TICK_HZ) + (((phaseStep & 0x1FF) * TICK_HZ) >> 9)) >> 16;
+    if (top == 0) return 0;
+    uint32_t countsQ8 = CLOCK * 128UL / prescalers()[prescaler];
+    uint32_t periodQ8 = uint32_t(top) * 256 + fraction;
+    return (countsQ8 / periodQ8) * 256 + (countsQ8 % periodQ8) * 256 / periodQ8;
+  }
+
+  // TOP for the next PWM period (overflow interrupt)
+  uint8_t nextTop()
+  {
+    uint8_t d = dither;
+    dither += fraction;
+    return top + (dither < d ? 1 : 0);
+  }
+
+  // true if the pin toggles on this slow mode tick (compare interrupt)
+  bool tick()
+  {
+    uint32_t p = phase;
+    phase += phaseStep;
+    return phase < p;
+  }
+};
+
+inline SpeedPulseTimer2& speedPulseTimer2() { static SpeedPulseTimer2 t; return t; }
+#endif
+
+class SpeedPulse
+{
+public:
+  uint32_t pulsesPerKm = 130000;
+  uint32_t frequencyQ8 = 0;         // hz * 256 the output is set to, 0 when it's held LOW
+
+  // false if the pin can't do it on this board
+  bool begin(uint8_t _pin)
+  {
+    pin = _pin;
+    if (!timerBegin()) {
+      pin = NONE;
+      return false;
+    }
+    frequencyQ8 = requestedQ8 = 0;
+    return true;
+  }
+
+  bool isRunning() { return pin != NONE; }
+
+  // km/hr * 10 as AOG sends it
+  void setSpeed(uint8_t gpsSpeed)
+  {
+    if (pin == NONE) return;
+    uint32_t f = frequencyFor(gpsSpeed);
+    if (f == requestedQ8) return;
+    requestedQ8 = f;
+    frequencyQ8 = timerSet(f);              // what the peripheral makes of it, 0 if it's too slow
+  }
+
+  // hz * 256 for gpsSpeed, 32 bit math for the Nano
+  uint32_t frequencyFor(uint8_t gpsSpeed)
+  {
+    uint32_t pulses = gpsSpeed * pulsesPerKm;     // pulses per 10 hrs, 36000 of them is 1 hz
+    return (pulses / 36000) * 256 + (pulses % 36000) * 256 / 36000;
+  }
+
+private:
+  static const uint8_t NONE = 0xFF;
+  uint8_t pin = NONE;
+  uint32_t requestedQ8 = 0;         // frequencyFor() the last speed
+
+#if defined(__IMXRT1062__)
+  // ******************************** Teensy 4.x, FlexPWM/QuadTimer ****************************
+  bool timerBegin()
+  {
+    if (!digitalPinHasPWM(pin)) return false;
+    analogWrite(pin, 0);
+    return true;
+  }
+  uint32_t timerSet(uint32_t fQ8)
+  {
+    if (fQ8 >= 18 * 256) {          // prescaler 128 & a 16 bit period at 150mhz is 17.9hz
+      slowStop();
+      analogWriteFrequency(pin, fQ8 / 256.0f);
+      analogWrite(pin, 128);        // 50% at the default 8 bit analogWriteResolution()
+      return fQ8;
+    }
+    if (fQ8 < 256) {
+      if (!slowStop()) analogWrite(pin, 0);
+      return 0;
+    }
+    float halfUs = 128000000.0f / fQ8;      // 1000000 / (2 * fQ8 / 256)
+    if (isSlow) {
+      slowTimer.update(halfUs);             // takes over at the next toggle
+      return fQ8;
+    }
+    analogWrite(pin, 0);
+    pinMode(pin, OUTPUT);
+    slowPin() = pin;
+    isSlow = slowTimer.begin(toggle, halfUs);
+    return (isSlow ? fQ8 : 0);
+  }
+
+  // below the PWM, an IntervalTimer toggles the pin
+  IntervalTimer slowTimer;
+  bool isSlow = false;
+  static uint8_t& slowPin() { static uint8_t p = 0; return p; }
+  static void toggle() { digitalToggle(slowPin()); }
+
+  // true if it was running, the pin is left LOW
+  bool slowStop()
+  {
+    if (!isSlow) return false;
+    slowTimer.end();
+    isSlow = false;
+    digitalWrite(pin, LOW);
+    return true;
+  }
+
+#elif defined(ESP32)
+  // ******************************** ESP32, LEDC **********************************************
+  static const ledc_mode_t MODE = LEDC_LOW_SPEED_MODE;    // the only mode on the C3/S3
+  static const ledc_timer_t TIMER = LEDC_TIMER_3;         // analogWrite()/ledcAttach() start from timer 0 & channel 0
+  static const ledc_channel_t CHANNEL = LEDC_CHANNEL_5;   // the C3 only has 6 channels
+
+  bool timerBegin()
+  {
+    ledc_timer_config_t timer = {};
+    timer.speed_mode = MODE;
+    timer.duty_resolution = LEDC_TIMER_10_BIT;
+    timer.timer_num = TIMER;
+    timer.freq_hz = 1000;
+    timer.clk_cfg = LEDC_USE_APB_CLK;
+    if (ledc_timer_config(&timer) != ESP_OK) return false;
+
+    ledc_channel_config_t channel = {};
+    channel.gpio_num = pin;
+    channel.speed_mode = MODE;
+    channel.channel = CHANNEL;
+    channel.timer_sel = TIMER;
+    channel.duty = 0;
+    return ledc_channel_config(&channel) == ESP_OK;
+  }
+  uint32_t timerSet(uint32_t fQ8)
+  {
+    // divider is 10.8 fixed point: 80mhz APB / (f * 2^bits), the fewest duty bits the divider fits with
+    // so the fraction is as small a part of the divider as it can be, 1 bit is plenty for 50%
+    uint8_t bits = 1;
+    uint64_t divQ8 = 0;
+    if (fQ8 != 0) {
+      for (; bits < LEDC_TIMER_BIT_MAX; bits++) {
+        uint64_t den = (uint64_t)fQ8 << bits;
+        divQ8 = ((80000000ULL << 16) + den / 2) / den;
+        if (divQ8 <= 0x3FFFF) break;
+      }
+    }
+    if (fQ8 == 0 || divQ8 > 0x3FFFF) {      // slower then the divider goes
+      ledc_set_duty(MODE, CHANNEL, 0);
+      ledc_update_duty(MODE, CHANNEL);
+      return 0;
+    }
+    ledc_timer_set(MODE, TIMER, uint32_t(divQ8), bits, LEDC_APB_CLK);
+    ledc_set_duty(MODE, CHANNEL, 1UL << (bits - 1));
+    ledc_update_duty(MODE, CHANNEL);
+    return uint32_t((80000000ULL << 16) / (divQ8 << bits));      // the divider's rounding
+  }
+
+#elif defined(__AVR__) && defined(SPEED_PULSE_TIMER2)
+  // ******************************** Nano, Timer2 on pin 3 ************************************
+  bool timerBegin()
+  {
+    if (pin != 3) return false;     // OC2B
+    pinMode(3, OUTPUT);
+    digitalWrite(3, LOW);
+    timerStop();
+    return true;
+  }
+  uint32_t timerSet(uint32_t fQ8)
+  {
+    SpeedPulseTimer2 next;                  // the divisions outside the cli()
+    if (!next.set(fQ8)) {
+      timerStop();
+      return 0;
+    }
+    SpeedPulseTimer2& t = speedPulseTimer2();
+    uint8_t sreg = SREG;
+    cli();
+    bool wasSlow = (t.phaseStep != 0), wasStopped = !(TCCR2B & (_BV(CS22) | _BV(CS21) | _BV(CS20)));
+    uint32_t phase = t.phase;
+    t = next;
+    if (next.phaseStep != 0) {
+      if (wasSlow) {
+        t.phase = phase;                    // the pin stays in step
+      } else {
+        TIMSK2 = 0;
+        TCCR2A = _BV(WGM21);                // CTC, TOP is OCR2A, OC2B off so PIND toggles pin 3
+        TCCR2B = t.TICK_PRESCALER + 1;
+        TCNT2 = 0;
+        OCR2A = t.TICK_TOP;
+        PORTD &= ~_BV(3);
+        TIFR2 = _BV(OCF2A);
+        TIMSK2 = _BV(OCIE2A);
+      }
+    } else {
+      TIMSK2 = 0;
+      if (wasSlow || wasStopped) TCNT2 = 0;         // from CTC it could be past the new TOP
+      OCR2A = t.top;                                // double buffered, takes over at the end of the period
+      OCR2B = t.top / 2;
+      TCCR2A = _BV(COM2B1) | _BV(WGM20);            // phase correct PWM, TOP is OCR2A
+      TCCR2B = _BV(WGM22) | (t.prescaler + 1);
+      if (t.fraction != 0) {
+        TIFR2 = _BV(TOV2);
+        TIMSK2 = _BV(TOIE2);                        // dithers TOP
+      }
+    }
+    SREG = sreg;
+    return next.frequencyQ8();
+  }
+  void timerStop()
+  {
+    uint8_t sreg = SREG;
+    cli();
+    TIMSK2 = 0;
+    TCCR2A = _BV(WGM20);                    // OC2B off, pin 3 back to PORTD LOW
+    TCCR2B = _BV(WGM22);                    // stopped
+    PORTD &= ~_BV(3);
+    speedPulseTimer2().set(0);
+    SREG = sreg;
+  }
+
+#elif defined(HOST_GPIO_PORTS)
+  // ******************************** Host_Bench ***********************************************
+  // the Nano's Timer2 settings in speedPulseTimer2(), without the registers
+  bool timerBegin() { return true; }
+  uint32_t timerSet(uint32_t fQ8) { return speedPulseTimer2().set(fQ8) ? speedPulseTimer2().frequencyQ8() : 0; }
+
+#else
+  bool timerBegin() { return false; }
+  uint32_t timerSet(uint32_t fQ8) { return 0; }
+#endif
+};
+
+#if defined(__AVR__) && defined(SPEED_PULSE_TIMER2)
+  ISR(TIMER2_OVF_vect)
+  {
+    uint8_t top = speedPulseTimer2().nextTop();
+    OCR2A = top;
+    OCR2B = top / 2;
+  }
+  ISR(TIMER2_COMPA_vect) { if (speedPulseTimer2().tick()) PIND = _BV(3); }     // writing PIND toggles
+#endif
+
+#endif
@@ -15,7 +15,12 @@ struct ConfigIP {
 #include <EEPROM.h>
 #include "src\EtherCard_AOG.h"
 #include <IPAddress.h>
+//#define OUTPUT_SCHEDULER_TIMER1              // uncomment with machine.startOutputScheduler() below, takes Timer1 (see outputScheduler.h)
+//#define SPEED_PULSE_TIMER2                   // uncomment with machine.speedPulse.begin(3) below, takes Timer2 (see speedPulse.h)
+//#define CYCLE_BENCH                          // uncomment to time the PGN to outputs stages in CPU cycles, 'b' on Serial prints them (see cycleBench.h)
 #include "machine.h"
+#include "pgnFramer.h"
+#include "pgnRouter.h"
 
 static uint8_t myIP[]  = { 0,0,0,123 };                  // ethernet interface ip address
 static uint8_t gwIP[]  = { 0,0,0,1 };                    // gateway ip address
@@ -77,6 +82,12 @@ void setup()
   ether.printIp("AgIO: ", broadcastIP);
 
   machine.init(arduinoOutputPinNumbers, sizeof(arduinoOutputPinNumbers), 100);
+  //machine.speedPulse.pulsesPerKm = 130000;           // radar style GPS speed output, 130000 is 36.1hz per km/hr
+  //machine.speedPulse.begin(3);                       // pin 3 only (Timer2), take it out of arduinoOutputPinNumbers first, needs SPEED_PULSE_TIMER2 above
+  //machine.startOutputScheduler();                     // outputs on a 500us Timer1 tick 4ms after the PGN, needs OUTPUT_SCHEDULER_TIMER1 above
+#ifdef CYCLE_BENCH
+  cycleBench().begin();               // Timer1, after machine.startOutputScheduler() if it's used
+#endif
 
   Serial.println("\r\n\nSetup complete, waiting for AgOpenGPS");
 }
@@ -86,97 +97,145 @@ void loop()
   delay(1);
 
   //this must be called for ethercard functions to work. Calls parseUdpData() defined below.
-  ether.packetLoop(ether.packetReceive());
+  {
+    CYCLE_BENCH_SCOPE(CycleBench::NETWORK);   // ENC28J60 SPI reads & parsing the PGNs
+    ether.packetLoop(ether.packetReceive());
+  }
 
   machine.watchdogCheck();      // used to check if UDP comms (PGN updates) have failed and turn outputs OFF
 
   readOutputPinStates();
+
+  if (Serial.available()) parseSerial();
+}
+
+void parseSerial()
+{
+  char cmd = Serial.read();
+  if (cmd == 'l') {                               // print (and reset with "lr") the 64 Section Data to outputs latency histogram
+    machine.printSectionLatency();
+    if (Serial.available() && Serial.peek() == 'r') {
+      Serial.read();
+      machine.sectionLatency.reset();
+      Serial.print(F("\r\n- latency reset"));
+    }
+  }
+  else if (cmd == 'b') {                          // print (and reset with "br") the CYCLE_BENCH stage timings
+#ifdef CYCLE_BENCH
+    cycleBench().print();
+    if (Serial.available() && Serial.peek() == 'r') {
+      Serial.read();
+      cycleBench().reset();
+      Serial.print(F("\r\n- cycle bench reset"));
+    }
+#else
+    Serial.print(F("\r\nCYCLE_BENCH isn't defined"));
+#endif
+  }
 }
 
 
+uint8_t* pgnSourceIP;      // IP of the packet currently being parsed, for the PGN handlers below
+
 void parseUdpData(uint16_t dest_port, uint8_t src_ip[IP_LEN], uint16_t src_port, uint8_t* udpData, uint16_t len)
 {
-  if (udpData[0] != 0x80 || udpData[1] != 0x81 || udpData[2] != 0x7F) return; // if these don't match, reject it
   /*IPAddress src(src_ip[0],src_ip[1],src_ip[2],src_ip[3]);
   Serial.print("dPort:");  Serial.print(dest_port);
   Serial.print("  sPort: ");  Serial.print(src_port);
   Serial.print("  sIP: ");  ether.printIp(src_ip);  Serial.print("  len:"); Serial.println(len);*/
 
+  machine.stampPacket(micros());      // start of the 64 Section Data to outputs latency
 
-  if (udpData[3] == 200)            // 0xC8 (200) - Hello from AgIO
-  {
-    Serial.print("\n0x"); Serial.print(udpData[3], HEX); Serial.print(" ("); Serial.print(udpData[3]); Serial.print(") - ");
-    Serial.print("Hello from AgIO");
+  // there can be more then one PGN in each packet, parse them straight out of the ENC28J60 buffer
+  pgnSourceIP = src_ip;
+  PgnFramer::parseBuffer(udpData, len, parsePgn);
+}
 
-    const uint8_t helloFromMachine[] = { 128, 129, 123, 123, 5, 0, 0, 0, 0, 0, 71 };
-    ether.sendUdp(helloFromMachine, 11, portFrom, broadcastIP, portDestination);
-  }
+// each PGN this module uses has its own handler, SketchPGNs (below) lists them
+bool machinePGNs(uint8_t* udpData, uint8_t len)     // Machine/Section PGNs, MACHINE has its own dispatch table for these
+{
+  return machine.parsePGN(udpData, len);
+}
 
+bool helloFromAgIO(uint8_t* udpData, uint8_t len)   // 0xC8 (200) - Hello from AgIO
+{
+  Serial.print("\n0x"); Serial.print(udpData[3], HEX); Serial.print(" ("); Serial.print(udpData[3]); Serial.print(") - ");
+  Serial.print("Hello from AgIO");
 
-  else if (udpData[3] == 201)       // 0xC9 (201) - Subnet Change
-  {
-    Serial.print("\n0x"); Serial.print(udpData[3], HEX); Serial.print(" ("); Serial.print(udpData[3]); Serial.print(") - ");
-    Serial.print("Subnet Change");
-
-    if (udpData[4] == 5 && udpData[5] == 201 && udpData[6] == 201)        // make really sure this is the subnet pgn
-    {
-      networkAddress.ipOne = udpData[7];
-      networkAddress.ipTwo = udpData[8];
-      networkAddress.ipThree = udpData[9];
-
-      //save in EEPROM and restart
-      EEPROM.put(5, networkAddress);
-      Serial.print("\r\nRebooting for network IP change");
-      delay(5);
-      resetFunc();
-    }
-  }
+  ether.sendUdp((const char*)machine.getHelloReply(), sizeof(machine.helloReply), portFrom, broadcastIP, portDestination);
+  return true;
+}
 
-  
-  else if (udpData[3] == 202)       // 0xCA (202) - Scan Request
+bool subnetChange(uint8_t* udpData, uint8_t len)    // 0xC9 (201) - Subnet Change
+{
+  Serial.print("\n0x"); Serial.print(udpData[3], HEX); Serial.print(" ("); Serial.print(udpData[3]); Serial.print(") - ");
+  Serial.print("Subnet Change");
+
+  if (udpData[4] == 5 && udpData[5] == 201 && udpData[6] == 201)        // make really sure this is the subnet pgn
   {
-    Serial.print("\n0x"); Serial.print(udpData[3], HEX); Serial.print(" ("); Serial.print(udpData[3]); Serial.print(") - ");
-    Serial.print("Scan Request");
-
-    if (udpData[4] == 3 && udpData[5] == 202 && udpData[6] == 202)   // make really sure this is the scan pgn
-    {
-      uint8_t scanReply[] = { 128, 129, 123, 203, 7, 
-        networkAddress.ipOne, networkAddress.ipTwo, networkAddress.ipThree, 123,
-        src_ip[0], src_ip[1], src_ip[2], 23   };
-
-      //checksum
-      int16_t CK_A = 0;
-      for (uint8_t i = 2; i < sizeof(scanReply) - 1; i++)
-      {
-        CK_A = (CK_A + scanReply[i]);
-      }
-      scanReply[sizeof(scanReply)-1] = CK_A;
-
-      static uint8_t superBroadcastIP[] = { 255,255,255,255 };
-
-      ether.sendUdp(scanReply, sizeof(scanReply), portFrom, superBroadcastIP, portDestination);
-    }
+    networkAddress.ipOne = udpData[7];
+    networkAddress.ipTwo = udpData[8];
+    networkAddress.ipThree = udpData[9];
+
+    //save in EEPROM and restart
+    EEPROM.put(5, networkAddress);
+    Serial.print("\r\nRebooting for network IP change");
+    delay(5);
+    resetFunc();
   }
+  return true;
+}
 
+bool scanRequest(uint8_t* udpData, uint8_t len)     // 0xCA (202) - Scan Request
+{
+  Serial.print("\n0x"); Serial.print(udpData[3], HEX); Serial.print(" ("); Serial.print(udpData[3]); Serial.print(") - ");
+  Serial.print("Scan Request");
 
-  // just added here to suppress repeated "Unknown PGN data" msgs
-  else if (udpData[3] == 0xFE)                // 0xFE (254) - Steer Data
+  if (udpData[4] == 3 && udpData[5] == 202 && udpData[6] == 202)   // make really sure this is the scan pgn
   {
-    //Serial.print("\n0x"); Serial.print(udpData[3], HEX); Serial.print(" ("); Serial.print(udpData[3]); Serial.print(") - ");
-    //Serial.print("Steer Data");
+    static uint8_t superBroadcastIP[] = { 255,255,255,255 };
+
+    // myIP has the subnet from networkAddress (set in setup), the reply is only patched if either IP changed
+    ether.sendUdp((const char*)machine.getScanReply(myIP, pgnSourceIP), sizeof(machine.scanReply), portFrom, superBroadcastIP, portDestination);
   }
+  return true;
+}
+
+bool latencyRequest(uint8_t* udpData, uint8_t len)  // 0xD1 (209) - Latency Request, bit 0 of the data byte resets the histogram
+{
+  ether.sendUdp((const char*)machine.getLatencyReply(), sizeof(machine.latencyReply), portFrom, pgnSourceIP, portDestination);
+  machine.printSectionLatency();
+  if (udpData[5] & 0x01) machine.sectionLatency.reset();
+  return true;
+}
 
+bool steerData(uint8_t* udpData, uint8_t len)       // 0xFE (254) - Steer Data, only its arrival time is used here
+{
+  machine.steerDataArrived();         // AOG sends it every GPS fix, so machine.commsWatchdog learns the rate from it too
+  return true;
+}
 
-  else if (machine.parsePGN(udpData, len))    // if no PGN matches yet, look for Machine PGNs
-  {
-    //Serial.print("\r\nMachine/Section PGN matched");
-  }
+// resolved at compile time, only the handlers listed here are compiled in
+typedef PgnRouter<
+  PgnRange<MACHINE::PGN_TABLE_FIRST, MACHINE::PGN_TABLE_FIRST + MACHINE::PGN_TABLE_SIZE - 1, machinePGNs>,
+  PgnHandler<200, 9, helloFromAgIO>,
+  PgnHandler<201, 11, subnetChange>,
+  PgnHandler<202, 9, scanRequest>,
+  PgnHandler<MACHINE::LATENCY_PGN, 7, latencyRequest>,
+  PgnHandler<0xFE, 14, steerData>
+> SketchPGNs;
 
+PgnFilter<SketchPGNs, 4> pgnFilter;     // drops everything SketchPGNs doesn't handle in one bit test, only 4 drop counters to save RAM
 
-  else      // catch & alert to all other PGN data
-  {
-    Serial.print("\r\n0x"); Serial.print(udpData[3], HEX); Serial.print("("); Serial.print(udpData[3]); Serial.print(") - Unknown PGN, len: "); Serial.print(len);
-  }
+void parsePgn(uint8_t* udpData, uint8_t len)
+{
+  if (!pgnFilter.pass(udpData[3])) return;
+  if (udpData[0] != 0x80 || udpData[1] != 0x81 || udpData[2] != 0x7F) return; // if these don't match, reject it
+
+  if (SketchPGNs::handle(udpData, len)) return;
+
+  // catch & alert to PGNs that passed pgnFilter but weren't handled (ie wrong length)
+  Serial.print("\r\n0x"); Serial.print(udpData[3], HEX); Serial.print("("); Serial.print(udpData[3]); Serial.print(") - Unknown PGN, len: "); Serial.print(len);
 }
 
 void readOutputPinStates()
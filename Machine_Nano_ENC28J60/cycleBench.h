@@ -0,0 +1,204 @@
+/*
+  On target benchmark, CPU cycles spent in each stage of the PGN to outputs path with min/mean/max per stage
+    - compile time: #define CYCLE_BENCH before #include "machine.h", without it CYCLE_BENCH_SCOPE() is nothing and this costs nothing
+    - CYCLE_BENCH_SCOPE(stage) at the top of a block times the rest of the block, from the cycle counter so flash wait states,
+      SPI & I2C are all in it (Host_Bench can't see those), one per block
+      - stages nest, ie PARSE_PGN includes MACHINE_STATES which includes OUTPUTS, so each is the total for its whole call
+      - interrupts that land in a stage are counted in it, the cost of start()/stop() themselves is measured in begin() and taken off
+        (an inner stage's stop() still shows in the stage around it, tens of cycles)
+    - Teensy 4.x: DWT->CYCCNT, 1 cycle
+    - ESP32: ccount (ESP.getCycleCount()), 1 cycle, the stats are locked as the AsyncUDP task & loop() both record
+      - per core, a task moved to the other core mid stage gets a nonsense sample (max), pin the tasks for clean numbers
+    - Nano: Timer1, it's the output scheduler's once that's started so it's read the way the scheduler set it up
+      - free (no output scheduler): Timer1 is set to count every cycle, 1 cycle, pins 9 & 10 lose analogWrite()
+      - output scheduler: prescaler 8 & TOP of one tick, 8 cycles
+      - stages longer then Timer1 wraps in (4ms, or a tick) are timed with micros() instead, 64 cycles
+      - begin() after machine.startOutputScheduler()
+    - anything else: micros(), so the "cycles" are us
+    - 32 bit sums, halved along with the count when they'd overflow so the mean stays right
+
+  Example:
+    #define CYCLE_BENCH                         // at the top of the sketch
+    cycleBench().begin();                       // in setup()
+    { CYCLE_BENCH_SCOPE(CycleBench::NETWORK); ether.packetLoop(ether.packetReceive()); }
+    cycleBench().print();                       // samples, min/mean/max cycles & us for each stage
+*/
+
+#ifndef CYCLEBENCH_H
+#define CYCLEBENCH_H
+
+#include <stdint.h>
+
+class CycleBench
+{
+public:
+  enum Stage : uint8_t {
+    NETWORK,            // receiving a packet & everything it sets off (ether.packetLoop(), Ethernet UDP read, AsyncUDP callback)
+    PARSE_PGN,          // machine.parsePGN()
+    MACHINE_STATES,     // updateStates()/updateMachineStates(), the functions & outputs from a PGN
+    OUTPUTS,            // Arduino pin writes (or queuing them for the output scheduler), the ESP32 output callbacks
+    PCA9555_WRITE,      // PCA9555 register updates & I2C writes
+    WATCHDOG,           // machine.watchdogCheck()
+    STAGES
+  };
+
+  struct Stats {
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint32_t sumCycles;
+  } stats[STAGES];
+
+  uint32_t overhead = 0;      // cycles a start() & stop() with nothing in between takes, taken off each sample
+
+  void begin()
+  {
+    counterBegin();
+    reset();
+    overhead = 0xFFFFFFFF;
+    for (uint8_t i = 0; i < 16; i++) {
+      uint32_t s = start();
+      uint32_t c = elapsed(s);
+      if (c < overhead) overhead = c;
+    }
+    reset();
+  }
+
+  void reset()
+  {
+    for (uint8_t i = 0; i < STAGES; i++) {
+      stats[i].count = stats[i].maxCycles = stats[i].sumCycles = 0;
+      stats[i].minCycles = 0xFFFFFFFF;
+    }
+  }
+
+  // the counter now, for stop()
+  inline uint32_t start() { return counterRead(); }
+
+  void stop(uint8_t stage, uint32_t startCount)
+  {
+    uint32_t c = elapsed(startCount);
+    c = (c > overhead ? c - overhead : 0);
+    if (stage >= STAGES) return;
+    lock();
+    Stats& s = stats[stage];
+    if (s.sumCycles + c < s.sumCycles) {        // would overflow, half the samples at the same mean
+      s.sumCycles >>= 1;
+      s.count >>= 1;
+    }
+    s.sumCycles += c;
+    s.count++;
+    if (c < s.minCycles) s.minCycles = c;
+    if (c > s.maxCycles) s.maxCycles = c;
+    unlock();
+  }
+
+  void print()
+  {
+    static const char* const names[STAGES] = { "network", "parsePGN", "machine states", "outputs", "PCA9555", "watchdogCheck" };
+    uint32_t mhz = cyclesPerUs();
+    Serial.print("\r\nCycle bench, "); Serial.print(mhz); Serial.print(" cycles/us, min/mean/max cycles (us)");
+    for (uint8_t i = 0; i < STAGES; i++) {
+      const Stats& s = stats[i];
+      if (s.count == 0) continue;
+      Serial.print("\r\n  "); Serial.print(names[i]); Serial.print(": "); Serial.print(s.count);
+      Serial.print(" x, "); printCycles(s.minCycles, mhz);
+      Serial.print(" / "); printCycles(s.sumCycles / s.count, mhz);
+      Serial.print(" / "); printCycles(s.maxCycles, mhz);
+    }
+  }
+
+private:
+  static void printCycles(uint32_t cycles, uint32_t mhz)
+  {
+    Serial.print(cycles); Serial.print(" (");
+    Serial.print(cycles / mhz); Serial.print("."); Serial.print((cycles % mhz) * 10 / mhz);
+    Serial.print(")");
+  }
+
+#if defined(__IMXRT1062__)
+  // ******************************** Teensy 4.x, DWT->CYCCNT **********************************
+  void counterBegin()
+  {
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;              // the Teensy core starts it, this is in case something stopped it
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+  }
+  inline uint32_t counterRead() { return ARM_DWT_CYCCNT; }
+  inline uint32_t elapsed(uint32_t startCount) { return ARM_DWT_CYCCNT - startCount; }
+  uint32_t cyclesPerUs() { return F_CPU_ACTUAL / 1000000; }
+  void lock() {}
+  void unlock() {}
+
+#elif defined(ESP32)
+  // ******************************** ESP32, ccount ********************************************
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+  void counterBegin() {}
+  inline uint32_t counterRead() { return ESP.getCycleCount(); }
+  inline uint32_t elapsed(uint32_t startCount) { return ESP.getCycleCount() - startCount; }
+  uint32_t cyclesPerUs() { return getCpuFrequencyMhz(); }
+  void lock() { portENTER_CRITICAL(&mux); }
+  void unlock() { portEXIT_CRITICAL(&mux); }
+
+#elif defined(__AVR__)
+  // ******************************** Nano, Timer1 *********************************************
+  uint32_t timerTop = 65536;      // Timer1 counts 0 to timerTop - 1
+  uint16_t cyclesPerCount = 1;    // Timer1 prescaler
+  uint16_t timerUs = 4096;        // Timer1 wraps this often
+
+  void counterBegin()
+  {
+    static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    uint8_t sreg = SREG;
+    cli();
+    if (TIMSK1 & _BV(OCIE1A)) {                 // the output scheduler's, CTC with TOP in OCR1A
+      timerTop = uint32_t(OCR1A) + 1;
+      cyclesPerCount = prescalers[TCCR1B & 0x07];
+    } else {                                    // free running, every cycle
+      TCCR1A = 0;
+      TCCR1B = _BV(CS10);
+      timerTop = 65536;
+      cyclesPerCount = 1;
+    }
+    SREG = sreg;
+    timerUs = timerTop * cyclesPerCount / (F_CPU / 1000000UL);
+  }
+  // micros() in the top 16 bits, Timer1 in the bottom
+  inline uint32_t counterRead() { return (uint32_t(uint16_t(micros())) << 16) | TCNT1; }
+  uint32_t elapsed(uint32_t startCount)
+  {
+    uint32_t now = counterRead();
+    uint16_t us = uint16_t(now >> 16) - uint16_t(startCount >> 16);
+    if (us + 8 >= timerUs) return uint32_t(us) * (F_CPU / 1000000UL);    // Timer1 could have wrapped, micros() it is
+    int32_t counts = int32_t(uint16_t(now)) - uint16_t(startCount);
+    if (counts < 0) counts += timerTop;         // no % here, a 32 bit divide would land in the stage around this one
+    return uint32_t(counts) * cyclesPerCount;
+  }
+  uint32_t cyclesPerUs() { return F_CPU / 1000000UL; }
+  void lock() {}
+  void unlock() {}
+
+#else
+  void counterBegin() {}
+  inline uint32_t counterRead() { return micros(); }
+  inline uint32_t elapsed(uint32_t startCount) { return micros() - startCount; }
+  uint32_t cyclesPerUs() { return 1; }
+  void lock() {}
+  void unlock() {}
+#endif
+};
+
+inline CycleBench& cycleBench() { static CycleBench bench; return bench; }
+
+#ifdef CYCLE_BENCH
+  struct CycleBenchScope {
+    uint8_t stage;
+    uint32_t startCount;
+    CycleBenchScope(uint8_t _stage) : stage(_stage), startCount(cycleBench().start()) {}
+    ~CycleBenchScope() { cycleBench().stop(stage, startCount); }
+  };
+  #define CYCLE_BENCH_SCOPE(stage) CycleBenchScope cycleBenchScope(stage)
+#else
+  #define CYCLE_BENCH_SCOPE(stage)
+#endif
+
+#endif
@@ -0,0 +1,108 @@
+/*
+  Fixed size log bucket histogram of latencies in us, for timing things under real field traffic without keeping every sample
+    - a bucket is a power of 2 (octave) split into 2^SUB_BITS, so the buckets are 1/2^SUB_BITS of their octave wide (25% with 2 bits)
+      - OCTAVES * 2^SUB_BITS buckets, values past the last one are counted in the last bucket
+    - record() is a bit scan, a shift & an increment, no floats or division, counts stop at their max instead of wrapping
+    - percentiles are the middle of the bucket they fall in (never more then max), max is exact
+    - print() for Serial, the raw counts are public for anything else (ie a UDP reply)
+
+  Example:
+    LatencyHistogram<> latency;             // 24 octaves (up to 33s) at 25%, 96 x 32 bit counts
+    latency.record(micros() - startUs);
+    latency.print("Packet to output");      // samples, p50, p90, p99 & max in us
+    latency.reset();
+*/
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+template <uint8_t OCTAVES = 24, uint8_t SUB_BITS = 2, typename Count = uint32_t>
+class LatencyHistogram
+{
+public:
+  static const uint8_t SUBS = 1 << SUB_BITS;
+  static const uint16_t NUM_BUCKETS = uint16_t(OCTAVES) * SUBS;
+
+  Count count = 0;
+  uint32_t maxUs = 0;
+  Count buckets[NUM_BUCKETS] = {};
+
+  void record(uint32_t us)
+  {
+    uint16_t b = bucketOf(us);
+    if (b >= NUM_BUCKETS) b = NUM_BUCKETS - 1;
+    if (buckets[b] != Count(~Count(0))) buckets[b]++;
+    if (count != Count(~Count(0))) count++;
+    if (us > maxUs) maxUs = us;
+  }
+
+  void reset()
+  {
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    maxUs = 0;
+  }
+
+  // percent 0-100, 0 if there are no samples
+  uint32_t percentile(uint8_t percent)
+  {
+    if (count == 0) return 0;
+    uint32_t target = (uint32_t(count) * percent + 99) / 100;     // the sample we want, counting from 1
+    if (target == 0) target = 1;
+    uint32_t seen = 0;
+    for (uint16_t b = 0; b < NUM_BUCKETS; b++) {
+      seen += buckets[b];
+      if (seen < target) continue;
+      if (b == NUM_BUCKETS - 1) return maxUs;     // anything past the last bucket is counted in it
+      uint32_t start = bucketStart(b);
+      uint32_t mid = (b < SUBS ? start : start + (bucketStart(b + 1) - start) / 2);    // the first buckets are 1us wide
+      return (mid < maxUs ? mid : maxUs);
+    }
+    return maxUs;
+  }
+
+  void print(const char* name)
+  {
+    Serial.print("\r\n"); Serial.print(name);
+    Serial.print(": "); Serial.print(uint32_t(count)); Serial.print(" samples");
+    if (count == 0) return;
+    Serial.print(", p50 "); Serial.print(percentile(50));
+    Serial.print("us, p90 "); Serial.print(percentile(90));
+    Serial.print("us, p99 "); Serial.print(percentile(99));
+    Serial.print("us, max "); Serial.print(maxUs); Serial.print("us");
+  }
+
+  // values below SUBS get a bucket each, then SUBS buckets per octave
+  static uint16_t bucketOf(uint32_t us)
+  {
+    if (us < SUBS) return us;
+    uint8_t msb = highestBit(us);
+    return (msb - SUB_BITS + 1) * SUBS + ((us >> (msb - SUB_BITS)) & (SUBS - 1));
+  }
+
+  // lowest value that goes in bucket b
+  static uint32_t bucketStart(uint16_t b)
+  {
+    if (b < SUBS) return b;
+    uint8_t msb = b / SUBS + SUB_BITS - 1;
+    if (msb > 31) return 0xFFFFFFFF;
+    return (1UL << msb) | (uint32_t(b % SUBS) << (msb - SUB_BITS));
+  }
+
+private:
+  static uint8_t highestBit(uint32_t v)       // v > 0
+  {
+  #if defined(__AVR__)
+    uint8_t bit = 0;                          // no 32 bit count leading zeros instruction, and an int is 16 bits
+    while (v >>= 1) bit++;
+    return bit;
+  #else
+    return 31 - __builtin_clz(v);
+  #endif
+  }
+};
+
+#endif
@@ -5,14 +5,22 @@
 
   Supports control of regular Arduino pins as well as PCA9555 I2C port expanders as used on the AiO v5.0a Proto
     - two init() functions, one for Arduino pins and one for PCA9555/v5.0a control
-    - currently only properly supports 24 output pins
-      - to use all 64 would probably need a mode to only do sections and not other functions like hyd lift, trams, geo stop, etc
+    - 24 function selectable output pins (AoG pin config), or sections 1-24 on 24 pins in section only mode (setSectionsOnly())
+      - section only mode skips the other functions like hyd lift, trams, geo stop, etc
+    - optional valve latency compensation for sections 1-16 (sectionTiming), edges go out from watchdogCheck() when they're due
+      so their timing is only as good as the loop period, unless the output scheduler writes them (see sectionTiming.h)
+    - optional output scheduler (startOutputScheduler(), needs #define OUTPUT_SCHEDULER_TIMER1), the pins change on a Timer1 tick
+      a fixed time after the PGN came in
+    - 64 Section Data in to outputs written latency histogram (sectionLatency), the sketch stamps packets with stampPacket()
+    - optional GPS speed pulse output from Timer2 on pin 3 (speedPulse.begin(3), needs #define SPEED_PULSE_TIMER2)
+    - comms watchdog learns the 64 Section Data & Steer Data rates (commsWatchdog), outputs go OFF after a few missed periods
+      the fixed watchdogTimeoutPeriod is the upper bound, the sketch calls steerDataArrived() as Steer Data isn't a machine PGN
+    - #define CYCLE_BENCH before including this to time the PGN to outputs stages in CPU cycles (see cycleBench.h)
     - 
 
 
   To to:
     - add section switch code, maybe in it's own class?
-    - add GPS speed output options/code
     - maybe split up machine functions and sections into seperate classes or seperate output groups
 */
 
@@ -21,6 +29,13 @@
 
 #include "EEPROM.h"
 #include "elapsedMillis.h"
+#include "outputPorts.h"
+#include "sectionTiming.h"
+#include "speedPulse.h"
+#include "commsWatchdog.h"
+#include "cycleBench.h"
+#include "outputScheduler.h"
+#include "latencyHistogram.h"
 #ifdef CLSPCA9555_H_
   #include "clsPCA9555.h"
 #endif
@@ -29,7 +44,7 @@ class MACHINE
 {
 private:
   int16_t eeAddr = -1;                            // -1 defaults to no EEPROM saving/loading
-  #define EE_IDENT 11                             // change to force EE to reset to defaults
+  #define EE_IDENT 12                             // change to force EE to reset to defaults
   bool eeLoadedAtStartup;
 
   struct Config {
@@ -44,7 +59,16 @@ private:
     uint8_t user4;
 
     uint8_t pinFunction[1 + 24] = { 0,1,2,3,4,5,6,7,8,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
-  };  Config config;   // 33 bytes
+
+    uint8_t numSections = 0;              // from Section Dimensions PGN
+    uint16_t sectionWidth[16] = { 0 };    // cm, section 1 is the left most
+  };  Config config;   // 66 bytes
+
+  // worked out from config.sectionWidth[] once, when it changes, see updateSectionGeometry()
+  struct SectionGeometry {
+    uint16_t totalWidth = 0;      // cm
+    int16_t offset[16] = { 0 };   // cm, from the centre of the machine to the centre of each section, left is -ve
+  }; SectionGeometry sectionGeometry;
   /* pin function numbers as below, assigned to pinFunction[]
   1-16   Section 1-16
   17,18  Hyd Up, Hyd Down,
@@ -58,7 +82,24 @@ private:
   uint8_t numOutputPins = 0;                      // 0 defaults to no direct Arduino pin control
   const uint8_t maxOutputPins = 24;               // 24 pins can be configured in AoG (Machine Pin Config PGN), 64 sections currently the max supported by AoG
   uint8_t* outputPinNumbers;                      // store Arduino output pin numbers
+  OutputPorts<14, 3> outputPorts;    // Nano: D2-D9 & A0-A5 max, on PORTD, PORTB & PORTC
+  uint32_t outputLatencyUs;                       // PGN in to outputs out, with the output scheduler running
+  uint32_t eventUs;                               // micros() when the PGN (or watchdogCheck()) that's updating the outputs started
+  uint32_t packetUs;                              // stampPacket(), when the packet being parsed came in
+  bool isPacketStamped;
+  uint32_t outputWriteUs;                         // when the last output write goes out, see outputWritten()
+  bool isOutputWritten;                           // cleared at the start of each 64 Section Data
   bool forceOutputUpdate;
+  bool isSectionsOnly = false;                    // setSectionsOnly(), section n on pin n, no pin functions
+
+  // config.pinFunction/isPinActiveHigh compiled by compilePinMap(), so updating the outputs is a bit gather and one XOR
+  struct PinMap {
+    uint8_t functionBit[24];      // states.functions bit for each pin (pin 1 is [0]), 0 is always OFF
+    uint32_t invertMask;          // pins that are LOW when ON (isPinActiveHigh = 0)
+    uint32_t sectionMask;         // section only mode: the pins there are
+    uint32_t sectionInvertMask;   // section only mode: invertMask for all of them
+  }; PinMap pinMap;
+  uint32_t pinLevels;             // levels last written to pins 1-24, bit 0 is pin 1
 
 #ifdef CLSPCA9555_H_
   PCA9555* pcaOutputs = NULL;
@@ -71,12 +112,18 @@ private:
     uint8_t hydLift;              // 0 - off, 1 - down, 2 - up
     uint8_t tramline;             // bit0: right, bit1: left
     uint8_t geoStop;              // 0 - inside boundary, 1 - outside boundary
+    uint8_t toolLeftSpeed;        // from 64 Section Data, only the ratio of left to right is used
+    uint8_t toolRightSpeed;
 
-    // read value from Machine Data and set 1 or zero according to list, 21 different function types
-    bool functions[1 + 21] = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
+    // 21 different function types, bit n is function n (bit 0 is not used), all set in one go by updateStates()
+    uint32_t functions = 0;
+    uint32_t changedFunctions = 0;  // functions that changed in the last update (XOR of the old & new states)
 
     // store state of up to 64 sections, from AOG, but only currently using section 1-16 as per the pin functions above
-    bool sections[1 + 64];
+    union {
+      uint8_t groupsofeight[8];  // access sections in groups of 8 (bytes)
+      uint64_t allSections;      // access the total value of all section states, updated in one go from 64 Section Data PGN
+    } sections;
   }; States states;
 
   elapsedMillis watchdogTimer;
@@ -85,6 +132,12 @@ private:
   const uint16_t watchdogAlertPeriod = 1000;      // ms, how long after UDP comms lost to alert
   bool watchdogAlertTriggered;
 
+  // hyd lift runs for config.lowerTime/raiseTime secs of millis() from when AOG's hydLift changes, whatever rate the PGNs come at
+  uint8_t hydTrigger;             // hydLift that started the lift: 1 - lower, 2 - raise, 0 - none
+  bool isHydRunning;              // ON until hydRunMs after hydStartMs, watchdogCheck() turns it OFF between PGNs
+  uint32_t hydStartMs;
+  uint32_t hydRunMs;
+
   const String functionNames[1 + 21] = { "",
       "S01", "S02", "S03", "S04", "S05", "S06", "S07", "S08",
       "S09", "S10", "S11", "S12", "S13", "S14", "S15", "S16",
@@ -94,6 +147,12 @@ private:
 public:
 
   bool isInit;
+  SectionTiming<16, uint32_t> sectionTiming;    // section 1-16 valve latency compensation, off until sectionTiming.isEnabled is set (see sectionTiming.h)
+  SpeedPulse speedPulse;             // GPS speed pulse output, off until speedPulse.begin(pin) (see speedPulse.h)
+  CommsWatchdog<2> commsWatchdog{ watchdogAlertPeriod, watchdogTimeoutPeriod };   // learned comms timeout, the fixed periods are its upper bounds (see commsWatchdog.h)
+  static const uint8_t COMMS_SECTION_DATA = 0, COMMS_STEER_DATA = 1;               // commsWatchdog streams
+  OutputScheduler<OutputPorts<14, 3>, uint32_t, 8, 4> outputScheduler;    // writes outputPorts from Timer1, see startOutputScheduler()
+  LatencyHistogram<18, 1, uint16_t> sectionLatency;   // us from 64 Section Data received to outputs written, 50% buckets to 262ms & 16 bit counts to save RAM
 
   uint8_t debugLevel = 3;
     // 0 - debug prints OFF
@@ -119,13 +178,15 @@ public:
   ~MACHINE(void) {}
 
   // init function for regular "Arduino" pins
-  void init(uint8_t* _outputPinNumbers, uint8_t _numOutputPins = 0, int16_t _eeAddr = -1, const uint8_t _eeSize = 33)
+  void init(uint8_t* _outputPinNumbers, uint8_t _numOutputPins = 0, int16_t _eeAddr = -1, const uint8_t _eeSize = 68)
   {
+    (void)_eeSize;
     numOutputPins = min(_numOutputPins, maxOutputPins);   // limit to maxOutputPins (24 or 64)
     
     //Serial.print("\r\nnumOutputPins:"); Serial.print(numOutputPins);
     eeAddr = _eeAddr;
     loadFromEeprom();
+    compilePinMap();
 
     outputPinNumbers = _outputPinNumbers;
 
@@ -133,133 +194,138 @@ public:
       pinMode(outputPinNumbers[i], OUTPUT);
       digitalWrite(outputPinNumbers[i], !config.isPinActiveHigh);
     }
+    pinLevels = pinMap.sectionInvertMask;   // all OFF
+    if (!outputPorts.begin(outputPinNumbers, numOutputPins) && debugLevel > 0) {
+      Serial.print("\r\n* More output pins/ports then outputPorts has room for, see outputPorts.h *");
+    }
     isInit = true;
   }
 
 #ifdef CLSPCA9555_H_
   // init function for PCA9555 IO expander pins (AiO v5.0a)
-  void init(PCA9555* _pcaOutputs, uint8_t* _outputPins, int16_t _eeAddr = -1, const uint8_t _eeSize = 33)
+  void init(PCA9555* _pcaOutputs, uint8_t* _outputPins, int16_t _eeAddr = -1, const uint8_t _eeSize = 68)
   {
+    (void)_eeSize;
     pcaOutputs = _pcaOutputs;
     eeAddr = _eeAddr;
     loadFromEeprom();
+    compilePinMap();
 
     pcaOutputPinNumbers = _outputPins;
 
     for (uint8_t i = 0; i < 8; i++){
       //pcaOutputPinNumbers[i+1] = _outputPins[i];
       //pcaOutputs->pinMode(pcaOutputPinNumbers[i], OUTPUT);                         // calling digitalWrite already sets the pins to OUTPUT
-      pcaOutputs->digitalWrite(pcaOutputPinNumbers[i], config.isPinActiveHigh);      // PCA9555 outputs on AiO v5.0a are inverted from other test LEDs
+      pcaOutputs->bufferWrite(pcaOutputPinNumbers[i], config.isPinActiveHigh);      // PCA9555 outputs on AiO v5.0a are inverted from other test LEDs
     }
+    pcaOutputs->flush();
     isInit = true;
   }
 #endif
 
+  // outputs go out from the Timer1 interrupt on a tickUs grid, latencyUs after the PGN came in, instead of in the PGN parsing
+  // latencyUs has to cover the slowest PGN parse (incl debug prints) or those changes are a tick late
+  // false without #define OUTPUT_SCHEDULER_TIMER1 before #include "machine.h", the Timer1 interrupt is only compiled in with it
+  bool startOutputScheduler(uint32_t tickUs = 500, uint32_t latencyUs = 4000)
+  {
+    outputLatencyUs = latencyUs;
+    return outputScheduler.begin(&outputPorts, tickUs);
+  }
+
+  // Steer Data (254) isn't a machine PGN, the sketch calls this when one arrives so commsWatchdog learns AOG's rate from it too
+  void steerDataArrived() { commsWatchdog.arrived(COMMS_STEER_DATA, millis()); }
+
+  // section only mode, best set before init(): sections 1-24 go straight to pins 1-24
+  // the pin function map and hyd lift, tramline & geo stop are skipped, each update is a 32 bit copy and diff
+  void setSectionsOnly(bool _isSectionsOnly)
+  {
+    isSectionsOnly = _isSectionsOnly;
+    compilePinMap();
+  }
+
   void watchdogCheck()
   {
-    if (watchdogTimer > watchdogTimeoutPeriod)    // watchdogTimer reset with Machine Data PGN, should be 64 Section instead or both?
+    CYCLE_BENCH_SCOPE(CycleBench::WATCHDOG);
+    if (outputScheduler.isRunning()) eventUs = micros();
+    if (sectionTiming.update(millis())) {      // compensated section edges that came due since the PGN
+      // the scheduler writes them latency after they came due, not after loop() got here, so the loop period doesn't add jitter
+      if (outputScheduler.isRunning()) eventUs = micros() - uint16_t(uint16_t(millis()) - sectionTiming.dueMs) * 1000UL;
+      updateSectionEdges();
+      if (outputScheduler.isRunning()) eventUs = micros();
+    }
+    if (isHydRunning && millis() - hydStartMs >= hydRunMs) updateHydLiftEdge();    // lift time is up, no need to wait for a PGN
+    // commsWatchdog trips a few of AOG's periods after the last 64 Section/Steer Data, watchdogTimer (reset when 64 Section Data updates the outputs) is the upper bound
+    uint32_t nowMs = millis();
+    bool isCommsTimedOut = commsWatchdog.isTimedOut(nowMs);
+    if (isCommsTimedOut || watchdogTimer > watchdogTimeoutPeriod)
     {
-      if (debugLevel > 0) Serial.print("\r\n*** UDP Machine Comms lost for 4s, setting all outputs OFF! ***");
-      for (uint8_t i = 1; i <= 21; i++) {
-        states.functions[i] = 0;            // set all functions OFF
+      if (debugLevel > 0) {
+        Serial.print("\r\n*** UDP Machine Comms lost for ");
+        Serial.print(isCommsTimedOut ? commsWatchdog.sinceMs(nowMs) : uint32_t(watchdogTimer));
+        Serial.print("ms, setting all outputs OFF! ***");
       }
+      watchdogAlertTriggered = true;        // so it says when they resume
+      states.changedFunctions = states.functions;
+      states.functions = 0;                 // set all functions OFF
+      states.sections.allSections = 0;      // and sections, section only mode outputs follow them directly
+      sectionTiming.reset();                // right now, no compensation
+      isHydRunning = false;
+      speedPulse.setSpeed(0);               // speed unknown, stop the pulses
 
       updateOutputPins();
       watchdogTimer = 0;            // only output timed out OFF every watchdogTimeoutPeriod
     }
-    else if (watchdogTimer > watchdogAlertPeriod)
+    else if (watchdogTimer > watchdogAlertPeriod || commsWatchdog.isLate(nowMs))
     {
       if (debugLevel > 0 && !watchdogAlertTriggered) {
-        Serial.print("\r\n** UDP Machine Comms lost for 1s **");
-        watchdogAlertTriggered = true;
+        Serial.print("\r\n** UDP Machine Comms lost for ");
+        Serial.print(min(commsWatchdog.sinceMs(nowMs), uint32_t(watchdogTimer)));
+        Serial.print("ms **");
       }
+      watchdogAlertTriggered = true;
     }
   }
 
+  // outputs were just updated from a PGN
+  void resetWatchdog()
+  {
+    if (debugLevel > 0 && watchdogAlertTriggered) {
+      Serial.print("\r\n*** UDP Machine Comms resumed ***");
+    }
+    watchdogTimer = 0;   //reset watchdog timer
+    watchdogAlertTriggered = false;
+  }
+
   // update triggered by PGN from AOG for quicker section response, watchdogCheck() looks for comms timeout
   // updating outputs from PGN should be slightly quicker response then waiting for old update loop to trigger, at times the delay was almost 200ms
   void updateStates()
   {
-    static uint8_t lastTrigger;          // "static" means this var is accessible only to this function but its value persists (it's not destroyed)
-    static uint8_t raiseTimer = 0;
-    static uint8_t lowerTimer = 0;
-    bool isRaise, isLower;
-
-    bool prevFunctions[sizeof(states.functions)];// = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0 };
-    memcpy(prevFunctions, states.functions, sizeof(states.functions));
-
-    if (config.hydLiftEnable)       // hydraulic lift
-    {
-      if (states.hydLift != lastTrigger && (states.hydLift == 1 || states.hydLift == 2))
-      {
-        lastTrigger = states.hydLift;
-        lowerTimer = 0;
-        raiseTimer = 0;
-
-        switch (states.hydLift) {
-          case 1:   //lower
-            lowerTimer = config.lowerTime * 5;      // secs * 5 update cycles per second (5hz)
-            break;
-          case 2:   //raise
-            raiseTimer = config.raiseTime * 5;
-            break;
-        }
-      }
-
-      if (raiseTimer) {
-        raiseTimer--;
-        lowerTimer = 0;
-      }
-      if (lowerTimer) lowerTimer--;
-
-      //if anything wrong, shut off hydraulics, reset last
-      if (states.hydLift != 1 && states.hydLift != 2) { //|| gpsSpeed < 2)
-        lowerTimer = 0;
-        raiseTimer = 0;
-        lastTrigger = 0;
-      }
-
-      isLower = isRaise = false;          // set both OFF
-      if (lowerTimer) isLower = true;     // if lower is active, set ON
-      if (raiseTimer) isRaise = true;     // if raise is active, set ON
-    }
-    else {      // hyd lift is disabled, make sure any hyd lift pins are OFF
-      isLower = false;
-      isRaise = false;
-    }
-
-    /*float speedPulse = gpsSpeed * 36.1111;
-    if (speedPulse > 2.0) {                    // less then 2 hz (0.055 km/hr) doesn't work well with tone()
-      tone(speedPulsePin, uint16_t(speedPulse));
-    } else {
-      noTone(speedPulsePin);
-    }*/
-
-    //Load the current output states for section 1-16 only from 64 Sections PGN
-    for (uint8_t i = 1; i <= 16; i++) {
-        states.functions[i] = states.sections[i];    // copy from 64 Sections PGN
+    CYCLE_BENCH_SCOPE(CycleBench::MACHINE_STATES);
+    if (isSectionsOnly) {       // no hyd lift, tramlines or geo stop, the sections go straight to the outputs
+      updateSectionOutputs();
+      resetWatchdog();
+      return;
     }
 
-    // Hydraulics
-    states.functions[17] = isLower;
-    states.functions[18] = isRaise;
+    uint8_t hydOutput = updateHydLift();
+    bool isLower = (hydOutput == 1);
+    bool isRaise = (hydOutput == 2);
 
-    //Tram
-    states.functions[19] = bitRead(states.tramline, 0); //right
-    states.functions[20] = bitRead(states.tramline, 1); //left
+    // build all the functions at once, sections 1-16 shift straight into functions 1-16
+    uint32_t functions = uint32_t(uint16_t(sectionTiming.outputs)) << 1;
+    if (isLower) functions |= 1UL << 17;                  // Hydraulics
+    if (isRaise) functions |= 1UL << 18;
+    functions |= uint32_t(states.tramline & 0x03) << 19;  // Tram, bit 0 right, bit 1 left
+    if (states.geoStop) functions |= 1UL << 21;           // GeoStop
 
-    //GeoStop
-    states.functions[21] = states.geoStop;
+    states.changedFunctions = functions ^ states.functions;
+    states.functions = functions;
 
-    if (forceOutputUpdate || memcmp(states.functions, prevFunctions, sizeof(states.functions))) {
+    if (forceOutputUpdate || states.changedFunctions) {
       //Serial.print("\r\nOutputs updated");
       updateOutputPins();
     }
-
-    if (debugLevel > 0 && watchdogTimer > watchdogAlertPeriod) {
-      Serial.print("\r\n*** UDP Machine Comms resumed ***");
-    }
-    watchdogTimer = 0;   //reset watchdog timer
+    resetWatchdog();
 
     // *** Sending PGN_237 isn't necessary/doesn't do anything?
 
@@ -283,27 +349,37 @@ public:
 
   void updateOutputPins()
   {
+    if (isSectionsOnly) {
+      updateSectionOutputs();
+      return;
+    }
+
     // set pins according to states.functions unless watchdog has timed out, then set to !isPinActiveHigh
+    uint32_t levels = gatherPinLevels();
+    uint32_t changed = (forceOutputUpdate ? 0x00FFFFFF : levels ^ pinLevels);    // only write the pins that changed
+    pinLevels = levels;
 
     if (numOutputPins > 0)
     {
       //if (debugLevel > 3) Serial.print("\r\nPin outputs ");
-      for (uint8_t i = 1; i <= numOutputPins; i++) {
-        digitalWrite(outputPinNumbers[i - 1], states.functions[config.pinFunction[i]] == config.isPinActiveHigh);                     // ==, XOR
-        //if (debugLevel > 3) Serial.print(i); Serial.print(":"); Serial.print(states.functions[config.pinFunction[i]] == config.isPinActiveHigh); Serial.print(" ");
-      }
+      writeOutputPorts(levels, changed);      // one register write per port, the pins on a port switch together
     }
 
 #ifdef CLSPCA9555_H_
     if (pcaOutputs != NULL)
     {
-      //if (debugLevel > 3) Serial.print("\r\nPCA outputs ");
-      for (uint8_t i = 1; i <= 8; i++) {       // AiO v5.0a has 8 PCA9555 outputs
-        if (config.pinFunction[i] > 0) {
-          pcaOutputs->digitalWrite(pcaOutputPinNumbers[i - 1], !(states.functions[config.pinFunction[i]] == config.isPinActiveHigh));   // NXOR
-          //if (debugLevel > 3) Serial.print(i); Serial.print(":"); Serial.print(!(states.functions[config.pinFunction[i]] == config.isPinActiveHigh)); Serial.print(" ");
+      CYCLE_BENCH_SCOPE(CycleBench::PCA9555_WRITE);
+      for (uint8_t i = 0; i < 8; i++) {       // AiO v5.0a has 8 PCA9555 outputs
+        if (pinMap.functionBit[i] > 0) {
+          pcaOutputs->bufferWrite(pcaOutputPinNumbers[i], !bitRead(levels, i));   // inverted, low side switching
         }
       }
+      bool isSent = pcaOutputs->flush();      // all 8 outputs in one 2 byte I2C write, nothing if they didn't change
+      if (isSent) outputWritten(micros());
+      if (debugLevel > 3 && isSent) {
+        Serial.print("\r\nPCA outputs ");
+        for (uint8_t i = 0; i < 8; i++) { Serial.print(i + 1); Serial.print(":"); Serial.print(!bitRead(levels, i)); Serial.print(" "); }
+      }
     }
 #endif
     /*Serial.println();
@@ -312,155 +388,425 @@ public:
     }
     Serial.println();
     for (byte i = 0; i < 24; i++){
-      Serial.printf("%2i ", (config.pinFunction[i] > 0 ? states.functions[config.pinFunction[i]] : -1));
+      Serial.printf("%2i ", (config.pinFunction[i] > 0 ? bitRead(states.functions, config.pinFunction[i]) : -1));
     }
     Serial.println();
     for (byte i = 0; i < 22; i++){
-      Serial.printf("%2i ", states.functions[i]);
+      Serial.printf("%2i ", bitRead(states.functions, i));
     }*/
     //Serial << "\r\noutput update delay: " << updateDelayTimer;
-    //if (config.pinFunction[0]) digitalWrite(4, states.functions[config.pinFunction[0]]);
+    //if (config.pinFunction[0]) digitalWrite(4, bitRead(states.functions, config.pinFunction[0]));
     forceOutputUpdate = false;
   }
 
+  // which hyd lift output is ON: 1 - lower, 2 - raise, 0 - none
+  uint8_t updateHydLift()
+  {
+    if (!config.hydLiftEnable || (states.hydLift != 1 && states.hydLift != 2)) {    // disabled, or anything wrong, shut off hydraulics, reset last
+      hydTrigger = 0;
+      isHydRunning = false;
+      return 0;
+    }
+    if (states.hydLift != hydTrigger) {
+      hydTrigger = states.hydLift;
+      hydStartMs = millis();
+      hydRunMs = (hydTrigger == 1 ? config.lowerTime : config.raiseTime) * 1000UL;
+      isHydRunning = true;
+    }
+    if (isHydRunning && millis() - hydStartMs >= hydRunMs) isHydRunning = false;
+    return (isHydRunning ? hydTrigger : 0);
+  }
+
+  // the hyd lift time ran out between PGNs, only the hyd lift functions change
+  void updateHydLiftEdge()
+  {
+    isHydRunning = false;
+    uint32_t functions = states.functions & ~(3UL << 17);      // Hydraulics OFF
+    states.changedFunctions = functions ^ states.functions;
+    states.functions = functions;
+    if (states.changedFunctions) updateOutputPins();
+  }
+
+  // a compensated section edge came due, only sections 1-16 in states.functions change, the hyd lift is left alone
+  void updateSectionEdges()
+  {
+    if (isSectionsOnly) {
+      updateSectionOutputs();
+      return;
+    }
+    uint32_t functions = (states.functions & ~0x0001FFFEUL) | (uint32_t(uint16_t(sectionTiming.outputs)) << 1);
+    states.changedFunctions = functions ^ states.functions;
+    states.functions = functions;
+    if (states.changedFunctions) updateOutputPins();
+  }
+
+  // section only mode, section n to pin n, no pin function map
+  void updateSectionOutputs()
+  {
+    uint32_t levels = (sectionTiming.outputs & pinMap.sectionMask) ^ pinMap.sectionInvertMask;    // only the low 4 bytes, no 64 bit math on AVR
+    uint32_t changed = (forceOutputUpdate ? pinMap.sectionMask : levels ^ pinLevels);
+    pinLevels = levels;
+
+    if (changed) writeOutputPorts(levels, changed);
+    forceOutputUpdate = false;
+  }
+
+  // straight away, or on the output scheduler's tick outputLatencyUs after eventUs
+  void writeOutputPorts(uint32_t levels, uint32_t changed)
+  {
+    CYCLE_BENCH_SCOPE(CycleBench::OUTPUTS);
+    if (outputScheduler.write(levels, changed, eventUs + outputLatencyUs)) {
+      outputWritten(outputScheduler.dueUs);
+    } else {
+      outputPorts.write(levels, changed);
+      outputWritten(micros());
+    }
+  }
+
   // ***************************************************************************************************************************************************
   // ****************************************************** PGN PARSING ********************************************************************************
   // ***************************************************************************************************************************************************
+  // packed views of the machine PGNs, cast straight over the receive buffer to read the fields without copying the PGN
+  // all three boards are little endian, so multi byte fields can be read as is (LSB first like AOG sends them)
+  struct __attribute__((packed)) PgnHeader {
+    uint8_t aogHeader[2];           // 0x80, 0x81
+    uint8_t source;                 // 0x7F from AgIO
+    uint8_t pgn;
+    uint8_t dataLen;                // number of data bytes (excludes header & CRC)
+  };
+
+  struct __attribute__((packed)) SectionDataPgn {       // 0xE5 (229) - 64 Section Data
+    PgnHeader header;
+    uint64_t sections;              // bit 0 is section 1
+    uint8_t leftSpeed;
+    uint8_t rightSpeed;
+    uint8_t crc;
+  };
+
+  struct __attribute__((packed)) SectionDimsPgn {       // 0xEB (235) - Section Dimensions
+    PgnHeader header;
+    uint16_t sectionWidth[16];      // cm
+    uint8_t numSections;
+    uint8_t crc;
+  };
+
+  struct __attribute__((packed)) PinConfigPgn {         // 0xEC (236) - Machine Pin Config
+    PgnHeader header;
+    uint8_t pinFunction[24];        // function number for pin 1-24
+    uint8_t crc;
+  };
+
+  struct __attribute__((packed)) MachineConfigPgn {     // 0xEE (238) - Machine Config
+    PgnHeader header;
+    uint8_t raiseTime;
+    uint8_t lowerTime;
+    uint8_t hydLiftEnable;          // not used, see set0
+    uint8_t set0;                   // bit 0: relayActiveHigh, bit 1: hydLiftEnable
+    uint8_t user[4];
+    uint8_t crc;
+  };
+
+  struct __attribute__((packed)) MachineDataPgn {       // 0xEF (239) - Machine Data
+    PgnHeader header;
+    uint8_t uTurn;
+    uint8_t gpsSpeed;               // km/hr * 10
+    uint8_t hydLift;                // 0 - off, 1 - down, 2 - up
+    uint8_t tramline;               // bit 0: right, bit 1: left
+    uint8_t geoStop;
+    uint8_t reserved;
+    uint8_t sec1to8;
+    uint8_t sec9to16;
+    uint8_t crc;
+  };
+
+  static_assert(sizeof(SectionDataPgn) == 16, "64 Section Data PGN is 16 bytes");
+  static_assert(sizeof(SectionDimsPgn) == 39, "Section Dimensions PGN is 39 bytes");
+  static_assert(sizeof(PinConfigPgn) == 30, "Machine Pin Config PGN is 30 bytes");
+  static_assert(sizeof(MachineConfigPgn) == 14, "Machine Config PGN is 14 bytes");
+  static_assert(sizeof(MachineDataPgn) == 14, "Machine Data PGN is 14 bytes");
+  static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "PGN views need a little endian CPU");
+
+
+  // all machine PGNs are between 0xE5 (229) and 0xEF (239) so the PGN number can index straight into the dispatch table
+  static const uint8_t PGN_TABLE_FIRST = 229;
+  static const uint8_t PGN_TABLE_SIZE = 11;
+
+  bool checkCRC = true;             // drop machine PGNs with a bad CRC before they change any states/config
+
+  struct PgnCounters {
+    uint16_t accepted;      // 16 bit to save RAM on the Nano, wraps after ~1.8 hrs at 10hz
+    uint16_t badLength;
+    uint16_t badCRC;
+  };
+  PgnCounters pgnCounters[PGN_TABLE_SIZE];    // indexed the same as the dispatch table, see getPgnEntry()
+  uint16_t unknownPgns;                       // AOG PGNs that aren't machine PGNs
+
   bool parsePGN(uint8_t *pgnData, uint8_t len)
   {
+    CYCLE_BENCH_SCOPE(CycleBench::PARSE_PGN);
+    if (outputScheduler.isRunning()) eventUs = micros();
     if (len < 5) return false;
-    // should check CRC here too???
     if (pgnData[0] != 0x80 || pgnData[1] != 0x81 || pgnData[2] != 0x7F) return false;    // skip the rest if the first three bytes are NOT AoG headers
 
+    // one table lookup by PGN number instead of checking every PGN number & length in turn
+    PgnEntry entry;
+    if (!getPgnEntry(pgnData[3], entry)) {
+      unknownPgns++;
+      return false;   // no matching PGN, return false for further PGN processing
+    }
 
-    if (pgnData[3] == 229 && len == 16)                    // 0xE5 (229) - 64 Section Data, len: 16
-    {                                                      // use this instead of relayLo/Hi from other PGNs because it works for zones/groups too
-      
-      if (debugLevel > 3) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
-      if (debugLevel > 3) Serial.print("64 Section Data");
+    PgnCounters& counters = pgnCounters[pgnData[3] - PGN_TABLE_FIRST];
+    if (entry.len != len) {
+      counters.badLength++;
+      return false;
+    }
+    if (checkCRC && pgnData[len - 1] != calculateCRC(pgnData, len)) {
+      counters.badCRC++;
+      if (debugLevel > 0) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - Bad CRC, dropped"); }
+      return true;    // it is a machine PGN, just a corrupt one, nothing else should use it either
+    }
+    counters.accepted++;
 
-      if (debugLevel > 3) Serial.println();
-      for (uint8_t j = 0; j < 8; j++) {
-        if (debugLevel > 3){ Serial.print(j + 1); Serial.print(":"); }
-        for (uint8_t i = 0; i < 8; i++) {
-          states.sections[1 + i + j * 8] = bitRead(pgnData[5 + j], i);
-          if (debugLevel > 3) Serial.print(states.sections[1 + i + j * 8]);
-        }
-        if (debugLevel > 3) Serial.print(" ");
-      }
+    (this->*entry.handler)(pgnData, len);
+    return true;
+  }
 
-      if (debugLevel > 3) Serial.println(); 
-      updateStates();
-      return true;
-    }
+  typedef void (MACHINE::*PgnHandler)(uint8_t*, uint8_t);
 
+  struct PgnEntry {
+    uint8_t len;              // expected length of the whole PGN, incl header & CRC
+    PgnHandler handler;       // NULL if this PGN isn't handled by the Machine class
+  };
 
-    else if (pgnData[3] == 235 && len == 39)               // 0xEB (235) - Section Dimensions, len: 39
-    {
-      if (debugLevel > 2) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
-      if (debugLevel > 2) Serial.print("Section Dimensions");
-      
-      // parse section dims here
-      
-      if (debugLevel > 2) Serial.println(); 
-      return true;
-    }
+  static bool getPgnEntry(uint8_t pgn, PgnEntry& entry)
+  {
+    static const PgnEntry pgnTable[PGN_TABLE_SIZE] PROGMEM = {    // PROGMEM keeps the table out of RAM on the Nano
+      { sizeof(SectionDataPgn), &MACHINE::parseSectionData },     // 0xE5 (229) - 64 Section Data
+      { 0, NULL }, { 0, NULL }, { 0, NULL }, { 0, NULL }, { 0, NULL },  // 230 - 234
+      { sizeof(SectionDimsPgn), &MACHINE::parseSectionDims },     // 0xEB (235) - Section Dimensions
+      { sizeof(PinConfigPgn), &MACHINE::parsePinConfig },         // 0xEC (236) - Machine Pin Config
+      { 0, NULL },                                                // 0xED (237) - From Machine
+      { sizeof(MachineConfigPgn), &MACHINE::parseMachineConfig }, // 0xEE (238) - Machine Config
+      { sizeof(MachineDataPgn), &MACHINE::parseMachineData }      // 0xEF (239) - Machine Data
+    };
+
+    uint8_t index = pgn - PGN_TABLE_FIRST;          // PGNs below the table wrap around to > PGN_TABLE_SIZE
+    if (index >= PGN_TABLE_SIZE) return false;
+    memcpy_P(&entry, &pgnTable[index], sizeof(entry));
+    return entry.handler != NULL;
+  }
 
 
-    else if (pgnData[3] == 236 && len == 30)               // 0xEC (236) - Machine Pin Config, len: 30
-    {
-      if (debugLevel > 2) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
-      if (debugLevel > 2) Serial.print("Machine Pin Config");
-      for (uint8_t i = 5; i < min(len - 1, uint8_t(sizeof(config.pinFunction) + 5)); i++) {
-        config.pinFunction[i - 4] = pgnData[i];
+  // use this instead of relayLo/Hi from other PGNs because it works for zones/groups too
+  void parseSectionData(uint8_t *pgnData, uint8_t len)   // 0xE5 (229) - 64 Section Data, len: 16
+  {
+    (void)len;
+    if (debugLevel > 3) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
+    if (debugLevel > 3) Serial.print("64 Section Data");
+
+    uint32_t rxUs = (isPacketStamped ? packetUs : micros());
+    isPacketStamped = false;
+    isOutputWritten = false;
+
+    const SectionDataPgn* pgn = (const SectionDataPgn*)pgnData;
+    states.sections.allSections = pgn->sections;      // read all 8 bytes of section state data at once
+    states.toolLeftSpeed = pgn->leftSpeed;
+    states.toolRightSpeed = pgn->rightSpeed;
+    sectionTiming.command(uint32_t(states.sections.allSections), millis(), states.gpsSpeed, states.toolLeftSpeed, states.toolRightSpeed);    // the outputs get sectionTiming.outputs
+
+    if (debugLevel > 3) {
+      Serial.println();
+      for (uint8_t j = 0; j < 8; j++) {
+        Serial.print(j + 1); Serial.print(":");
+        printBinaryByteLSB(states.sections.groupsofeight[j], 8);
+        Serial.print(" ");
       }
-      if (debugLevel > 2) printPinConfig();
-      saveToEeprom();
-      forceOutputUpdate = true;
+    }
+
+    if (debugLevel > 3) Serial.println(); 
+    updateStates();
+    if (isOutputWritten) sectionLatency.record(outputWriteUs - rxUs);   // only frames that changed an output, compensated edges go out later
+    commsWatchdog.arrived(COMMS_SECTION_DATA, millis());
+  }
+
 
-      if (debugLevel > 2) Serial.println();
-      return true;
+  void parseSectionDims(uint8_t *pgnData, uint8_t len)   // 0xEB (235) - Section Dimensions, len: 39
+  {
+    (void)len;
+    if (debugLevel > 2) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
+    if (debugLevel > 2) Serial.print("Section Dimensions");
+    
+    const SectionDimsPgn* pgn = (const SectionDimsPgn*)pgnData;
+    uint8_t numSections = min(pgn->numSections, (uint8_t)16);     // the PGN only has room for 16 widths
+    if (numSections != config.numSections || memcmp(config.sectionWidth, pgn->sectionWidth, sizeof(config.sectionWidth))) {
+      config.numSections = numSections;
+      memcpy(config.sectionWidth, pgn->sectionWidth, sizeof(config.sectionWidth));
+      updateSectionGeometry();
+      saveToEeprom();             // only when something changed
     }
+    if (debugLevel > 2) printSectionGeometry();
+    
+    if (debugLevel > 2) Serial.println(); 
+  }
 
 
-    else if (pgnData[3] == 238 && len == 14)                // 0xEE (238) - Machine Config, len: 14
-    {
-      if (debugLevel > 2) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
-      if (debugLevel > 2) Serial.print("Machine Config");
-      config.raiseTime = pgnData[5];
-      config.lowerTime = pgnData[6];
-      //config.hydLiftEnable = pgnData[7];    // not used?
-
-      uint8_t set0 = pgnData[8];  // setting0
-                                  // bit 0: relayActiveHigh
-                                  // bit 1: hydLiftEnable
-      config.isPinActiveHigh = bitRead(set0, 0) ? 1 : 0;
-      config.hydLiftEnable   = bitRead(set0, 1) ? 1 : 0;
-
-      config.user1 = pgnData[9];
-      config.user2 = pgnData[10];
-      config.user3 = pgnData[11];
-      config.user4 = pgnData[12];
-
-      //Serial << "\r\n- set0: " << set0 << " " << (bitRead(set0, 3) ? 1 : 0) << (bitRead(set0, 2) ? 1 : 0) << (bitRead(set0, 1) ? 1 : 0) << (bitRead(set0, 0) ? 1 : 0);
-      if (debugLevel > 2) printConfig();
+  void parsePinConfig(uint8_t *pgnData, uint8_t len)   // 0xEC (236) - Machine Pin Config, len: 30
+  {
+    (void)len;
+    if (debugLevel > 2) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
+    if (debugLevel > 2) Serial.print("Machine Pin Config");
+    const PinConfigPgn* pgn = (const PinConfigPgn*)pgnData;
+    static_assert(sizeof(config.pinFunction) == 1 + sizeof(pgn->pinFunction), "pinFunction[0] is not used");
+    if (memcmp(&config.pinFunction[1], pgn->pinFunction, sizeof(pgn->pinFunction))) {    // AOG repeats the config, only act on a change
+      memcpy(&config.pinFunction[1], pgn->pinFunction, sizeof(pgn->pinFunction));      // all 24 pin functions in one copy
+      compilePinMap();
       saveToEeprom();
-      forceOutputUpdate = true;
-      //rebootFunc();    // from old code, is there any reason to reboot?
-
-      if (debugLevel > 2) Serial.println();
-      return true;
     }
+    if (debugLevel > 2) printPinConfig();
 
+    if (debugLevel > 2) Serial.println();
+  }
 
-    else if (pgnData[3] == 239 && len == 14)                // 0xEF (239) - Machine Data, len: 14
-    {
-      if (debugLevel > 3) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
-      if (debugLevel > 3) Serial.print("Machine Data");
-      
-      states.uTurn = pgnData[5];
-
-      //gpsSpeed = (float)pgnData[6] * 0.1;     // gpsSpeed is 10x actual speed
-      states.gpsSpeed = pgnData[6];
-      //speedPulseUpdate();
-
-      states.hydLift = pgnData[7];
-      states.tramline = pgnData[8];  // bit 0 is right bit 1 is left
-      states.geoStop = (pgnData[9] > 0 ? 1 : 0);
-
-      //relayLo = pgnData[11];  // use 64 Sections PGN data instead
-      //relayHi = pgnData[12];
-
-      if (debugLevel > 4) {
-        Serial.print("\r\nuTurn: "); Serial.print(states.uTurn);
-        Serial.print("\r\ngpsSpeed: "); Serial.print(pgnData[6]); Serial.print(" > "); Serial.print(states.gpsSpeed);
-        Serial.print("\r\nhydLift(1:D 2:U): "); Serial.print(states.hydLift); Serial.print((states.hydLift == 1 ? ":DOWN" : states.hydLift == 2 ? ":UP" : ":OFF"));
-        Serial.print("\r\ntramline(1:R 2:L): "); Serial.print(states.tramline); Serial.print((states.tramline == 1 ? ":RIGHT" : states.tramline == 2 ? ":LEFT" : ":OFF"));
-        Serial.print("\r\ngeoStop(0:OK 1:STOP): "); Serial.print(states.geoStop); Serial.print((states.geoStop == 1 ? ":STOP!!!" : ":GOOD"));
-        Serial.print("\r\nsec 1-8: "); printBinaryByteLSB(pgnData[11], 8);
-        Serial.print(" sec 9-16: "); printBinaryByteLSB(pgnData[12], 8);
-      } else if (debugLevel > 3) {
-        Serial.print("\r\n0:"); printBinaryByteLSB(pgnData[11], 8);
-        Serial.print(" 1:"); printBinaryByteLSB(pgnData[12], 8);
-      }
 
-      //updateStates();   // 64 Section PGN comes after Machine Data, so states/outputs are updated there
-      if (debugLevel > 3) Serial.println();
-      return true;
-    }
+  void parseMachineConfig(uint8_t *pgnData, uint8_t len)   // 0xEE (238) - Machine Config, len: 14
+  {
+    (void)len;
+    if (debugLevel > 2) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
+    if (debugLevel > 2) Serial.print("Machine Config");
+    const MachineConfigPgn* pgn = (const MachineConfigPgn*)pgnData;
+    config.raiseTime = pgn->raiseTime;
+    config.lowerTime = pgn->lowerTime;
+    //config.hydLiftEnable = pgn->hydLiftEnable;    // not used?
+
+    uint8_t set0 = pgn->set0;   // setting0
+                                // bit 0: relayActiveHigh
+                                // bit 1: hydLiftEnable
+    uint8_t wasPinActiveHigh = config.isPinActiveHigh;
+    config.isPinActiveHigh = bitRead(set0, 0) ? 1 : 0;
+    config.hydLiftEnable   = bitRead(set0, 1) ? 1 : 0;
+    if (config.isPinActiveHigh != wasPinActiveHigh) compilePinMap();
+
+    config.user1 = pgn->user[0];
+    config.user2 = pgn->user[1];
+    config.user3 = pgn->user[2];
+    config.user4 = pgn->user[3];
+
+    //Serial << "\r\n- set0: " << set0 << " " << (bitRead(set0, 3) ? 1 : 0) << (bitRead(set0, 2) ? 1 : 0) << (bitRead(set0, 1) ? 1 : 0) << (bitRead(set0, 0) ? 1 : 0);
+    if (debugLevel > 2) printConfig();
+    saveToEeprom();
+    //rebootFunc();    // from old code, is there any reason to reboot?
+
+    if (debugLevel > 2) Serial.println();
+  }
 
-    else
-    {
-      return false;   // no matching PGN, return false for further PGN processing
+
+  void parseMachineData(uint8_t *pgnData, uint8_t len)   // 0xEF (239) - Machine Data, len: 14
+  {
+    (void)len;
+    if (debugLevel > 3) { Serial.print("\r\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - "); }
+    if (debugLevel > 3) Serial.print("Machine Data");
+    
+    const MachineDataPgn* pgn = (const MachineDataPgn*)pgnData;
+    states.uTurn = pgn->uTurn;
+
+    //gpsSpeed = (float)pgn->gpsSpeed * 0.1;     // gpsSpeed is 10x actual speed
+    states.gpsSpeed = pgn->gpsSpeed;
+    speedPulse.setSpeed(states.gpsSpeed);       // nothing if it's not running or the speed didn't change
+
+    states.hydLift = pgn->hydLift;
+    states.tramline = pgn->tramline;  // bit 0 is right bit 1 is left
+    states.geoStop = (pgn->geoStop > 0 ? 1 : 0);
+
+    //relayLo = pgn->sec1to8;  // use 64 Sections PGN data instead
+    //relayHi = pgn->sec9to16;
+
+    if (debugLevel > 4) {
+      Serial.print("\r\nuTurn: "); Serial.print(states.uTurn);
+      Serial.print("\r\ngpsSpeed: "); Serial.print(pgn->gpsSpeed); Serial.print(" > "); Serial.print(states.gpsSpeed);
+      Serial.print("\r\nhydLift(1:D 2:U): "); Serial.print(states.hydLift); Serial.print((states.hydLift == 1 ? ":DOWN" : states.hydLift == 2 ? ":UP" : ":OFF"));
+      Serial.print("\r\ntramline(1:R 2:L): "); Serial.print(states.tramline); Serial.print((states.tramline == 1 ? ":RIGHT" : states.tramline == 2 ? ":LEFT" : ":OFF"));
+      Serial.print("\r\ngeoStop(0:OK 1:STOP): "); Serial.print(states.geoStop); Serial.print((states.geoStop == 1 ? ":STOP!!!" : ":GOOD"));
+      Serial.print("\r\nsec 1-8: "); printBinaryByteLSB(pgn->sec1to8, 8);
+      Serial.print(" sec 9-16: "); printBinaryByteLSB(pgn->sec9to16, 8);
+    } else if (debugLevel > 3) {
+      Serial.print("\r\n0:"); printBinaryByteLSB(pgn->sec1to8, 8);
+      Serial.print(" 1:"); printBinaryByteLSB(pgn->sec9to16, 8);
     }
 
-    return false;     // should never reach this
+    //updateStates();   // 64 Section PGN comes after Machine Data, so states/outputs are updated there
+    if (debugLevel > 3) Serial.println();
   }
 
 
   // ***************************************************************************************************************************************************
   // ****************************************************** OTHER FUNCTIONS*****************************************************************************
   // ***************************************************************************************************************************************************
+  int8_t getSectionState(byte secNum)
+  {
+    if (secNum > 63) return -1;
+    return bitRead(states.sections.allSections, secNum);
+  }
+
+  // funcNum 1-21, see functionNames[]
+  bool getFunctionState(uint8_t funcNum)
+  {
+    return bitRead(states.functions, funcNum);
+  }
+
+  // rebuilds pinMap, only needed when config.pinFunction or config.isPinActiveHigh change
+  void compilePinMap()
+  {
+    for (uint8_t i = 0; i < 24; i++) {
+      uint8_t function = config.pinFunction[1 + i];
+      pinMap.functionBit[i] = (function <= 21 ? function : 0);    // unknown function numbers stay OFF
+    }
+    pinMap.invertMask = (config.isPinActiveHigh ? 0 : 0x00FFFFFF);
+    pinMap.sectionMask = (1UL << numOutputPins) - 1;    // 24 pins max
+    pinMap.sectionInvertMask = (config.isPinActiveHigh ? 0 : pinMap.sectionMask);
+    forceOutputUpdate = true;       // write every pin once with the new map
+  }
+
+  // output levels of pins 1-24 (bit 0 is pin 1) for the current states.functions
+  uint32_t gatherPinLevels()
+  {
+    const uint8_t* functionBytes = (const uint8_t*)&states.functions;   // byte at a time, 32 bit shifts by a variable are slow loops on AVR
+    uint32_t levels = 0, pinBit = 1;
+    for (uint8_t i = 0; i < 24; i++, pinBit <<= 1) {
+      uint8_t bit = pinMap.functionBit[i];
+      if (functionBytes[bit >> 3] & (1 << (bit & 7))) levels |= pinBit;
+    }
+    return levels ^ pinMap.invertMask;
+  }
+
+  // secNum 0 is section 1, only the first 16 sections have dimensions
+  uint16_t getSectionWidth(byte secNum)
+  {
+    return (secNum < config.numSections) ? config.sectionWidth[secNum] : 0;
+  }
+
+  int16_t getSectionOffset(byte secNum)
+  {
+    return (secNum < config.numSections) ? sectionGeometry.offset[secNum] : 0;
+  }
+
+  void updateSectionGeometry()
+  {
+    uint16_t totalWidth = 0;
+    for (uint8_t i = 0; i < config.numSections; i++) totalWidth += config.sectionWidth[i];
+    sectionGeometry.totalWidth = totalWidth;
+
+    int16_t leftEdge = -(int16_t)(totalWidth / 2);      // of section 1
+    for (uint8_t i = 0; i < 16; i++) {
+      if (i < config.numSections) {
+        sectionGeometry.offset[i] = leftEdge + config.sectionWidth[i] / 2;
+        leftEdge += config.sectionWidth[i];
+      } else {
+        sectionGeometry.offset[i] = 0;
+      }
+    }
+    sectionTiming.setGeometry(sectionGeometry.offset, config.numSections, totalWidth);
+  }
+
   void loadFromEeprom()
   {
     if (eeLoadedAtStartup) return;
@@ -476,6 +822,7 @@ public:
       EEPROM.get(eeAddr + 2, config);
       Serial.print("\r\n\nMachine config loaded from EEPROM");
     }
+    updateSectionGeometry();
     printConfig();
     printPinConfig();
     eeLoadedAtStartup = true;
@@ -502,6 +849,17 @@ public:
     }
   }
 
+  void printSectionGeometry()
+  {
+    Serial.print("\r\n- sections: "); Serial.print(config.numSections);
+    Serial.print(", total width: "); Serial.print(sectionGeometry.totalWidth); Serial.print("cm");
+    for (uint8_t i = 0; i < config.numSections; i++) {
+      Serial.print("\r\n- Section "); Serial.print(i + 1);
+      Serial.print(" width: "); Serial.print(config.sectionWidth[i]);
+      Serial.print(" offset: "); Serial.print(sectionGeometry.offset[i]);
+    }
+  }
+
   void printPinConfig()
   {
     if (debugLevel > 1) {
@@ -527,12 +885,107 @@ public:
 
   void calculateAndSetCRC(uint8_t myMessage[], uint8_t myLen) {
     if (myLen <= 2 ) return;
+    myMessage[myLen - 1] = calculateCRC(myMessage, myLen);
+  }
+
+  // AOG CRC is the low byte of the sum of all bytes after 0x80 0x81, up to (not incl) the CRC byte
+  static uint8_t calculateCRC(const uint8_t* myMessage, uint8_t myLen) {
+    if (myLen <= 2) return 0;
+
+    const uint8_t* data = myMessage + 2;
+    uint8_t count = myLen - 3;
+  #if defined(__AVR__)
+    uint8_t sum = 0;                // 8 bit AVR loads a byte at a time anyways
+  #else
+    uint32_t sum = 0;
+    // sum 4 bytes per load, every 2nd byte goes into its own 16 bit lane so carries never cross into the next byte
+    while (count >= 4) {
+      uint32_t word;
+      memcpy(&word, data, 4);       // data isn't word aligned, memcpy lets the compiler pick the fastest safe load
+      sum += (word & 0x00FF00FF) + ((word >> 8) & 0x00FF00FF);
+      data += 4;
+      count -= 4;
+    }
+    sum += sum >> 16;               // add the two lanes together, only the low byte matters
+  #endif
+    while (count--) sum += *data++; // last 0-3 bytes (or all of them on AVR)
+    return (uint8_t)sum;
+  }
+
+  // Hello & Scan replies are kept ready to send, get*Reply() updates them and they're sent as is, sizeof() bytes
+  uint8_t helloReply[11] = { 0x80, 0x81, 123, 123, 5, 0, 0, 0, 0, 0, 0xFB };        // 0x7B (123) - Hello from Machine: relayLo, relayHi, 0, 0, 0
+  uint8_t scanReply[13] = { 0x80, 0x81, 123, 203, 7, 0, 0, 0, 0, 0, 0, 0, 0x4D };   // 0xCB (203) - Scan Reply: module IP, AgIO subnet
+
+  // the reply frames are only patched where a byte changed, the CRC is adjusted by the same difference
+  // (AOG CRC is a plain 8 bit sum) so it never has to be summed again
+  static void setReplyByte(uint8_t* frame, uint8_t len, uint8_t index, uint8_t value) {
+    if (frame[index] == value) return;
+    frame[len - 1] += uint8_t(value - frame[index]);
+    frame[index] = value;
+  }
+
+  // Hello reply with the current section states 1-16
+  const uint8_t* getHelloReply() {
+    setReplyByte(helloReply, sizeof(helloReply), 5, states.sections.groupsofeight[0]);   // relayLo
+    setReplyByte(helloReply, sizeof(helloReply), 6, states.sections.groupsofeight[1]);   // relayHi
+    return helloReply;
+  }
+
+  // Scan reply with this module's IP and the subnet the request came from, IP can be IPAddress or a byte array
+  template <typename IP1, typename IP2>
+  const uint8_t* getScanReply(const IP1& moduleIP, const IP2& agioIP) {
+    for (uint8_t i = 0; i < 4; i++) setReplyByte(scanReply, sizeof(scanReply), 5 + i, moduleIP[i]);
+    for (uint8_t i = 0; i < 3; i++) setReplyByte(scanReply, sizeof(scanReply), 9 + i, agioIP[i]);
+    return scanReply;
+  }
+
+  // call from the UDP receive callback with micros() when the packet came in, before it's parsed
+  // so sectionLatency includes the time in the network stack & PGN routing, without it the time starts at parseSectionData()
+  void stampPacket(uint32_t us)
+  {
+    packetUs = us;
+    isPacketStamped = true;
+  }
 
-    uint8_t crc = 0;
-    for (byte i = 2; i < myLen - 1; i++) {
-      crc = (crc + myMessage[i]);
+  // micros() time an output write goes out (now, or on a scheduler tick), the last one in a 64 Section Data is the sample
+  void outputWritten(uint32_t us)
+  {
+    if (isOutputWritten && int32_t(us - outputWriteUs) < 0) return;
+    outputWriteUs = us;
+    isOutputWritten = true;
+  }
+
+  // Latency reply to LATENCY_PGN: samples, p50, p99, max (us), each uint32 LSB first
+  static const uint8_t LATENCY_PGN = 0xD1;    // 209, the request has 1 data byte, bit 0 resets sectionLatency after the reply
+  uint8_t latencyReply[22] = { 0x80, 0x81, 123, LATENCY_PGN, 16 };
+
+  const uint8_t* getLatencyReply() {
+    uint32_t values[4] = { sectionLatency.count, sectionLatency.percentile(50), sectionLatency.percentile(99), sectionLatency.maxUs };
+    memcpy(&latencyReply[5], values, sizeof(values));     // all three boards are little endian
+    latencyReply[sizeof(latencyReply) - 1] = calculateCRC(latencyReply, sizeof(latencyReply));
+    return latencyReply;
+  }
+
+  void printSectionLatency() { sectionLatency.print("64 Section Data to outputs"); }
+
+  void printPgnCounters()
+  {
+    Serial.print("\r\nMachine PGN counters (accepted, bad len, bad CRC)");
+    PgnEntry entry;
+    for (uint8_t i = 0; i < PGN_TABLE_SIZE; i++) {
+      if (!getPgnEntry(PGN_TABLE_FIRST + i, entry)) continue;
+      Serial.print("\r\n- "); Serial.print(PGN_TABLE_FIRST + i); Serial.print(": ");
+      Serial.print(pgnCounters[i].accepted); Serial.print(", ");
+      Serial.print(pgnCounters[i].badLength); Serial.print(", ");
+      Serial.print(pgnCounters[i].badCRC);
     }
-    myMessage[myLen - 1] = crc;
+    Serial.print("\r\n- not machine PGNs: "); Serial.print(unknownPgns);
+  }
+
+  void resetPgnCounters()
+  {
+    memset(pgnCounters, 0, sizeof(pgnCounters));
+    unknownPgns = 0;
   }
 
 
@@ -0,0 +1,166 @@
+/*
+  Writes a group of output pins with one register write per hardware port instead of a digitalWrite() per pin
+    - begin() looks up the port & bit of each pin once, write() then only ORs bits together and writes each port once
+    - all the pins on a port switch at the same instant
+      - Nano (AVR): one read-modify-write of PORTx (interrupts off for those few cycles, like digitalWrite() does)
+      - Teensy 4.x: GPIOx_DR_SET & GPIOx_DR_CLEAR
+      - ESP32: GPIO_OUT_W1TS & GPIO_OUT_W1TC (GPIO_OUT1_* for pins 32+)
+      - Host_Bench: mock ports in stub/Arduino.h, 8 pins per port, that count the register writes
+    - anything else falls back to digitalWrite() for each changed pin
+    - the pins need to be set to OUTPUT (pinMode) before begin()
+
+  Example:
+    OutputPorts<8> outputPorts;
+    outputPorts.begin(outputPins, 8);
+    outputPorts.write(levels, changed);     // bit 0 is outputPins[0], only the changed pins are written
+
+    OutputPorts<64, 4, uint64_t> outputPorts;   // more then 32 pins needs a 64 bit levels/changed
+*/
+
+#ifndef OUTPUTPORTS_H
+#define OUTPUTPORTS_H
+
+#include <stdint.h>
+
+#if defined(__AVR__)
+  #define OUTPUT_PORTS_RMW                          // no set/clear registers, read-modify-write PORTx
+  typedef uint8_t PortMask;
+  typedef volatile uint8_t* PortRegister;
+#elif defined(__IMXRT1062__) || defined(ESP32)
+  #if defined(ESP32)
+    #include "soc/gpio_reg.h"
+    #include "soc/soc_caps.h"
+  #endif
+  typedef uint32_t PortMask;
+  typedef volatile uint32_t* PortRegister;
+#elif defined(HOST_GPIO_PORTS)                      // Host_Bench/stub/Arduino.h
+  typedef uint32_t PortMask;
+  typedef HostPortRegister* PortRegister;
+#else
+  #define OUTPUT_PORTS_DIGITALWRITE                 // no port access, one digitalWrite() per pin
+  typedef uint32_t PortMask;
+  typedef uint8_t* PortRegister;
+#endif
+
+template <uint8_t MAX_PINS, uint8_t MAX_PORTS = 4, typename Bits = uint32_t>
+class OutputPorts
+{
+public:
+  uint8_t numPins = 0;
+  uint8_t numPorts = 0;
+
+  // false if there are more then MAX_PINS pins (the extra pins aren't written at all)
+  // or they're on more then MAX_PORTS ports (the pins that didn't fit are written with digitalWrite())
+  bool begin(const uint8_t* _pins, uint8_t _numPins)
+  {
+    numPins = (_numPins < MAX_PINS ? _numPins : MAX_PINS);
+    numPorts = 0;
+    bool allFit = (_numPins <= MAX_PINS);
+
+    for (uint8_t i = 0; i < numPins; i++) {
+      pins[i].pin = _pins[i];
+      pins[i].port = NO_PORT;
+#ifndef OUTPUT_PORTS_DIGITALWRITE
+      PortRegister setReg, clearReg;
+      PortMask bit;
+      lookup(_pins[i], setReg, clearReg, bit);
+
+      uint8_t p = 0;
+      while (p < numPorts && ports[p].setReg != setReg) p++;
+      if (p == numPorts) {
+        if (numPorts == MAX_PORTS) { allFit = false; continue; }
+        ports[p].setReg = setReg;
+        ports[p].clearReg = clearReg;
+        numPorts++;
+      }
+      pins[i].port = p;
+      pins[i].bit = bit;
+#endif
+    }
+    return allFit;
+  }
+
+  // levels & changed: bit 0 is the first pin given to begin(), only pins with a changed bit are written
+  void write(Bits levels, Bits changed)
+  {
+    for (uint8_t p = 0; p < numPorts; p++) {
+      ports[p].setBits = 0;
+      ports[p].clearBits = 0;
+    }
+
+    Bits pinBit = 1;
+    for (uint8_t i = 0; i < numPins; i++, pinBit <<= 1) {
+      if (!(changed & pinBit)) continue;
+      if (pins[i].port == NO_PORT) {
+        digitalWrite(pins[i].pin, (levels & pinBit) ? HIGH : LOW);
+      } else if (levels & pinBit) {
+        ports[pins[i].port].setBits |= pins[i].bit;
+      } else {
+        ports[pins[i].port].clearBits |= pins[i].bit;
+      }
+    }
+
+    for (uint8_t p = 0; p < numPorts; p++) {
+      Port& port = ports[p];
+#ifdef OUTPUT_PORTS_RMW
+      if (port.setBits | port.clearBits) {
+        uint8_t oldSREG = SREG;
+        cli();
+        *port.setReg = (*port.setReg & ~port.clearBits) | port.setBits;
+        SREG = oldSREG;
+      }
+#else
+      if (port.setBits) *port.setReg = port.setBits;
+      if (port.clearBits) *port.clearReg = port.clearBits;
+#endif
+    }
+  }
+
+private:
+  static const uint8_t NO_PORT = 0xFF;
+
+  struct Port {
+    PortRegister setReg;        // AVR: PORTx
+    PortRegister clearReg;      // AVR: PORTx too
+    PortMask setBits;           // built by write()
+    PortMask clearBits;
+  } ports[MAX_PORTS];
+
+  struct Pin {
+    uint8_t pin;
+    uint8_t port;               // index in ports[], NO_PORT for digitalWrite()
+    PortMask bit;
+  } pins[MAX_PINS];
+
+#ifndef OUTPUT_PORTS_DIGITALWRITE
+  static void lookup(uint8_t pin, PortRegister& setReg, PortRegister& clearReg, PortMask& bit)
+  {
+  #if defined(__AVR__)
+    setReg = clearReg = portOutputRegister(digitalPinToPort(pin));
+    bit = digitalPinToBitMask(pin);
+  #elif defined(__IMXRT1062__)
+    setReg = portSetRegister(pin);
+    clearReg = portClearRegister(pin);
+    bit = digitalPinToBitMask(pin);
+  #elif defined(ESP32)
+    #if SOC_GPIO_PIN_COUNT > 32
+    if (pin >= 32) {
+      setReg = (PortRegister)GPIO_OUT1_W1TS_REG;
+      clearReg = (PortRegister)GPIO_OUT1_W1TC_REG;
+      bit = 1UL << (pin - 32);
+      return;
+    }
+    #endif
+    setReg = (PortRegister)GPIO_OUT_W1TS_REG;
+    clearReg = (PortRegister)GPIO_OUT_W1TC_REG;
+    bit = 1UL << pin;
+  #else
+    setReg = hostPortSetRegister(pin);
+    clearReg = hostPortClearRegister(pin);
+    bit = hostPinBitMask(pin);
+  #endif
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,261 @@
+/*
+  Writes output states at set times from a hardware timer interrupt, instead of straight from the PGN parsing
+    - write() queues levels/changed with the micros() time they should go out, the timer tick writes them with OutputPorts
+      so outputs change on a tick a fixed time after the PGN came in, no matter how long parsing, Serial prints or the network took
+      - jitter is one tick (tickUs), as long as the latency given to write() covers the slowest PGN parse
+    - TimingWheel is the queue, there's no hardware in it so it runs on the host too (Host_Bench)
+      - SLOTS buckets of one tick each, an event goes in bucket dueTick % SLOTS and a tick only looks at its own bucket
+      - events more then SLOTS ticks ahead wait in their bucket until the wheel comes round to them
+      - full: the event is merged into the last one queued, it goes out a little early but nothing is lost or out of order
+    - Teensy 4.x: IntervalTimer
+    - ESP32: periodic esp_timer (runs in the esp_timer task, so the jitter is a bit more then a tick)
+    - Nano: Timer1 compare A, only with #define OUTPUT_SCHEDULER_TIMER1 before including this (before machine.h in the sketch)
+      - without it the Timer1 ISR isn't compiled in, so Servo, tone() etc can have Timer1, and begin() returns false
+      - with it Timer1 can't be used for anything else (pins 9/10 analogWrite()) once begin() is called
+    - Host_Bench: no timer, poll() runs the ticks that are due in HostClock time
+    - anything else: begin() returns false and write() does nothing, the caller writes the outputs itself
+    - one OutputScheduler at a time, the timer interrupt needs a static instance
+
+  Example:
+    OutputScheduler<OutputPorts<8>> outputScheduler;
+    outputScheduler.begin(&outputPorts, 250);                      // 250us ticks
+    if (!outputScheduler.write(levels, changed, pgnTimeUs + 2000)) outputPorts.write(levels, changed);
+*/
+
+#ifndef OUTPUTSCHEDULER_H
+#define OUTPUTSCHEDULER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__IMXRT1062__)
+  #include <IntervalTimer.h>
+#elif defined(ESP32)
+  #include "esp_timer.h"
+#elif defined(__AVR__) && defined(OUTPUT_SCHEDULER_TIMER1)
+  // the AVR vector can't be a template member, it calls whichever OutputScheduler began last
+  inline void (*&timer1Isr())() { static void (*isr)() = NULL; return isr; }
+#endif
+
+template <uint8_t SLOTS = 16, uint8_t MAX_EVENTS = 8, typename Bits = uint32_t>
+class TimingWheel
+{
+public:
+  uint32_t merged = 0;          // events merged into the last one queued because the queue was full
+
+  // empties the wheel, nowTick is the last tick that's been run
+  void reset(uint32_t nowTick)
+  {
+    for (uint8_t s = 0; s < SLOTS; s++) head[s] = tail[s] = NONE;
+    for (uint8_t i = 0; i < MAX_EVENTS; i++) events[i].next = (i + 1 < MAX_EVENTS ? i + 1 : NONE);
+    freeList = 0;
+    last = NONE;
+    nextTick = nowTick + 1;
+  }
+
+  // levels for the changed bits at dueTick, a dueTick that's already been run goes out on the next tick
+  void schedule(uint32_t dueTick, Bits levels, Bits changed)
+  {
+    if (int32_t(dueTick - nextTick) < 0) dueTick = nextTick;
+    if (freeList == NONE) {
+      Event& e = events[last];          // full, so the last one queued is still waiting
+      e.levels = (e.levels & ~changed) | (levels & changed);
+      e.changed |= changed;
+      merged++;
+      return;
+    }
+
+    uint8_t i = freeList;
+    freeList = events[i].next;
+    events[i].dueTick = dueTick;
+    events[i].levels = levels;
+    events[i].changed = changed;
+    events[i].next = NONE;
+
+    uint8_t s = dueTick % SLOTS;
+    if (head[s] == NONE) head[s] = i;
+    else events[tail[s]].next = i;
+    tail[s] = i;
+    last = i;
+  }
+
+  // runs the ticks up to & incl nowTick, levels/changed get every event that came due (in order), false if there weren't any
+  bool advance(uint32_t nowTick, Bits& levels, Bits& changed)
+  {
+    levels = changed = 0;
+    int32_t ticks = int32_t(nowTick - nextTick) + 1;
+    if (ticks <= 0) return false;
+    if (ticks > SLOTS) ticks = SLOTS;   // way behind, once round the wheel picks up everything that's due
+
+    for (; ticks > 0; ticks--, nextTick++) {
+      uint8_t s = nextTick % SLOTS;
+      uint8_t prev = NONE;
+      for (uint8_t i = head[s]; i != NONE; ) {
+        Event& e = events[i];
+        uint8_t next = e.next;
+        if (int32_t(e.dueTick - nowTick) <= 0) {
+          levels = (levels & ~e.changed) | (e.levels & e.changed);
+          changed |= e.changed;
+          if (prev == NONE) head[s] = next;
+          else events[prev].next = next;
+          if (tail[s] == i) tail[s] = prev;
+          e.next = freeList;
+          freeList = i;
+        } else {
+          prev = i;                     // a later trip round the wheel
+        }
+        i = next;
+      }
+    }
+    nextTick = nowTick + 1;
+    return changed != 0;
+  }
+
+  bool isEmpty()
+  {
+    for (uint8_t s = 0; s < SLOTS; s++) if (head[s] != NONE) return false;
+    return true;
+  }
+
+private:
+  static const uint8_t NONE = 0xFF;
+
+  struct Event {
+    uint32_t dueTick;
+    Bits levels;
+    Bits changed;
+    uint8_t next;               // next event in the same bucket, or the free list
+  } events[MAX_EVENTS];
+
+  uint8_t head[SLOTS];          // first event in each bucket
+  uint8_t tail[SLOTS];          // last, new events go on the end so the ones for the same tick stay in order
+  uint8_t freeList;
+  uint8_t last;                 // last event queued
+  uint32_t nextTick;            // next tick to run
+};
+
+
+template <typename Ports, typename Bits = uint32_t, uint8_t SLOTS = 16, uint8_t MAX_EVENTS = 8>
+class OutputScheduler
+{
+public:
+  uint32_t tickUs = 0;          // 0 until begin() works
+  volatile uint32_t tickCount = 0;
+  uint32_t dueUs = 0;           // micros() time the last write() goes out
+  TimingWheel<SLOTS, MAX_EVENTS, Bits> wheel;
+
+  // starts the timer, false if there's no timer for this board
+  bool begin(Ports* _ports, uint32_t _tickUs = 250)
+  {
+    if (tickUs != 0 || _tickUs == 0) return false;    // already running
+    ports = _ports;
+    instance() = this;
+    wheel.reset(tickCount);
+    lastTickUs = micros();
+    tickUs = _tickUs;
+    if (!timerBegin()) {
+      tickUs = 0;
+      return false;
+    }
+    return true;
+  }
+
+  bool isRunning() { return tickUs != 0; }
+
+  // queues levels for the changed outputs (see OutputPorts::write()) to go out on the first tick at or after atUs (micros() time)
+  // false if the scheduler isn't running, the caller has to write them
+  bool write(Bits levels, Bits changed, uint32_t atUs)
+  {
+    if (tickUs == 0) return false;
+    lock();
+    int32_t aheadUs = int32_t(atUs - lastTickUs);
+    uint32_t dueTick = tickCount + (aheadUs <= 0 ? 1 : (uint32_t(aheadUs) + tickUs - 1) / tickUs);
+    wheel.schedule(dueTick, levels, changed);
+    dueUs = lastTickUs + (dueTick - tickCount) * tickUs;
+    unlock();
+    return true;
+  }
+
+  // from the timer interrupt
+  void tick(uint32_t nowUs)
+  {
+    tickCount++;
+    lastTickUs = nowUs;
+    Bits levels, changed;
+    if (wheel.advance(tickCount, levels, changed)) ports->write(levels, changed);
+  }
+
+  // runs the ticks that are due by micros(), for Host_Bench where there's no timer interrupt
+  void poll()
+  {
+    while (tickUs != 0 && uint32_t(micros()) - lastTickUs >= tickUs) tick(lastTickUs + tickUs);
+  }
+
+private:
+  Ports* ports = NULL;
+  volatile uint32_t lastTickUs = 0;
+
+  static OutputScheduler*& instance() { static OutputScheduler* s = NULL; return s; }
+  static void timerIsr() { instance()->tick(micros()); }
+
+#if defined(__IMXRT1062__)
+  // ******************************** Teensy 4.x, IntervalTimer ********************************
+  IntervalTimer timer;
+  bool timerBegin() { return timer.begin(timerIsr, tickUs); }
+  void lock() { noInterrupts(); }
+  void unlock() { interrupts(); }
+
+#elif defined(ESP32)
+  // ******************************** ESP32, esp_timer *****************************************
+  esp_timer_handle_t timer = NULL;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;      // the esp_timer task can be on the other core
+  bool timerBegin()
+  {
+    esp_timer_create_args_t args = {};
+    args.callback = [](void*) { timerIsr(); };
+    args.name = "outputs";
+    if (esp_timer_create(&args, &timer) != ESP_OK) return false;
+    return esp_timer_start_periodic(timer, tickUs) == ESP_OK;
+  }
+  void lock() { portENTER_CRITICAL(&mux); }
+  void unlock() { portEXIT_CRITICAL(&mux); }
+
+#elif defined(__AVR__) && defined(OUTPUT_SCHEDULER_TIMER1)
+  // ******************************** Nano, Timer1 compare A ***********************************
+  uint8_t oldSREG;
+  bool timerBegin()
+  {
+    uint32_t counts = (F_CPU / 8000000UL) * tickUs;     // prescaler 8, 2 counts per us at 16mhz
+    if (counts == 0 || counts > 65536UL) return false;
+    timer1Isr() = timerIsr;
+    uint8_t sreg = SREG;
+    cli();
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12) | _BV(CS11);                     // CTC, TOP is OCR1A
+    TCNT1 = 0;
+    OCR1A = counts - 1;
+    TIMSK1 |= _BV(OCIE1A);
+    SREG = sreg;
+    return true;
+  }
+  void lock() { oldSREG = SREG; cli(); }
+  void unlock() { SREG = oldSREG; }
+
+#elif defined(HOST_GPIO_PORTS)
+  // ******************************** Host_Bench, poll() ***************************************
+  bool timerBegin() { return true; }
+  void lock() {}
+  void unlock() {}
+
+#else
+  bool timerBegin() { return false; }
+  void lock() {}
+  void unlock() {}
+#endif
+};
+
+#if defined(__AVR__) && defined(OUTPUT_SCHEDULER_TIMER1)
+  ISR(TIMER1_COMPA_vect) { if (timer1Isr() != NULL) timer1Isr()(); }
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+/*
+  Compile time list of which function handles which PGN
+    - everything is known at compile time so the compiler inlines the handlers into one chain of compares on the PGN byte
+    - handlers are tried in order, return true if the PGN was used or false to let the next handler try (ie more then one module replying to Hello)
+    - a PgnRouter can be used as a handler in another PgnRouter, and an empty PgnRouter<> costs nothing
+      so optional modules (steer, IMU etc) only add code when they are compiled in
+
+  Example:
+    bool machinePGNs(uint8_t* pgnData, uint8_t len) { return machine.parsePGN(pgnData, len); }
+
+    #ifdef STEER_MODULE
+      typedef PgnRouter< PgnHandler<200, 9, steerHello>, PgnHandler<252, 14, steerSettings> > SteerPGNs;
+    #else
+      typedef PgnRouter<> SteerPGNs;
+    #endif
+
+    typedef PgnRouter<
+      PgnRange<229, 239, machinePGNs>,      // all machine PGNs, MACHINE has its own dispatch table for these
+      PgnHandler<200, 9, helloFromAgIO>,    // Hello from AgIO, must be 9 bytes
+      SteerPGNs,
+      PgnIgnore<254>                        // Steer Data, not used but don't report it as unknown
+    > SketchPGNs;
+
+    if (!SketchPGNs::handle(pgnData, len)) Serial.print("Unknown PGN");
+
+  PgnFilter goes in front of the router to drop PGNs this module doesn't use (ie Steer Data at GPS rate) with one bit test
+    PgnFilter<SketchPGNs, 8> pgnFilter;     // passes the PGNs SketchPGNs handles (not PgnIgnore), 8 per PGN drop counters
+
+    if (!pgnFilter.pass(pgnData[3])) return;
+*/
+
+#ifndef PGNROUTER_H
+#define PGNROUTER_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef bool (*PgnFunction)(uint8_t* pgnData, uint8_t len);
+
+// one PGN, LEN of 0 accepts any length
+template <uint8_t PGN, uint8_t LEN, PgnFunction FUNC>
+struct PgnHandler {
+  static inline bool handle(uint8_t* pgnData, uint8_t len) {
+    if (pgnData[3] != PGN || (LEN != 0 && len != LEN)) return false;
+    return FUNC(pgnData, len);
+  }
+  static void markInteresting(uint8_t* bitmap) { bitmap[PGN >> 3] |= 1 << (PGN & 7); }
+};
+
+// a block of PGNs passed to one function, ie MACHINE::parsePGN() which has its own dispatch table
+template <uint8_t FIRST, uint8_t LAST, PgnFunction FUNC>
+struct PgnRange {
+  static inline bool handle(uint8_t* pgnData, uint8_t len) {
+    if (uint8_t(pgnData[3] - FIRST) > uint8_t(LAST - FIRST)) return false;
+    return FUNC(pgnData, len);
+  }
+  static void markInteresting(uint8_t* bitmap) {
+    for (uint16_t pgn = FIRST; pgn <= LAST; pgn++) bitmap[pgn >> 3] |= 1 << (pgn & 7);
+  }
+};
+
+// PGNs that are sent to every module but not used by this one, so they aren't reported as unknown
+template <uint8_t PGN, uint8_t LEN = 0>
+struct PgnIgnore {
+  static inline bool handle(uint8_t* pgnData, uint8_t len) {
+    return pgnData[3] == PGN && (LEN == 0 || len == LEN);
+  }
+  static void markInteresting(uint8_t* bitmap) {}    // left out so PgnFilter drops them
+};
+
+template <typename... Handlers>
+struct PgnRouter;
+
+template <>
+struct PgnRouter<> {                // nothing to route to, ie a module that isn't compiled in
+  static inline bool handle(uint8_t* pgnData, uint8_t len) { return false; }
+  static void markInteresting(uint8_t* bitmap) {}
+};
+
+template <typename First, typename... Rest>
+struct PgnRouter<First, Rest...> {
+  static inline bool handle(uint8_t* pgnData, uint8_t len) {
+    return First::handle(pgnData, len) || PgnRouter<Rest...>::handle(pgnData, len);
+  }
+  static void markInteresting(uint8_t* bitmap) {
+    First::markInteresting(bitmap);
+    PgnRouter<Rest...>::markInteresting(bitmap);
+  }
+};
+
+
+#if defined(__AVR__)
+  typedef uint16_t PgnDropCount;      // save RAM on the Nano
+#else
+  typedef uint32_t PgnDropCount;
+#endif
+
+// drops PGNs that aren't in the "interesting" bitmap before any other checks, counts the drops by PGN number
+//  - the bitmap starts with the PGNs Router handles, setInteresting()/setAll() can change it at run time
+//  - only the first SLOTS different PGN numbers dropped get their own counter, the rest are added up in otherDrops
+template <typename Router, uint8_t SLOTS>
+class PgnFilter
+{
+public:
+  PgnFilter() {
+    setAll(false);
+    Router::markInteresting(bitmap);
+    resetDrops();
+  }
+
+  inline bool pass(uint8_t pgn) {
+    if (bitmap[pgn >> 3] & (1 << (pgn & 7))) return true;
+    countDrop(pgn);
+    return false;
+  }
+
+  void setInteresting(uint8_t pgn, bool isInteresting) {
+    if (isInteresting) bitmap[pgn >> 3] |= 1 << (pgn & 7);
+    else bitmap[pgn >> 3] &= ~(1 << (pgn & 7));
+  }
+
+  void setAll(bool isInteresting) { memset(bitmap, isInteresting ? 0xFF : 0, sizeof(bitmap)); }
+
+  struct DropCounter {
+    uint8_t pgn;
+    PgnDropCount drops;       // 0 if this slot isn't used yet
+  };
+  DropCounter dropCounters[SLOTS];
+  PgnDropCount otherDrops;    // dropped PGNs that didn't get a slot
+
+  void resetDrops() {
+    memset(dropCounters, 0, sizeof(dropCounters));
+    otherDrops = 0;
+  }
+
+  // works with Serial or anything else with print()
+  template <typename Printer>
+  void printDrops(Printer& out) {
+    out.print("\r\nDropped PGNs (PGN: count)");
+    for (uint8_t i = 0; i < SLOTS && dropCounters[i].drops > 0; i++) {
+      out.print("\r\n- "); out.print(dropCounters[i].pgn); out.print(": "); out.print(dropCounters[i].drops);
+    }
+    out.print("\r\n- others: "); out.print(otherDrops);
+  }
+
+private:
+  uint8_t bitmap[32];         // bit set for each PGN number to pass
+
+  void countDrop(uint8_t pgn) {
+    for (uint8_t i = 0; i < SLOTS; i++) {
+      if (dropCounters[i].drops == 0) dropCounters[i].pgn = pgn;    // first free slot, take it
+      if (dropCounters[i].pgn == pgn) {
+        if (dropCounters[i].drops < PgnDropCount(~0)) dropCounters[i].drops++;   // stop at max, 0 means a free slot
+        return;
+      }
+    }
+    if (otherDrops < PgnDropCount(~0)) otherDrops++;
+  }
+};
+
+#endif
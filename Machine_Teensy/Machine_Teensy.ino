@@ -7,10 +7,19 @@
 #include <NativeEthernetUdp.h>
 #include <IPAddress.h>
 #include "clsPCA9555.h" // https://github.com/nicoverduin/PCA9555
+//#define CYCLE_BENCH                          // uncomment to time the PGN to outputs stages in CPU cycles, 'b' on Serial prints them (see cycleBench.h)
 #include "machine.h"
+#include "pgnFramer.h"
+#include "pgnRouter.h"
 
-const uint8_t LONGER_UDP_PACKET_SIZE = 40; // currently the longest PGN is 39 (Section Dimension - 39 bytes), UDP_TX_PACKET_MAX_SIZE is only 24
-uint8_t pgnData[LONGER_UDP_PACKET_SIZE];   // Buffer For Receiving UDP Data
+const uint16_t LONGER_UDP_PACKET_SIZE = 256; // room for several PGNs in one packet, currently the longest PGN is 39 (Section Dimension - 39 bytes), UDP_TX_PACKET_MAX_SIZE is only 24
+uint8_t udpData[LONGER_UDP_PACKET_SIZE];     // Buffer For Receiving UDP Data
+
+//#define SERIAL_PGNS Serial2                // uncomment to also receive PGNs from a serial bridge
+#ifdef SERIAL_PGNS
+  uint8_t serialPgnBuffer[64];               // only needs to fit one PGN
+  PgnFramer serialFramer(serialPgnBuffer, sizeof(serialPgnBuffer));
+#endif
 
 // IP & MAC address of this module of this module
 byte myip[4] = { 192, 168, 5, 123};                 // 123 is the designated "machine module" IP
@@ -49,11 +58,21 @@ void setup() {
   if (pcaOutputs.begin()) {
     Serial.print("\r\nSection outputs (PCA9555) detected (8 channels, low side switching)");
     machine.init(&pcaOutputs, pcaOutputPinNumbers, 100);   // for PCA9555, AiO v5.0a FET output control (low side)
+    // more PCA9555 on the same bus (up to 8, for 64 outputs): PCA9555* pcaChain[] = { &pcaOutputs, &pcaOutputs2 };
+    //   machine.init(pcaChain, 2, pcaOutputPinNumbers, 100);     // pins 1-8 on the first one, 9-16 on the second etc
   }
   
   // for regular "Arduino" pin control
   machine.init(arduinoOutputPinNumbers, sizeof(arduinoOutputPinNumbers), 100);
+  //machine.speedPulse.pulsesPerKm = 130000;           // radar style GPS speed output, 130000 is 36.1hz per km/hr
+  //machine.speedPulse.begin(speedPulsePin);           // any free PWM pin
 
+#ifdef SERIAL_PGNS
+  SERIAL_PGNS.begin(115200);
+#endif
+#ifdef CYCLE_BENCH
+  cycleBench().begin();
+#endif
 
   Serial.print("\r\nEnd setup\r\n");
 }
@@ -62,13 +81,47 @@ void setup() {
 
 void loop() {
   CheckPGNs();
+#ifdef SERIAL_PGNS
+  while (SERIAL_PGNS.available()) {
+    machine.stampPacket(micros());    // a PGN is complete with its last byte
+    serialFramer.write(SERIAL_PGNS.read(), CheckPGN);
+  }
+#endif
   machine.watchdogCheck();      // used to check if UDP comms (PGN updates) have failed and turn outputs OFF
+
+  if (Serial.available()) parseSerial();
+}
+
+
+void parseSerial() {
+  char cmd = Serial.read();
+  if (cmd == 'l') {                               // print (and reset with "lr") the 64 Section Data to outputs latency histogram
+    machine.printSectionLatency();
+    if (Serial.available() && Serial.peek() == 'r') {
+      Serial.read();
+      machine.sectionLatency.reset();
+      Serial.print("\r\n- latency reset");
+    }
+  }
+  else if (cmd == 'b') {                          // print (and reset with "br") the CYCLE_BENCH stage timings
+#ifdef CYCLE_BENCH
+    cycleBench().print();
+    if (Serial.available() && Serial.peek() == 'r') {
+      Serial.read();
+      cycleBench().reset();
+      Serial.print("\r\n- cycle bench reset");
+    }
+#else
+    Serial.print("\r\nCYCLE_BENCH isn't defined");
+#endif
+  }
 }
 
 
 
 void CheckPGNs()
 {
+  CYCLE_BENCH_SCOPE(CycleBench::NETWORK);     // polling the native Ethernet, reading the packet & parsing its PGNs
   if (!Ethernet_running) {    // When ethernet is not running, return directly. parsePacket() will block when we don't
     Serial.print("***Ethernet NOT running***");
     return;
@@ -77,158 +130,142 @@ void CheckPGNs()
   uint16_t len = Eth_PGNs.parsePacket();
   if (len < 5) return;      // len needs to be > 4, because we check byte 0, 1, 2 and 3 for PGN numbers (+data bytes too)
 
-  Eth_PGNs.read(pgnData, LONGER_UDP_PACKET_SIZE);
+  machine.stampPacket(micros());      // start of the 64 Section Data to outputs latency
+  len = Eth_PGNs.read(udpData, LONGER_UDP_PACKET_SIZE);
+  PgnFramer::parseBuffer(udpData, len, CheckPGN);     // there can be more then one PGN in each packet
+}
 
-  if (pgnData[0] != 0x80 && pgnData[1] != 0x81 && pgnData[2] != 0x7F) return;      // verify the first three bytes are AoG PGN headers
-  
-  if (pgnData[3] == 0xFE)               // 0xFE (254) - Steer Data
-  {
-    /*Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print((String)" (" + pgnData[3] + ") - ");
-    //Serial.print("Steer Data");
-    //Serial.print("\n0:"); machine.printBinary(pgnData[11]);// Serial.print(" "); Serial.print(relayLo,BIN);
-    //Serial.print(" 1:"); machine.printBinary(pgnData[12]);// Serial.print(" "); Serial.print(relayHi,BIN);
-    Serial.println();*/
-  }
+// each PGN this module uses has its own handler, SketchPGNs (below) lists them
+bool machinePGNs(uint8_t *pgnData, uint8_t len)      // Machine/Section PGNs, MACHINE has its own dispatch table for these
+{
+  return machine.parsePGN(pgnData, len);
+}
 
-  else if (pgnData[3] == 0xFC)           // 0xFC (252) - Steer Settings
-  {
-    Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - ");
-    Serial.print("Steer Settings");
-  }
+bool steerSettings(uint8_t *pgnData, uint8_t len)    // 0xFC (252) - Steer Settings
+{
+  Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - ");
+  Serial.print("Steer Settings");
+  return true;
+}
 
+bool helloFromAgIO(uint8_t *pgnData, uint8_t len)    // 0xC8 (200) - Hello From AgIO
+{
+  //Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - ");
+  //Serial.print("Hello from AgIO");
 
-  else if (pgnData[3] == 0xC8)          // 0xC8 (200) - Hello From AgIO
+  if (myip[3] == 126) // this is the steer module IP, reply as steer module
   {
-    //Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - ");
-    //Serial.print("Hello from AgIO");
-
-    if (myip[3] == 126) // this is the steer module IP, reply as steer module
-    {
-      /*int16_t sa = (int16_t)(steerAngleActual * 100);
+    /*int16_t sa = (int16_t)(steerAngleActual * 100);
 
-      helloFromAutoSteer[5] = (uint8_t)sa;
-      helloFromAutoSteer[6] = sa >> 8;
-
-      helloFromAutoSteer[7] = (uint8_t)helloSteerPosition;
-      helloFromAutoSteer[8] = helloSteerPosition >> 8;
-      helloFromAutoSteer[9] = switchByte;
-
-      SendUdp(helloFromAutoSteer, sizeof(helloFromAutoSteer), Eth_ipDestination, portDestination);
-      */
-    }
-    else if (myip[3] == 123) // this is the machine module IP, reply as machine module
-    {
-      uint8_t relayLo = 0;
-      uint8_t relayHi = 0;
-      uint8_t helloFromMachine[] = { 128, 129, 123, 123, 5, relayLo, relayHi, 0, 0, 0, 71 };
-      SendUdp(helloFromMachine, sizeof(helloFromMachine), PGN_BROADCAST_IP, DEST_PORT);
-    }
-    else if (myip[3] == 121) // this is the IMU module IP, reply as IMU module
-    {
-      // should also reply even if other module but IMU is read by it
-      /*if(useBNO08x || useCMPS)
-        SendUdp(helloFromIMU, sizeof(helloFromIMU), Eth_ipDestination, portDestination); 
-      */
-    }
-    else if (myip[3] == 120) // this is the GPS module IP, reply as GPS module
-    {
-      // sending GPS data (GGA, PANDA, PAGOI etc) also sets GPS green in AgIO
-    }
-    else
-    {
-      Serial.print("\r\nUnknown module IP: ");
-      Serial.print(myip[3]);
-      Serial.print(", no reply sent to AgIO");
-    }
-  }     // end of Hello From AgIO
+    helloFromAutoSteer[5] = (uint8_t)sa;
+    helloFromAutoSteer[6] = sa >> 8;
 
+    helloFromAutoSteer[7] = (uint8_t)helloSteerPosition;
+    helloFromAutoSteer[8] = helloSteerPosition >> 8;
+    helloFromAutoSteer[9] = switchByte;
 
-  else if (pgnData[3] == 201)            // 0xC9 (201) - Subnet Change
+    SendUdp(helloFromAutoSteer, sizeof(helloFromAutoSteer), Eth_ipDestination, portDestination);
+    */
+  }
+  else if (myip[3] == 123) // this is the machine module IP, reply as machine module
   {
-    Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - ");
-    Serial.print("Subnet Change");
-    if (pgnData[4] == 5 && pgnData[5] == 201 && pgnData[6] == 201)        // make really sure this is the subnet pgn
-    {
-      myip[0] = pgnData[7];
-      myip[1] = pgnData[8];
-      myip[2] = pgnData[9];
-      Ethernet.setLocalIP(myip);  // Change IP address to IP set by PGN
-
-      //EEPROM.put(5, networkAddress); // eeprom not implement in this example
-      //delay(100);               // delay for serial/etc to finish
-      //SCB_AIRCR = 0x05FA0004;   // Teensy Reboot, not necessary
-
-    }
+    SendUdp(machine.getHelloReply(), sizeof(machine.helloReply), PGN_BROADCAST_IP, DEST_PORT);    // relayLo/Hi are the current section states
   }
-
-
-  else if (pgnData[3] == 202)            // 0xCA (202) - Scan Request
+  else if (myip[3] == 121) // this is the IMU module IP, reply as IMU module
   {
-    Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - ");
-    Serial.print("Scan Request");
-
-    if (pgnData[4] == 3 && pgnData[5] == 202 && pgnData[6] == 202) {
-      IPAddress rem_ip = Eth_PGNs.remoteIP();
-
-      #ifdef MACHINE_H
-        uint8_t scanReplyMachine[] = { 128, 129, 123, 203, 7,
-                                myip[0], myip[1], myip[2], myip[3],
-                                rem_ip[0], rem_ip[1], rem_ip[2], 23 };
-        //checksum
-        uint8_t CK_A = 0;
-        for (uint8_t i = 2; i < sizeof(scanReplyMachine) - 1; i++) {
-          CK_A = (CK_A + scanReplyMachine[i]);
-        }
-        scanReplyMachine[sizeof(scanReplyMachine) - 1] = CK_A;
-        SendUdp(scanReplyMachine, sizeof(scanReplyMachine), PGN_BROADCAST_IP, DEST_PORT);
-      #endif
-    }
-  }  // 0xCA (202) - Scan Request
-
-
-  else if (pgnData[3] == 100)           // 0x64 (100) - Corrected Position
+    // should also reply even if other module but IMU is read by it
+    /*if(useBNO08x || useCMPS)
+      SendUdp(helloFromIMU, sizeof(helloFromIMU), Eth_ipDestination, portDestination); 
+    */
+  }
+  else if (myip[3] == 120) // this is the GPS module IP, reply as GPS module
   {
-    /*
-    union {           // both variables in the union share the same memory space
-      byte array[8];  // fill "array" from an 8 byte array converted in AOG from the "double" precision number we wanted to send
-      double number;  // and the double "number" has the original "double" precision number from AOG
-    } lat, lon;
-
-    for (byte i = 0; i < 8; i++)
-    {
-      lon.array[i] = pgnData[i+5];
-      lat.array[i] = pgnData[i+13];
-    }*/
-    /*Serial.print("\r\n");
-    Serial.print(lat.number, 13);
-    Serial.print(" ");
-    Serial.print(lon.number, 13);*/
-
+    // sending GPS data (GGA, PANDA, PAGOI etc) also sets GPS green in AgIO
   }
+  else
+  {
+    Serial.print("\r\nUnknown module IP: ");
+    Serial.print(myip[3]);
+    Serial.print(", no reply sent to AgIO");
+  }
+  return true;
+}
 
-  /*else if ( pgnData[3] == 235 ||  // 0xEB (235) - Section Dimensions
-              pgnData[3] == 236 ||  // 0xEC (236) - Machine Pin Config
-              pgnData[3] == 238 ||  // 0xEE (238) - Machine Config
-              pgnData[3] == 239 ||  // 0xEF (239) - Machine Data
-              pgnData[3] == 229 ){  // 0xE5 (229) - 64 Section Data*/
-  else if (machine.parsePGN(pgnData, len))    // if no PGN matches yet, look for Machine PGNs
+bool subnetChange(uint8_t *pgnData, uint8_t len)     // 0xC9 (201) - Subnet Change
+{
+  Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - ");
+  Serial.print("Subnet Change");
+  if (pgnData[4] == 5 && pgnData[5] == 201 && pgnData[6] == 201)        // make really sure this is the subnet pgn
   {
-    //Serial.print("\r\nFound Machine/Section PGN");
+    myip[0] = pgnData[7];
+    myip[1] = pgnData[8];
+    myip[2] = pgnData[9];
+    Ethernet.setLocalIP(myip);  // Change IP address to IP set by PGN
+
+    //EEPROM.put(5, networkAddress); // eeprom not implement in this example
+    //delay(100);               // delay for serial/etc to finish
+    //SCB_AIRCR = 0x05FA0004;   // Teensy Reboot, not necessary
+
   }
+  return true;
+}
 
+bool scanRequest(uint8_t *pgnData, uint8_t len)      // 0xCA (202) - Scan Request
+{
+  Serial.print("\n0x"); Serial.print(pgnData[3], HEX); Serial.print(" ("); Serial.print(pgnData[3]); Serial.print(") - ");
+  Serial.print("Scan Request");
 
-  else    // catch & alert to all other PGN data
-  {
-    Serial.print("\r\n0x");
-    Serial.print(pgnData[3], HEX);
-    Serial.print("(");
-    Serial.print(pgnData[3]);
-    Serial.print(") - Unknown PGN data, len: ");
-    Serial.print(len);
+  if (pgnData[4] == 3 && pgnData[5] == 202 && pgnData[6] == 202) {
+    SendUdp(machine.getScanReply(myip, Eth_PGNs.remoteIP()), sizeof(machine.scanReply), PGN_BROADCAST_IP, DEST_PORT);
   }
+  return true;
+}
+
+bool latencyRequest(uint8_t *pgnData, uint8_t len)   // 0xD1 (209) - Latency Request, bit 0 of the data byte resets the histogram
+{
+  SendUdp(machine.getLatencyReply(), sizeof(machine.latencyReply), Eth_PGNs.remoteIP(), DEST_PORT);
+  machine.printSectionLatency();
+  if (pgnData[5] & 0x01) machine.sectionLatency.reset();
+  return true;
+}
+
+bool steerData(uint8_t *pgnData, uint8_t len)        // 0xFE (254) - Steer Data, only its arrival time is used here
+{
+  machine.steerDataArrived();         // AOG sends it every GPS fix, so machine.commsWatchdog learns the rate from it too
+  return true;
+}
+
+// resolved at compile time, add or remove handlers here (ie steer or IMU code on the same AiO board)
+typedef PgnRouter<
+  PgnRange<MACHINE::PGN_TABLE_FIRST, MACHINE::PGN_TABLE_FIRST + MACHINE::PGN_TABLE_SIZE - 1, machinePGNs>,
+  PgnHandler<0xC8, 9, helloFromAgIO>,
+  PgnHandler<201, 11, subnetChange>,
+  PgnHandler<202, 9, scanRequest>,
+  PgnHandler<0xFC, 14, steerSettings>,
+  PgnHandler<MACHINE::LATENCY_PGN, 7, latencyRequest>,
+  PgnHandler<0xFE, 14, steerData>,
+  PgnIgnore<100>                                        // 0x64 (100) - Corrected Position, not used but don't report it as unknown
+> SketchPGNs;
+
+PgnFilter<SketchPGNs, 16> pgnFilter;    // drops everything SketchPGNs doesn't handle in one bit test, pgnFilter.printDrops(Serial) to see what was dropped
+
+void CheckPGN(uint8_t *pgnData, uint8_t len)
+{
+  if (!pgnFilter.pass(pgnData[3])) return;
+  if (pgnData[0] != 0x80 || pgnData[1] != 0x81 || pgnData[2] != 0x7F) return;      // verify the first three bytes are AoG PGN headers
+
+  if (SketchPGNs::handle(pgnData, len)) return;
+
+  // catch & alert to PGNs that passed pgnFilter but weren't handled (ie wrong length)
+  Serial.print("\r\n0x");
+  Serial.print(pgnData[3], HEX);
+  Serial.print("(");
+  Serial.print(pgnData[3]);
+  Serial.print(") - Unknown PGN data, len: ");
+  Serial.print(len);
 }
 
-void SendUdp(uint8_t *data, uint8_t datalen, IPAddress dip, uint16_t dport)
+void SendUdp(const uint8_t *data, uint8_t datalen, IPAddress dip, uint16_t dport)
 {
   Eth_PGNs.beginPacket(dip, dport);
   Eth_PGNs.write(data, datalen);
@@ -74,6 +74,7 @@ bool PCA9555::begin() {
       return false;
     }else{
       Wire1.setClock(400000);
+      outputWriter.begin(_address, NXP_OUTPUT);
       for (uint8_t i = 0; i < 8; i++){
         pinMode(outputPins[i], OUTPUT);
         pinMode(inputPins[i], INPUT);
@@ -145,16 +146,54 @@ void PCA9555::digitalWrite(uint8_t pin, uint8_t value) {
     }
     //printBinary(_valueRegister);
     //Serial.print(_valueRegister);
-    I2CSetValue(_address, NXP_OUTPUT    , _valueRegister_low);
-    I2CSetValue(_address, NXP_OUTPUT + 1, _valueRegister_high);
+    flush();
 }
 
 void PCA9555::digitalWrite(uint16_t value) {
   _valueRegister = value;
   //printBinary(_valueRegister);
   //Serial.print(_valueRegister);
-  I2CSetValue(_address, NXP_OUTPUT    , _valueRegister_low);
-  I2CSetValue(_address, NXP_OUTPUT + 1, _valueRegister_high);
+  flush();
+}
+
+/**
+ * @name bufferWrite
+ * @param pin       pin number
+ * @param value     HIGH or LOW
+ * Sets the pin in _valueRegister without any I2C traffic, call flush() after setting all the pins
+ */
+void PCA9555::bufferWrite(uint8_t pin, uint8_t value) {
+    if (pin > 15) {
+        _error = 255;            // invalid pin
+        return;
+    }
+    if (value > 0) {
+        _valueRegister = _valueRegister | (1 << pin);
+    } else {
+        _valueRegister = _valueRegister & ~(1 << pin);
+    }
+}
+
+/**
+ * @name bufferWriteMask
+ * @param mask      pins to set, bit n is pin n
+ * @param value     HIGH/LOW for each pin in mask, bit n is pin n
+ * Sets several pins in _valueRegister at once without any I2C traffic, the pins not in mask are left alone
+ */
+void PCA9555::bufferWriteMask(uint16_t mask, uint16_t value) {
+    _valueRegister = (_valueRegister & ~mask) | (value & mask);
+}
+
+/**
+ * @name flush
+ * @return true if the output registers were queued
+ * Queues both output port registers for one transaction (the PCA9555 auto increments to the
+ * second register of the pair), only if _valueRegister changed since it was last sent.
+ * Returns right away, outputWriter sends it from the I2C interrupt (Teensy 4.x), if a transfer is
+ * already in flight only the latest value is sent after it
+ */
+bool PCA9555::flush() {
+    return outputWriter.write(_valueRegister);
 }
 
 void PCA9555::printBinary(uint16_t var) {
@@ -222,6 +261,7 @@ void PCA9555::alertISR()
  */
 uint16_t PCA9555::I2CGetValue(uint8_t address, uint8_t reg) {
     uint16_t _inputData;
+    outputWriter.waitIdle();                   // Wire1 is ours only when outputWriter is done with it
     //
     // read the address input register
     //
@@ -253,6 +293,7 @@ uint16_t PCA9555::I2CGetValue(uint8_t address, uint8_t reg) {
  * Write the value given to the register set to selected chip.
  */
 void PCA9555::I2CSetValue(uint8_t address, uint8_t reg, uint8_t value){
+    outputWriter.waitIdle();                       // Wire1 is ours only when outputWriter is done with it
     //
     // write output register to chip
     //
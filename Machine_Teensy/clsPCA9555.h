@@ -14,6 +14,8 @@
 #include "WProgram.h"
 #endif
 
+#include "i2cAsyncWriter.h"
+
 #define DEBUG 1
 
 /** enum with names of ports ED0 - ED15 */
@@ -43,6 +45,9 @@ public:
     uint8_t digitalRead(uint8_t pin);                    // digitalRead
     void digitalWrite(uint8_t pin, uint8_t value );      // digitalWrite
     void digitalWrite(uint16_t value );                  // bulk/fast digitalWrite
+    void bufferWrite(uint8_t pin, uint8_t value);        // like digitalWrite but only changes _valueRegister, flush() sends it
+    void bufferWriteMask(uint16_t mask, uint16_t value); // bufferWrite() for all the pins set in mask at once, bit n of value is pin n
+    bool flush();                                        // queues one 2 byte write of the outputs if _valueRegister changed, true if it was queued, doesn't wait for the bus
     uint8_t stateOfPin(uint8_t pin);                     // Actual ISR
     void setClock(uint32_t clockFrequency);              // Clock speed
     bool begin();                                        // Checks if PCA is responsive
@@ -50,6 +55,7 @@ public:
     bool enabled;
     const uint8_t outputPins[8] = { 1, 0, 12, 15, 9, 8, 6, 7 };
     const uint8_t inputPins[8]  = { 14, 13, 11, 10, 2, 3, 4, 5 };
+    I2cAsyncWriter outputWriter;                         // non-blocking output writes, transfers/coalesced/errors counters
 
 private:
     static PCA9555* instancePointer;
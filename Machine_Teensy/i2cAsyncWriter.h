@@ -0,0 +1,245 @@
+/*
+  Non-blocking writes of a 16 bit register pair over I2C (the PCA9555 output registers), so PGN parsing never waits on the bus
+    - write() queues the value and returns, the transfer is started right away or as soon as the bus is free
+    - values written while a transfer is in flight are coalesced, only the latest one is sent (outputs only care about the last state)
+    - a value that's already on the chip (or on its way) isn't sent again
+    - one writer per device, up to MAX_WRITERS on the bus (ie 8 PCA9555), devices waiting for the bus are served in turn
+    - Teensy 4.x: driven by the LPI2C3 (Wire1) interrupt, Wire1.begin() has to be called first for the pins/clock/timing
+    - Host_Bench: mock bus in stub/Arduino.h that takes as long as a real 400khz transfer (in HostClock time), hostI2cBus().poll() plays the interrupt
+    - anything else: blocking Wire1 transfer inside write()
+    - any blocking Wire1 use (reads, config writes) needs waitIdle() first, PCA9555 does this in its I2C functions
+*/
+
+#ifndef I2CASYNCWRITER_H
+#define I2CASYNCWRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if !defined(__IMXRT1062__) && !defined(HOST_I2C_BUS)
+  #include <Wire.h>
+#endif
+
+class I2cAsyncWriter
+{
+public:
+  static const uint8_t MAX_WRITERS = 8;   // a PCA9555 has 8 addresses
+
+  uint32_t transfers = 0;       // started
+  uint32_t coalesced = 0;       // queued values replaced by a newer one before they were sent
+  uint32_t errors = 0;          // NACK, arbitration lost, timeouts
+
+  // false if there are already MAX_WRITERS on the bus, write() then does nothing
+  bool begin(uint8_t _address, uint8_t _reg)
+  {
+    address = _address;
+    reg = _reg;
+    if (isBegun) return true;
+    Bus& b = bus();
+    if (b.numWriters == MAX_WRITERS) return false;
+    index = b.numWriters;
+    b.writers[b.numWriters++] = this;
+    if (index == 0) busBegin();
+    isBegun = true;
+    return true;
+  }
+
+  // true if value was queued, false if it's already on the chip (or on its way) or begin() didn't work
+  bool write(uint16_t value)
+  {
+    if (!isBegun) return false;
+    noInterrupts();
+    uint16_t latest = (hasPending ? pending : isSending ? sending : sent);
+    if ((isSent || isSending || hasPending) && value == latest) {
+      interrupts();
+      return false;
+    }
+    if (hasPending) coalesced++;
+    pending = value;
+    hasPending = true;
+    Bus& b = bus();
+    if (b.current == NULL) startNext(index + b.numWriters - 1);    // this one first
+    interrupts();
+    return true;
+  }
+
+  bool isBusy() { return isSending || hasPending; }
+
+  // waits until nothing is in flight or queued for any device on the bus, gives up after timeoutUs
+  static bool waitIdle(uint32_t timeoutUs = 2000)
+  {
+    Bus& b = bus();
+    uint32_t start = micros();
+    while (b.current != NULL) {         // transferDone() starts the next queued value before the bus is seen free
+      if (micros() - start > timeoutUs) {
+        noInterrupts();
+        busAbort();
+        for (uint8_t i = 0; i < b.numWriters; i++) {
+          I2cAsyncWriter* w = b.writers[i];
+          if (w->isSending) w->errors++;
+          w->isSending = w->hasPending = false;
+          w->isSent = false;            // don't know what the chip has, send the next value no matter what
+        }
+        b.current = NULL;
+        interrupts();
+        return false;
+      }
+  #ifdef HOST_I2C_BUS
+      hostI2cBus().finish();            // no interrupts on the host, and HostClock might not be moving
+  #endif
+    }
+    return true;
+  }
+
+  // called from the bus interrupt (or by the mock bus)
+  static void transferDone(bool isOK)
+  {
+    Bus& b = bus();
+    I2cAsyncWriter* w = b.current;
+    if (w == NULL) return;
+    w->complete(isOK);
+    b.current = NULL;
+    startNext(w->index);                // the next device after this one with something queued
+  }
+
+private:
+  uint8_t address;
+  uint8_t reg;
+  uint8_t index;                // in bus().writers[]
+  bool isBegun = false;
+  volatile bool isSending = false;
+  volatile bool hasPending = false;
+  volatile bool isSent = false;
+  volatile uint16_t pending;
+  volatile uint16_t sending;
+  volatile uint16_t sent;
+
+  struct Bus {
+    I2cAsyncWriter* writers[MAX_WRITERS];
+    uint8_t numWriters;
+    I2cAsyncWriter* volatile current;   // transfer in flight, NULL if the bus is free
+    volatile bool isStopQueued;         // LPI2C only
+  };
+  static Bus& bus() { static Bus b = {}; return b; }
+
+  void complete(bool isOK)
+  {
+    isSending = false;
+    if (isOK) {
+      sent = sending;
+      isSent = true;
+    } else {
+      errors++;
+      isSent = false;           // no automatic retry, the next write() is sent no matter what
+    }
+  }
+
+  // starts the first writer after writers[after] with a new value queued, interrupts off
+  static void startNext(uint8_t after)
+  {
+    Bus& b = bus();
+    for (uint8_t i = 1; i <= b.numWriters; i++) {
+      I2cAsyncWriter* w = b.writers[(after + i) % b.numWriters];
+      if (!w->hasPending) continue;
+      w->hasPending = false;
+      if (w->isSent && w->pending == w->sent) continue;    // changed back before it was sent
+      w->sending = w->pending;
+      w->isSending = true;
+      w->transfers++;
+      b.current = w;
+      if (busStart(w)) return;
+      b.current = NULL;                 // blocking bus, busStart() already finished it
+    }
+  }
+
+#if defined(__IMXRT1062__)
+  // ******************************** Teensy 4.x, LPI2C3 (Wire1) ********************************
+  static const uint32_t CMD_TRANSMIT = 0 << 8;
+  static const uint32_t CMD_STOP = 2 << 8;
+  static const uint32_t CMD_START = 4 << 8;
+  static const uint32_t ERROR_FLAGS = LPI2C_MSR_NDF | LPI2C_MSR_ALF | LPI2C_MSR_FEF | LPI2C_MSR_PLTF;
+
+  static void busBegin()
+  {
+    attachInterruptVector(IRQ_LPI2C3, lpi2cIsr);
+    NVIC_SET_PRIORITY(IRQ_LPI2C3, 144);         // below Ethernet (128)
+    NVIC_ENABLE_IRQ(IRQ_LPI2C3);
+  }
+
+  // true if the transfer was started, lpi2cIsr() finishes it
+  static bool busStart(I2cAsyncWriter* w)
+  {
+    IMXRT_LPI2C_t& port = IMXRT_LPI2C3;
+    port.MSR = ERROR_FLAGS | LPI2C_MSR_SDF | LPI2C_MSR_EPF;     // write 1 to clear
+    port.MTDR = CMD_START | (w->address << 1);  // TX FIFO is 4 words, the STOP goes in from the TDF interrupt
+    port.MTDR = CMD_TRANSMIT | w->reg;
+    port.MTDR = CMD_TRANSMIT | (w->sending & 0xFF);
+    port.MTDR = CMD_TRANSMIT | (w->sending >> 8);
+    bus().isStopQueued = false;
+    port.MIER = LPI2C_MIER_TDIE | LPI2C_MIER_SDIE | LPI2C_MIER_NDIE | LPI2C_MIER_ALIE | LPI2C_MIER_FEIE | LPI2C_MIER_PLTIE;
+    return true;
+  }
+
+  static void busAbort()
+  {
+    IMXRT_LPI2C_t& port = IMXRT_LPI2C3;
+    port.MIER = 0;
+    port.MCR |= LPI2C_MCR_RTF | LPI2C_MCR_RRF;  // empty the FIFOs
+    port.MSR = ERROR_FLAGS | LPI2C_MSR_SDF | LPI2C_MSR_EPF;
+  }
+
+  static void lpi2cIsr()
+  {
+    IMXRT_LPI2C_t& port = IMXRT_LPI2C3;
+    Bus& b = bus();
+    uint32_t status = port.MSR;
+
+    if (status & ERROR_FLAGS) {
+      port.MIER = 0;
+      port.MCR |= LPI2C_MCR_RTF | LPI2C_MCR_RRF;
+      if (status & LPI2C_MSR_NDF) port.MTDR = CMD_STOP;      // no ACK (chip missing?), release the bus
+      port.MSR = status;
+      transferDone(false);
+    } else {
+      if ((status & LPI2C_MSR_TDF) && !b.isStopQueued) {
+        port.MTDR = CMD_STOP;
+        b.isStopQueued = true;
+        port.MIER &= ~LPI2C_MIER_TDIE;
+      }
+      if (status & LPI2C_MSR_SDF) {
+        port.MSR = LPI2C_MSR_SDF;
+        port.MIER = 0;
+        transferDone(true);
+      }
+    }
+    asm volatile("dsb");        // make sure the flags are cleared before returning, or the ISR runs twice
+  }
+
+#elif defined(HOST_I2C_BUS)
+  // ******************************** Host_Bench mock bus ****************************************
+  static void busBegin() {}
+  static bool busStart(I2cAsyncWriter* w)
+  {
+    uint8_t data[3] = { w->reg, uint8_t(w->sending & 0xFF), uint8_t(w->sending >> 8) };
+    hostI2cBus().start(w->address, data, sizeof(data), transferDone);
+    return true;
+  }
+  static void busAbort() { hostI2cBus().abort(); }
+
+#else
+  // ******************************** anything else, blocking Wire1 ******************************
+  static void busBegin() {}
+  static bool busStart(I2cAsyncWriter* w)
+  {
+    Wire1.beginTransmission(w->address);
+    Wire1.write(w->reg);
+    Wire1.write(uint8_t(w->sending & 0xFF));
+    Wire1.write(uint8_t(w->sending >> 8));
+    w->complete(Wire1.endTransmission() == 0);
+    return false;               // already done
+  }
+  static void busAbort() {}
+#endif
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*
+  Valve/clutch latency compensation for the section outputs
+    - AOG switches sections early by its look ahead on/off times (Tool > Sections), one setting for every section
+    - real valves & clutches take 100-500ms to respond, not the same time to open as to close and not the same on every section
+    - each edge is held back by: look ahead - valve delay + the time it takes to travel behindCm at the section's own speed
+      so the product starts & stops on the line AOG switched for, instead of late
+      - an edge can't go out before AOG sends it, so AOG's look ahead has to be at least the slowest valve delay
+    - section speed is the GPS speed spread across the tool by the 64 Section Data left/right tool speeds (faster on the outside of a turn)
+      using the section offsets from the Section Dimensions PGN, sections without dimensions use the GPS speed
+    - command() takes the new section states from the PGN, edges with no delay go out right away
+    - update() applies the edges that came due, they go out on the first call at or after their due ms so their jitter is
+      however often it's called, no timer of its own
+      - MACHINE calls it from watchdogCheck() in loop(), so on its own that's the loop period + whatever Ethernet/UDP/Serial
+        work lands in it (a few ms on a busy network)
+      - with the output scheduler running MACHINE stamps the edges with dueMs instead of when loop() got to them, so they're
+        written on the scheduler's timer a fixed latency after they came due, the loop period only has to be under the latency
+    - turned off (isEnabled false) the outputs just follow the PGN
+
+  Example:
+    machine.sectionTiming.lookAheadOnMs = 500;        // same as AOG's look ahead on/off
+    machine.sectionTiming.lookAheadOffMs = 300;
+    machine.sectionTiming.setValveDelays(350, 150);   // all sections open in 350ms, close in 150ms
+    machine.sectionTiming.setSection(0, 450, 150, 60); // section 1 is slower, and 60cm behind the others
+    machine.sectionTiming.isEnabled = true;
+*/
+
+#ifndef SECTIONTIMING_H
+#define SECTIONTIMING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+template <uint8_t MAX_SECTIONS = 64, typename Bits = uint64_t>
+class SectionTiming
+{
+public:
+  bool isEnabled = false;
+  uint16_t lookAheadOnMs = 0;       // how early AOG sends ON (AOG's look ahead on)
+  uint16_t lookAheadOffMs = 0;      // how early AOG sends OFF
+  uint16_t maxDelayMs = 3000;       // longest an edge is held, ie creeping along with behindCm set
+
+  Bits outputs = 0;                 // compensated section states for the outputs, bit 0 is section 1
+  Bits changed = 0;                 // outputs changed by the last command()/update(), so the old states are outputs ^ changed
+  uint16_t dueMs = 0;               // when the edges the last update() applied were due, the latest of them
+
+  // sections past MAX_SECTIONS aren't compensated
+  void setValveDelays(uint16_t onMs, uint16_t offMs)
+  {
+    for (uint8_t i = 0; i < MAX_SECTIONS; i++) {
+      sections[i].onDelayMs = onMs;
+      sections[i].offDelayMs = offMs;
+    }
+  }
+
+  // secNum 0 is section 1, behindCm is how far the outlet is behind where AOG switches the section (-ve is ahead)
+  void setSection(uint8_t secNum, uint16_t onMs, uint16_t offMs, int16_t behindCm = 0)
+  {
+    if (secNum >= MAX_SECTIONS) return;
+    sections[secNum].onDelayMs = onMs;
+    sections[secNum].offDelayMs = offMs;
+    sections[secNum].behindCm = behindCm;
+  }
+
+  // offsets from the centre of the machine to the centre of each section (cm, left is -ve), kept by pointer
+  void setGeometry(const int16_t* _offsetCm, uint8_t _numOffsets, uint16_t _totalWidth)
+  {
+    offsetCm = _offsetCm;
+    numOffsets = _numOffsets;
+    totalWidth = _totalWidth;
+  }
+
+  // new section states from AOG, speeds are as sent (gpsSpeed km/hr * 10), true if any outputs changed right away
+  bool command(Bits states, uint16_t nowMs, uint8_t _gpsSpeed, uint8_t _leftSpeed, uint8_t _rightSpeed)
+  {
+    gpsSpeed = _gpsSpeed;
+    leftSpeed = _leftSpeed;
+    rightSpeed = _rightSpeed;
+
+    Bits newEdges = states ^ target;
+    target = states;
+    if (!isEnabled) {
+      pending = 0;
+      changed = outputs ^ states;
+      outputs = states;
+      return changed != 0;
+    }
+
+    Bits now = 0, bit = 1;
+    for (uint8_t i = 0; newEdges; i++, bit <<= 1, newEdges >>= 1) {
+      if (!(newEdges & 1)) continue;
+      pending &= ~bit;
+      if (!((outputs ^ states) & bit)) continue;        // changed back before the last edge went out, it never does
+      uint16_t delay = (i < MAX_SECTIONS ? edgeDelay(i, states & bit) : 0);
+      if (delay == 0) {
+        now |= bit;
+      } else {
+        sections[i].dueMs = nowMs + delay;
+        pending |= bit;
+      }
+    }
+
+    changed = now;
+    outputs ^= now;
+    return changed != 0;
+  }
+
+  // applies the edges that came due, true if any outputs changed
+  bool update(uint16_t nowMs)
+  {
+    changed = 0;
+    if (!pending) return false;
+
+    Bits due = 0, bit = 1, p = pending;
+    for (uint8_t i = 0; p; i++, bit <<= 1, p >>= 1) {
+      if (!(p & 1) || int16_t(nowMs - sections[i].dueMs) < 0) continue;
+      if (!due || int16_t(sections[i].dueMs - dueMs) > 0) dueMs = sections[i].dueMs;
+      due |= bit;
+    }
+    if (!due) return false;
+
+    pending &= ~due;
+    changed = (outputs ^ target) & due;
+    outputs ^= changed;
+    return changed != 0;
+  }
+
+  bool isPending() { return pending != 0; }
+
+  // all OFF right now, nothing pending (ie watchdog timeout)
+  void reset()
+  {
+    changed = outputs;
+    outputs = target = pending = 0;
+  }
+
+  // how long an edge of section i is held back, ms
+  uint16_t edgeDelay(uint8_t i, bool isOn)
+  {
+    const Section& s = sections[i];
+    int32_t ms = int32_t(isOn ? lookAheadOnMs : lookAheadOffMs) - int32_t(isOn ? s.onDelayMs : s.offDelayMs);
+    if (s.behindCm != 0) {
+      float speed = sectionSpeed(i);
+      if (speed > 0.5f) ms += int32_t(s.behindCm * 360.0f / speed);    // km/hr * 10 is 1/360 cm per ms
+    }
+    if (ms < 0) return 0;
+    return (ms > maxDelayMs ? maxDelayMs : uint16_t(ms));
+  }
+
+  // km/hr * 10 at the centre of section i
+  float sectionSpeed(uint8_t i)
+  {
+    uint16_t edges = leftSpeed + rightSpeed;
+    if (edges == 0 || totalWidth == 0 || offsetCm == NULL || i >= numOffsets) return gpsSpeed;
+    float fromLeft = (offsetCm[i] + totalWidth / 2) / float(totalWidth);    // 0 at the left edge of the tool, 1 at the right
+    return gpsSpeed * (leftSpeed + (int16_t(rightSpeed) - leftSpeed) * fromLeft) * 2 / edges;
+  }
+
+private:
+  struct Section {
+    uint16_t onDelayMs;         // command to product on the ground
+    uint16_t offDelayMs;
+    int16_t behindCm;
+    uint16_t dueMs;             // when the pending edge goes out, 16 bits is plenty for maxDelayMs
+  } sections[MAX_SECTIONS] = {};
+
+  Bits target = 0;              // latest states from AOG
+  Bits pending = 0;             // sections with an edge waiting for dueMs
+
+  uint8_t gpsSpeed = 0;
+  uint8_t leftSpeed = 0;
+  uint8_t rightSpeed = 0;
+  const int16_t* offsetCm = NULL;
+  uint8_t numOffsets = 0;
+  uint16_t totalWidth = 0;
+};
+
+#endif